@@ -0,0 +1,57 @@
+#include "alloccounter.h"
+#include <cstdlib>
+#include <new>
+
+#ifdef NODESTUFF_COUNT_ALLOCATIONS
+
+static thread_local uint64_t allocationCount = 0;
+
+void *operator new(std::size_t size)
+{
+    ++allocationCount;
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace AllocCounter {
+
+bool isEnabled()
+{
+    return true;
+}
+
+uint64_t count()
+{
+    return allocationCount;
+}
+
+} // namespace
+
+#else
+
+namespace AllocCounter {
+
+bool isEnabled()
+{
+    return false;
+}
+
+uint64_t count()
+{
+    return 0;
+}
+
+} // namespace
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef ALLOCCOUNTER_H
+#define ALLOCCOUNTER_H
+
+#include <cstdint>
+
+// Counts heap allocations made through the global operator new on the
+// calling thread. Only active when built with NODESTUFF_COUNT_ALLOCATIONS,
+// otherwise count() always returns 0.
+namespace AllocCounter {
+
+bool isEnabled();
+uint64_t count();
+
+} // namespace
+
+#endif
@@ -0,0 +1,257 @@
+#include "attributefile.h"
+#include "valuearray.h"
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ATTRIBUTEFILE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static const char MAGIC[8] = { 'N', 'O', 'D', 'E', 'A', 'T', 'T', 'R' };
+
+struct Header
+{
+    char magic[8];
+    uint32_t components;
+    uint32_t layout;
+    uint64_t count;
+    uint64_t stride;
+    uint64_t offset;
+};
+
+static PortDataType arrayTypeFor(size_t components)
+{
+    switch (components) {
+    case 1:
+        return PortDataType::FloatArray;
+    case 2:
+        return PortDataType::Vec2Array;
+    case 3:
+        return PortDataType::Vec3Array;
+    case 4:
+        return PortDataType::Vec4Array;
+    case 16:
+        return PortDataType::Mat4Array;
+    default:
+        return PortDataType::Empty;
+    }
+}
+
+static size_t recordComponents(const std::string &recordType)
+{
+    static const struct {
+        const char *name;
+        size_t components;
+    } recordTypes[] = { { "float", 1 }, { "vec2", 2 }, { "vec3", 3 }, { "vec4", 4 }, { "mat4", 16 } };
+    for (const auto &t : recordTypes) {
+        if (recordType == t.name)
+            return t.components;
+    }
+    return 0;
+}
+
+static inline size_t componentCount(PortDataType type)
+{
+    switch (type) {
+    case PortDataType::FloatArray:
+        return 1;
+    case PortDataType::Vec2Array:
+        return 2;
+    case PortDataType::Vec3Array:
+        return 3;
+    case PortDataType::Vec4Array:
+        return 4;
+    default:
+        return 16;
+    }
+}
+
+static inline size_t padded(size_t n)
+{
+    return (n + FloatArray::PADDING - 1) / FloatArray::PADDING * FloatArray::PADDING;
+}
+
+std::shared_ptr<const AttributeFile> AttributeFile::open(const std::string &fileName, const std::string &recordType,
+                                                         std::string *error)
+{
+    auto fail = [error, &fileName](const char *what) {
+        if (error)
+            *error = fileName + ": " + what;
+        return nullptr;
+    };
+
+    std::shared_ptr<AttributeFile> file(new AttributeFile);
+    const char *bytes = nullptr;
+    size_t size = 0;
+
+#ifdef ATTRIBUTEFILE_MMAP
+    const int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+        return fail("cannot open");
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return fail("not a file");
+    }
+    size = size_t(st.st_size);
+    if (size) {
+        // pages are read on first access, read-ahead by the kernel
+        void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            ::close(fd);
+            return fail("cannot map");
+        }
+        madvise(p, size, MADV_SEQUENTIAL);
+        file->mapping = p;
+        file->mappingSize = size;
+        bytes = static_cast<const char *>(p);
+    }
+    // the mapping stays valid without it
+    ::close(fd);
+#else
+    std::ifstream f(fileName, std::ios::binary | std::ios::ate);
+    if (!f)
+        return fail("cannot open");
+    size = size_t(f.tellg());
+    file->contents.resize(size);
+    f.seekg(0);
+    if (!f.read(file->contents.data(), std::streamsize(size)))
+        return fail("cannot read");
+    bytes = file->contents.data();
+#endif
+
+    size_t components = 0;
+    size_t offset = 0;
+    Header h;
+    if (size >= sizeof(h) && !memcmp(bytes, MAGIC, sizeof(MAGIC))) {
+        memcpy(&h, bytes, sizeof(h));
+        components = h.components;
+        offset = size_t(h.offset);
+        file->count = size_t(h.count);
+        file->planar = h.layout == 1;
+        file->stride = file->planar ? size_t(h.stride) : 0;
+        if (arrayTypeFor(components) == PortDataType::Empty || h.layout > 1 || (file->planar && file->stride < file->count))
+            return fail("invalid header");
+        if (offset % sizeof(float) || offset > size)
+            return fail("invalid offset");
+        if (file->count > size || file->stride > size)
+            return fail("not enough records");
+        const size_t floats = file->planar ? (components - 1) * file->stride + file->count : components * file->count;
+        if ((size - offset) / sizeof(float) < floats)
+            return fail("not enough records");
+    } else {
+        components = recordComponents(recordType);
+        if (!components)
+            return fail("unknown record type");
+        file->count = size / (components * sizeof(float));
+    }
+    file->type = arrayTypeFor(components);
+    file->first = reinterpret_cast<const float *>(bytes + offset);
+    return file;
+}
+
+AttributeFile::~AttributeFile()
+{
+#ifdef ATTRIBUTEFILE_MMAP
+    if (mapping)
+        munmap(mapping, mappingSize);
+#endif
+}
+
+bool AttributeFile::viewable() const
+{
+    if (!mapping || !planar || stride % FloatArray::PADDING)
+        return false;
+    // the padding after the last component is read as well
+    const size_t begin = size_t(reinterpret_cast<const char *>(first) - static_cast<const char *>(mapping));
+    const size_t floats = (componentCount(type) - 1) * stride + padded(count);
+    return begin % 64 == 0 && (mappingSize - begin) / sizeof(float) >= floats;
+}
+
+#ifdef ATTRIBUTEFILE_MMAP
+// Page faults map the pages around the faulting one as well, so reading
+// on maps some of those released before again. Releasing starts this far
+// back, which catches them.
+static const uintptr_t RELEASE_BEHIND = 1 << 20;
+
+// the whole pages before p + n, back to RELEASE_BEHIND before p but not
+// before the beginning of the mapping
+static void releasePages(const void *mapping, const float *p, size_t n)
+{
+    static const uintptr_t pageSize = uintptr_t(sysconf(_SC_PAGESIZE));
+    const uintptr_t base = reinterpret_cast<uintptr_t>(mapping);
+    const uintptr_t from = reinterpret_cast<uintptr_t>(p);
+    const uintptr_t begin = (from - base > RELEASE_BEHIND ? from - RELEASE_BEHIND : base) & ~(pageSize - 1);
+    const uintptr_t end = reinterpret_cast<uintptr_t>(p + n) & ~(pageSize - 1);
+    if (begin < end)
+        madvise(reinterpret_cast<void *>(begin), end - begin, MADV_DONTNEED);
+}
+#endif
+
+void AttributeFile::release(size_t firstRecord, size_t n) const
+{
+#ifdef ATTRIBUTEFILE_MMAP
+    firstRecord = std::min(firstRecord, count);
+    n = std::min(n, count - firstRecord);
+    if (!mapping || !n)
+        return;
+    const size_t components = componentCount(type);
+    if (planar) {
+        for (size_t c = 0; c < components; ++c)
+            releasePages(mapping, first + c * stride + firstRecord, n);
+    } else {
+        releasePages(mapping, first + firstRecord * components, n * components);
+    }
+#else
+    (void) firstRecord;
+    (void) n;
+#endif
+}
+
+template<typename T>
+static void readRecords(const AttributeFile &file, size_t firstRecord, size_t n, ValueArray<T> &a)
+{
+    constexpr int COMPONENTS = ValueArray<T>::COMPONENTS;
+    a.resize(n);
+    for (int c = 0; c < COMPONENTS; ++c) {
+        float *dst = a.component(c);
+        if (file.planar) {
+            std::copy_n(file.first + c * file.stride + firstRecord, n, dst);
+        } else {
+            const float *src = file.first + firstRecord * COMPONENTS + c;
+            for (size_t i = 0; i < n; ++i)
+                dst[i] = src[i * COMPONENTS];
+        }
+    }
+}
+
+void AttributeFile::read(size_t firstRecord, size_t n, void *array) const
+{
+    firstRecord = std::min(firstRecord, count);
+    n = std::min(n, count - firstRecord);
+    switch (type) {
+    case PortDataType::FloatArray:
+        readRecords(*this, firstRecord, n, *static_cast<FloatArray *>(array));
+        break;
+    case PortDataType::Vec2Array:
+        readRecords(*this, firstRecord, n, *static_cast<Vec2Array *>(array));
+        break;
+    case PortDataType::Vec3Array:
+        readRecords(*this, firstRecord, n, *static_cast<Vec3Array *>(array));
+        break;
+    case PortDataType::Vec4Array:
+        readRecords(*this, firstRecord, n, *static_cast<Vec4Array *>(array));
+        break;
+    case PortDataType::Mat4Array:
+        readRecords(*this, firstRecord, n, *static_cast<Mat4Array *>(array));
+        break;
+    default:
+        break;
+    }
+}
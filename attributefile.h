@@ -0,0 +1,63 @@
+#ifndef ATTRIBUTEFILE_H
+#define ATTRIBUTEFILE_H
+
+#include "portdata.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// A binary file of float, vec2, vec3, vec4 or mat4 records, mapped into
+// memory rather than read: opening it takes the same time whatever its
+// size, and pages are only read from disk once the evaluator gets to them,
+// front to back. A file either starts with a header, in the byte order of
+// the machine:
+//
+//     "NODEATTR"
+//     uint32 components: 1, 2, 3, 4 or 16 (mat4, column-major)
+//     uint32 layout: 0 = records one after the other, 1 = planar, a run of floats per component
+//     uint64 record count
+//     uint64 stride: planar only, floats from the start of one component to the next
+//     uint64 offset: bytes from the start of the file to the first float
+//
+// or is nothing but records of a type given when opening it. Planar files
+// whose runs are a multiple of 16 floats apart and padded like those of a
+// ValueArray (offset a multiple of 64) can be used in place, as a view of
+// the mapping. Everything else is copied into arrays, see read().
+struct AttributeFile
+{
+    PortDataType type = PortDataType::Empty; // of the array
+    size_t count = 0; // records
+    bool planar = false;
+    size_t stride = 0; // floats, planar only
+    const float *first = nullptr;
+
+    // Null, with error set, when the file cannot be opened or is too
+    // short. recordType, one of "float", "vec2", "vec3", "vec4" or "mat4",
+    // is that of the records of files without a header.
+    static std::shared_ptr<const AttributeFile> open(const std::string &fileName, const std::string &recordType,
+                                                     std::string *error = nullptr);
+
+    AttributeFile() = default;
+    AttributeFile(const AttributeFile &) = delete;
+    AttributeFile &operator=(const AttributeFile &) = delete;
+    ~AttributeFile();
+
+    // true when ValueArray::view(first, stride, count) is valid
+    bool viewable() const;
+
+    // Copies records from firstRecord on into array, a ValueArray of type
+    // resized to at most n elements.
+    void read(size_t firstRecord, size_t n, void *array) const;
+
+    // Drops the pages of n records from firstRecord on from memory, for a
+    // reader that is done with them. They are read from disk again when
+    // needed.
+    void release(size_t firstRecord, size_t n) const;
+
+private:
+    void *mapping = nullptr;
+    size_t mappingSize = 0;
+    std::vector<char> contents; // where files cannot be mapped
+};
+
+#endif
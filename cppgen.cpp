@@ -0,0 +1,480 @@
+#include "cppgen.h"
+#include "graph.h"
+#include "grapheval.h"
+#include <unordered_set>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace CppGen {
+
+static const char *typeName(PortDataType type)
+{
+    switch (type) {
+    case PortDataType::Float:
+        return "float";
+    case PortDataType::Vec2:
+        return "glm::vec2";
+    case PortDataType::Vec3:
+        return "glm::vec3";
+    case PortDataType::Vec4:
+        return "glm::vec4";
+    case PortDataType::Mat3:
+        return "glm::mat3";
+    case PortDataType::Mat4:
+        return "glm::mat4";
+    default:
+        return nullptr;
+    }
+}
+
+// number of floats in a value
+static inline int floatCount(PortDataType type)
+{
+    switch (type) {
+    case PortDataType::Float:
+        return 1;
+    case PortDataType::Vec2:
+        return 2;
+    case PortDataType::Vec3:
+        return 3;
+    case PortDataType::Vec4:
+        return 4;
+    case PortDataType::Mat3:
+        return 9;
+    case PortDataType::Mat4:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+// %.9g is enough to round trip any float
+static std::string floatLiteral(float f)
+{
+    if (std::isnan(f))
+        return "std::numeric_limits<float>::quiet_NaN()";
+    if (std::isinf(f))
+        return f > 0 ? "std::numeric_limits<float>::infinity()" : "-std::numeric_limits<float>::infinity()";
+    char s[32];
+    snprintf(s, sizeof(s), "%.9g", f);
+    std::string result(s);
+    if (result.find_first_of(".e") == std::string::npos)
+        result += ".0";
+    return result + 'f';
+}
+
+static std::string constructor(const char *type, const float *v, int count)
+{
+    std::string result(type);
+    result += '(';
+    for (int i = 0; i < count; ++i) {
+        if (i)
+            result += ", ";
+        result += floatLiteral(v[i]);
+    }
+    result += ')';
+    return result;
+}
+
+static std::string literal(const PortDataVar &d)
+{
+    return std::visit([](auto &&arg) -> std::string {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, PortDataFloat>)
+            return floatLiteral(arg.v);
+        else if constexpr (std::is_same_v<T, PortDataVec2>)
+            return constructor("glm::vec2", glm::value_ptr(arg.v), 2);
+        else if constexpr (std::is_same_v<T, PortDataVec3>)
+            return constructor("glm::vec3", glm::value_ptr(arg.v), 3);
+        else if constexpr (std::is_same_v<T, PortDataVec4>)
+            return constructor("glm::vec4", glm::value_ptr(arg.v), 4);
+        else if constexpr (std::is_same_v<T, PortDataMat3>)
+            return constructor("glm::mat3", glm::value_ptr(arg.v), 9); // column major
+        else if constexpr (std::is_same_v<T, PortDataMat4>)
+            return constructor("glm::mat4", glm::value_ptr(arg.v), 16);
+        else
+            return std::string();
+    }, d);
+}
+
+static std::string valueName(Id id)
+{
+    return "v" + std::to_string(id);
+}
+
+static std::string memberName(Id id)
+{
+    return "n" + std::to_string(id);
+}
+
+static std::string component(const std::string &a, int i)
+{
+    return a + '[' + std::to_string(i) + ']';
+}
+
+// The expression for the node, spelled exactly like its kernel in
+// grapheval.cpp, or empty when there is none.
+static std::string expression(const Node &n, const std::vector<std::string> &args, const std::vector<PortDataType> &argTypes)
+{
+    switch (n.type) {
+    case NodeType::Vec2Cast:
+        return argTypes[0] == PortDataType::Vec2 ? args[0] : "glm::vec2(" + args[0] + ')';
+    case NodeType::Vec3Cast:
+        switch (argTypes[0]) {
+        case PortDataType::Float:
+            return "glm::vec3(" + args[0] + ')';
+        case PortDataType::Vec2:
+            return "glm::vec3(" + args[0] + ".x, " + args[0] + ".y, 0.0f)";
+        case PortDataType::Vec4:
+            return "glm::vec3(" + args[0] + ".x, " + args[0] + ".y, " + args[0] + ".z)";
+        default:
+            return args[0];
+        }
+    case NodeType::Vec4Cast:
+        switch (argTypes[0]) {
+        case PortDataType::Float:
+            return "glm::vec4(" + args[0] + ')';
+        case PortDataType::Vec2:
+            return "glm::vec4(" + args[0] + ".x, " + args[0] + ".y, 0.0f, 0.0f)";
+        case PortDataType::Vec3:
+            return "glm::vec4(" + args[0] + ".x, " + args[0] + ".y, " + args[0] + ".z, 0.0f)";
+        default:
+            return args[0];
+        }
+    case NodeType::Mat3Cast:
+        return argTypes[0] == PortDataType::Mat3 ? args[0] : "glm::mat3(" + args[0] + ')';
+    case NodeType::Mat4Cast:
+        return argTypes[0] == PortDataType::Mat4 ? args[0] : "glm::mat4(" + args[0] + ')';
+    case NodeType::Vec2Combine:
+        return "glm::vec2(" + args[0] + ", " + args[1] + ')';
+    case NodeType::Vec3Combine:
+        return "glm::vec3(" + args[0] + ", " + args[1] + ", " + args[2] + ')';
+    case NodeType::Vec4Combine:
+        return "glm::vec4(" + args[0] + ", " + args[1] + ", " + args[2] + ", " + args[3] + ')';
+    case NodeType::Swizzle:
+    {
+        // components outside the source vector (or invalid characters) read as 0
+        const int srcCount = floatCount(argTypes[0]);
+        std::string c[4];
+        for (int i = 0; i < n.swizzle.count; ++i)
+            c[i] = n.swizzle.comp[i] < srcCount ? component(args[0], n.swizzle.comp[i]) : "0.0f";
+        switch (n.swizzle.count) {
+        case 1:
+            return c[0];
+        case 2:
+            return "glm::vec2(" + c[0] + ", " + c[1] + ')';
+        case 3:
+            return "glm::vec3(" + c[0] + ", " + c[1] + ", " + c[2] + ')';
+        default:
+            return "glm::vec4(" + c[0] + ", " + c[1] + ", " + c[2] + ", " + c[3] + ')';
+        }
+    }
+    case NodeType::Plus:
+        return args[0] + " + " + args[1];
+    case NodeType::Minus:
+        return args[0] + " - " + args[1];
+    case NodeType::Mul:
+        return args[0] + " * " + args[1];
+    case NodeType::Div:
+        return args[0] + " / " + args[1];
+    case NodeType::Negate:
+        return '-' + args[0];
+    case NodeType::Length:
+        return "glm::length(" + args[0] + ')';
+    case NodeType::Distance:
+        return "glm::distance(" + args[0] + ", " + args[1] + ')';
+    case NodeType::Dot:
+        return "glm::dot(" + args[0] + ", " + args[1] + ')';
+    case NodeType::Cross:
+        return "glm::cross(" + args[0] + ", " + args[1] + ')';
+    case NodeType::Normalize:
+        return "glm::normalize(" + args[0] + ')';
+    case NodeType::Transpose:
+        return "glm::transpose(" + args[0] + ')';
+    case NodeType::Inverse:
+        return "glm::inverse(" + args[0] + ')';
+    case NodeType::Determinant:
+        return "glm::determinant(" + args[0] + ')';
+    default:
+        return std::string();
+    }
+}
+
+static inline bool isConstantNode(const Node &n)
+{
+    return n.type >= NodeType::Float && n.type <= NodeType::Mat4;
+}
+
+static inline const Port *outPort(const Node &n)
+{
+    for (const Port &port : n.ports) {
+        if (port.dir == PortDirection::Output)
+            return &port;
+    }
+    return nullptr;
+}
+
+static inline const Port *staticPort(const Node &n)
+{
+    for (const Port &port : n.ports) {
+        if (port.dir == PortDirection::Static)
+            return &port;
+    }
+    return nullptr;
+}
+
+// sinks without duplicates, in the order given
+static std::vector<Id> uniqueSinks(const std::vector<Id> &sinks)
+{
+    std::vector<Id> result;
+    for (Id id : sinks) {
+        if (std::find(result.begin(), result.end(), id) == result.end())
+            result.push_back(id);
+    }
+    return result;
+}
+
+Header generate(const Graph &g, const std::vector<Id> &sinks, const Options &options)
+{
+    Header header;
+    const std::vector<Id> outputs = uniqueSinks(sinks);
+
+    // everything the sinks depend on
+    std::unordered_set<Id> needed;
+    std::vector<Id> stack(outputs);
+    while (!stack.empty()) {
+        const Id id = stack.back();
+        stack.pop_back();
+        if (needed.insert(id).second) {
+            for (Id srcId : g.node(id).sourceNodes)
+                stack.push_back(srcId);
+        }
+    }
+
+    std::string inputs;
+    std::string body;
+    std::vector<std::string> args;
+    std::vector<PortDataType> argTypes;
+    for (Id id : g.topoOrder) {
+        if (!id || !needed.count(id))
+            continue;
+        const Node &n(g.node(id));
+        const Port *oprt = outPort(n);
+        const char *type = oprt ? typeName(oprt->type) : nullptr;
+        if (!type || !n.kernel) {
+            header.failedNode = id;
+            break;
+        }
+
+        if (isConstantNode(n)) {
+            const std::string value = literal(staticPort(n)->data.d);
+            if (n.live || options.allConstantsAsInputs) {
+                inputs += "    " + std::string(type) + ' ' + memberName(id) + " = " + value + ";\n";
+                header.inputNodes.push_back(id);
+                body += "    const " + std::string(type) + ' ' + valueName(id) + " = in." + memberName(id) + ";\n";
+            } else {
+                body += "    const " + std::string(type) + ' ' + valueName(id) + " = " + value + ";\n";
+            }
+            continue;
+        }
+
+        // all inputs are connected since the node has a kernel
+        args.clear();
+        argTypes.clear();
+        for (const std::pair<Id, int> &src : g.orderedSourceNodesForNode(id)) {
+            args.push_back(valueName(src.first));
+            argTypes.push_back(outPort(g.node(src.first))->type);
+        }
+        const std::string expr = args.size() == n.descriptor().inputPortCount ? expression(n, args, argTypes) : std::string();
+        if (expr.empty()) {
+            header.failedNode = id;
+            break;
+        }
+        body += "    const " + std::string(type) + ' ' + valueName(id) + " = " + expr + ";\n";
+    }
+    if (header.failedNode) {
+        header.inputNodes.clear();
+        return header;
+    }
+
+    std::string &s(header.source);
+    s += "// Generated from a node graph. Computes the same results as\n"
+         "// GraphEval::update() when built with the same floating point flags.\n\n"
+         "#pragma once\n\n"
+         "#include <glm/glm.hpp>\n"
+         "#include <limits>\n\n";
+    s += "namespace " + options.namespaceName + " {\n\n";
+    s += "struct Inputs\n{\n" + inputs + "};\n\n";
+    s += "struct Outputs\n{\n";
+    for (Id id : outputs)
+        s += "    " + std::string(typeName(outPort(g.node(id))->type)) + ' ' + memberName(id) + ";\n";
+    s += "};\n\n";
+    s += "inline Outputs " + options.functionName + "(const Inputs &in)\n{\n";
+    if (header.inputNodes.empty())
+        s += "    (void) in;\n";
+    s += body;
+    s += "    Outputs out;\n";
+    for (Id id : outputs)
+        s += "    out." + memberName(id) + " = " + valueName(id) + ";\n";
+    s += "    return out;\n}\n\n} // namespace\n";
+
+    return header;
+}
+
+Module generateModule(const Graph &g, const std::string &functionName)
+{
+    // nodes computed in one function of the module, so that huge graphs do
+    // not end up in a single function the compiler chokes on
+    static const size_t NODES_PER_FUNCTION = 128;
+
+    Module module;
+    std::unordered_map<Id, size_t> slots; // node id -> index in the values argument
+    std::vector<std::string> functions;
+    std::string body;
+    std::unordered_set<Id> declared; // in the current function
+    size_t nodeCount = 0;
+    std::vector<std::string> args;
+    std::vector<PortDataType> argTypes;
+
+    // a reference to a value computed in an earlier function, or to a constant
+    auto use = [&](Id id) {
+        if (declared.insert(id).second) {
+            const char *type = typeName(outPort(g.node(id))->type);
+            body += "    const " + std::string(type) + " &" + valueName(id) + " = *static_cast<const " + type
+                + " *>(v[" + std::to_string(slots.at(id)) + "]);\n";
+        }
+    };
+
+    for (Id id : g.topoOrder) {
+        if (!id)
+            continue;
+        const Node &n(g.node(id));
+        const Port *oprt = outPort(n);
+        const char *type = oprt ? typeName(oprt->type) : nullptr;
+        if (!type || !n.kernel)
+            continue;
+
+        const std::vector<std::pair<Id, int>> sources = g.orderedSourceNodesForNode(id);
+        if (!std::all_of(sources.begin(), sources.end(), [&slots](const std::pair<Id, int> &src) { return slots.count(src.first); }))
+            continue;
+
+        if (isConstantNode(n)) {
+            slots[id] = module.nodes.size();
+            module.nodes.push_back(id);
+            continue;
+        }
+
+        args.clear();
+        argTypes.clear();
+        for (const std::pair<Id, int> &src : sources) {
+            args.push_back(valueName(src.first));
+            argTypes.push_back(outPort(g.node(src.first))->type);
+        }
+        const std::string expr = args.size() == n.descriptor().inputPortCount ? expression(n, args, argTypes) : std::string();
+        if (expr.empty())
+            continue;
+
+        if (nodeCount == NODES_PER_FUNCTION) {
+            functions.push_back(std::move(body));
+            body.clear();
+            declared.clear();
+            nodeCount = 0;
+        }
+        for (const std::pair<Id, int> &src : sources)
+            use(src.first);
+        slots[id] = module.nodes.size();
+        body += "    const " + std::string(type) + ' ' + valueName(id) + " = " + expr + ";\n";
+        body += "    *static_cast<" + std::string(type) + " *>(v[" + std::to_string(module.nodes.size()) + "]) = "
+            + valueName(id) + ";\n";
+        declared.insert(id);
+        module.nodes.push_back(id);
+        ++nodeCount;
+    }
+    if (nodeCount)
+        functions.push_back(std::move(body));
+
+    std::string &s(module.source);
+    s += "// Generated from a node graph for GraphEval::attachNative()\n\n"
+         "#include <glm/glm.hpp>\n\n";
+    for (size_t i = 0; i < functions.size(); ++i)
+        s += "static void part" + std::to_string(i) + "(void *const *v)\n{\n" + functions[i] + "}\n\n";
+    s += "extern \"C\" void " + functionName + "(void *const *v)\n{\n";
+    for (size_t i = 0; i < functions.size(); ++i)
+        s += "    part" + std::to_string(i) + "(v);\n";
+    if (functions.empty())
+        s += "    (void) v;\n";
+    s += "}\n";
+
+    return module;
+}
+
+std::string generateCheck(const Graph &g, const std::vector<Id> &sinks, const std::string &headerFileName,
+                          const Options &options)
+{
+    const std::vector<Id> outputs = uniqueSinks(sinks);
+
+    // evaluate a copy so that the dirty state of g is left alone; ids are
+    // preserved by copying
+    Graph copy(g);
+    GraphEval::Plan plan;
+    GraphEval::compile(copy, plan);
+    GraphEval::run(copy, plan, GraphEval::UpdateMode::Full);
+
+    std::string s;
+    s += "// Generated from a node graph. Checks that " + headerFileName + " reproduces the\n"
+         "// results of GraphEval bit for bit.\n\n"
+         "#include \"" + headerFileName + "\"\n"
+         "#include <cstdio>\n"
+         "#include <cstring>\n"
+         "#include <cstdint>\n\n";
+    s += "static int check(const char *name, const void *value, const uint32_t *expected, int count)\n"
+         "{\n"
+         "    uint32_t bits[16];\n"
+         "    memcpy(bits, value, count * sizeof(uint32_t));\n"
+         "    for (int i = 0; i < count; ++i) {\n"
+         "        if (bits[i] != expected[i]) {\n"
+         "            printf(\"%s[%d]: 0x%08x, expected 0x%08x\\n\", name, i, bits[i], expected[i]);\n"
+         "            return 1;\n"
+         "        }\n"
+         "    }\n"
+         "    return 0;\n"
+         "}\n\n";
+    s += "int main()\n{\n";
+    // called through a volatile pointer so that the function is not only
+    // evaluated at compile time
+    s += "    " + options.namespaceName + "::Outputs (*volatile evaluate)(const " + options.namespaceName + "::Inputs &) = "
+        + options.namespaceName + "::" + options.functionName + ";\n";
+    s += "    const " + options.namespaceName + "::Outputs out = evaluate(" + options.namespaceName + "::Inputs());\n";
+    s += "    int failures = 0;\n";
+    for (Id id : outputs) {
+        const Port *oprt = outPort(g.node(id));
+        auto value = plan.outputValues.find(oprt->id);
+        if (value == plan.outputValues.end() || plan.values.errors[value->second] != PortDataError::None)
+            continue;
+        const int count = floatCount(oprt->type);
+        uint32_t bits[16];
+        memcpy(bits, plan.values.pointer(value->second), count * sizeof(uint32_t));
+        const std::string name = memberName(id);
+        s += "    static const uint32_t " + name + "[] = {";
+        for (int i = 0; i < count; ++i) {
+            char hex[16];
+            snprintf(hex, sizeof(hex), " 0x%08x", bits[i]);
+            s += hex;
+            s += i + 1 < count ? "," : " ";
+        }
+        s += "};\n";
+        s += "    failures += check(\"" + name + "\", &out." + name + ", " + name + ", " + std::to_string(count) + ");\n";
+    }
+    s += "    if (failures)\n"
+         "        printf(\"%d output(s) differ\\n\", failures);\n"
+         "    else\n"
+         "        printf(\"all outputs match\\n\");\n"
+         "    return failures ? 1 : 0;\n"
+         "}\n";
+    return s;
+}
+
+} // namespace
@@ -0,0 +1,73 @@
+#ifndef CPPGEN_H
+#define CPPGEN_H
+
+#include <string>
+#include <vector>
+
+struct Graph;
+using Id = int;
+
+namespace CppGen {
+
+struct Options
+{
+    std::string namespaceName = "nodegraph";
+    std::string functionName = "evaluate";
+    // Constant nodes that are Node::live become members of the Inputs
+    // struct, the others are inlined as literals so the compiler can
+    // propagate them. With this set, all of them are inputs.
+    bool allConstantsAsInputs = false;
+};
+
+struct Header
+{
+    std::string source;
+    // the constant nodes that are members of Inputs, named n<id>
+    std::vector<Id> inputNodes;
+    // the first node that cannot be translated because its inputs are
+    // missing or have no kernel; source is empty then
+    Id failedNode = 0;
+};
+
+// Emits a self-contained header, depending only on glm, with an inline
+// function computing the nodes feeding sinks:
+//
+//     namespace <namespaceName> {
+//     struct Inputs { float n1 = 3.0f; ... };
+//     struct Outputs { glm::vec3 n7; ... };
+//     inline Outputs <functionName>(const Inputs &in);
+//     }
+//
+// Inputs default to the current values of the constants. Every node is
+// computed with the same glm expression as its GraphEval kernel, so the
+// results are bit-identical to GraphEval::update() as long as both are
+// built with the same floating point flags (no -ffast-math, and no FMA
+// contraction unless both sides use it).
+Header generate(const Graph &g, const std::vector<Id> &sinks, const Options &options = Options());
+
+// Emits a program including the header as headerFileName that calls the
+// function with the current inputs and compares the bits of every output
+// against what GraphEval computes for g right now. It prints the outputs
+// that differ and exits with 1 if there are any.
+std::string generateCheck(const Graph &g, const std::vector<Id> &sinks, const std::string &headerFileName,
+                          const Options &options = Options());
+
+// For the evaluator's native mode: a translation unit exporting
+//
+//     extern "C" void <functionName>(void *const *v);
+//
+// where v[i] points to the value of nodes[i], typed like the node's output
+// port. Constants are read, everything else is computed and written, in
+// topological order. Nodes that cannot be translated are left out, along
+// with everything downstream of them, instead of failing the module.
+struct Module
+{
+    std::string source;
+    std::vector<Id> nodes;
+};
+
+Module generateModule(const Graph &g, const std::string &functionName);
+
+} // namespace
+
+#endif
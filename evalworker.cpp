@@ -0,0 +1,168 @@
+#include "evalworker.h"
+#include "grapheval.h"
+
+EvalWorker::EvalWorker()
+{
+    thread = std::thread(&EvalWorker::run, this);
+}
+
+EvalWorker::~EvalWorker()
+{
+    {
+        std::lock_guard<std::mutex> guard(requestLock);
+        quit = true;
+    }
+    requestAvailable.notify_one();
+    thread.join();
+}
+
+void EvalWorker::submit(Graph &g)
+{
+    ++currentFrame;
+
+    // half done edits are not worth evaluating
+    if (g.isEditing())
+        return;
+
+    const bool topologyChanged = &g != submittedGraph || g.topologyVersion != submittedTopologyVersion;
+    if (!topologyChanged && !g.hasDirtyNodes)
+        return;
+
+    Request request;
+    request.frame = currentFrame;
+    if (topologyChanged) {
+        request.snapshot.reset(new Graph(g));
+        submittedGraph = &g;
+        submittedTopologyVersion = g.topologyVersion;
+    } else {
+        for (const Node &n : g.nodes) {
+            if (n.dirty) {
+                for (const Port &port : n.ports) {
+                    if (port.dir == PortDirection::Static)
+                        request.edits.push_back({ n.id, port.id, port.data });
+                }
+            }
+        }
+    }
+
+    // g itself is never evaluated, its dirty flags only track what is yet to be submitted
+    for (Node &n : g.nodes)
+        n.dirty = false;
+    g.hasDirtyNodes = false;
+
+    latestInputFrame = currentFrame;
+
+    {
+        std::lock_guard<std::mutex> guard(requestLock);
+        if (!hasPending || request.snapshot) {
+            pending = std::move(request);
+        } else {
+            // coalesce with what the worker has not picked up yet
+            pending.frame = request.frame;
+            for (StaticValueEdit &edit : request.edits)
+                pending.edits.push_back(std::move(edit));
+        }
+        hasPending = true;
+    }
+    requestAvailable.notify_one();
+}
+
+const EvalResults &EvalWorker::results()
+{
+    if (ready.load(std::memory_order_relaxed) & FRESH)
+        front = ready.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+    return buffers[front];
+}
+
+uint64_t EvalWorker::lag() const
+{
+    const uint64_t resultFrame = buffers[front].frame;
+    return resultFrame < latestInputFrame ? currentFrame - resultFrame : 0;
+}
+
+void EvalWorker::run()
+{
+    for (;;) {
+        Request request;
+        {
+            std::unique_lock<std::mutex> guard(requestLock);
+            requestAvailable.wait(guard, [this] { return quit || hasPending; });
+            if (quit)
+                return;
+            request = std::move(pending);
+            pending = Request();
+            hasPending = false;
+        }
+
+        GraphEval::UpdateMode mode = GraphEval::UpdateMode::Incremental;
+        if (request.snapshot) {
+            // a new graph, nothing in it has been evaluated
+            graph = std::move(request.snapshot);
+            mode = GraphEval::UpdateMode::Full;
+            ++nativeTag;
+            nativeRequested = false;
+        }
+        for (const StaticValueEdit &edit : request.edits) {
+            if (Node *n = graph->nodes.find(edit.nodeId)) {
+                graph->port(edit.portId).data = edit.data;
+                graph->staticPortChanged(*n);
+            }
+        }
+
+        GraphEval::update(*graph, mode);
+        updateNative();
+        publish(request.frame);
+    }
+}
+
+// Compiling happens on the NativeCompiler's thread. A module is requested
+// once per snapshot, after its first (interpreted) evaluation, and only
+// attached if no newer snapshot came in meanwhile. The next update() runs
+// it.
+void EvalWorker::updateNative()
+{
+    if (!isNativeEnabled()) {
+        if (GraphEval::updatePlan().native)
+            GraphEval::detachNative();
+        nativeRequested = false;
+        return;
+    }
+
+    NativeCompiler::Result result;
+    if (nativeCompiler.take(&result) && result.tag == nativeTag && result.function)
+        GraphEval::attachNative(*graph, result.function, std::move(result.library), result.nodes);
+
+    if (!nativeRequested && !GraphEval::updatePlan().native) {
+        CppGen::Module module = CppGen::generateModule(*graph, NativeCompiler::functionName());
+        if (!module.nodes.empty())
+            nativeCompiler.compile(nativeTag, std::move(module));
+        nativeRequested = true;
+    }
+}
+
+void EvalWorker::publish(uint64_t frame)
+{
+    EvalResults &r(buffers[back]);
+    if (r.topologyVersion != graph->topologyVersion) {
+        r.outputs.clear();
+        r.arrays.clear();
+        r.topologyVersion = graph->topologyVersion;
+    }
+    r.frame = frame;
+    r.native = GraphEval::stats().native;
+    // the only place results are converted to PortData
+    const GraphEval::Plan &plan(GraphEval::updatePlan());
+    for (const auto &value : plan.outputValues) {
+        const PortDataType type = plan.values.values[value.second].type;
+        if (isArrayType(type) && plan.values.errors[value.second] == PortDataError::None) {
+            r.arrays[value.first] = { type, plan.values.arraySize(value.second) };
+            r.outputs.erase(value.first);
+        } else {
+            r.outputs[value.first] = plan.values.portData(value.second);
+            if (isArrayType(type))
+                r.arrays.erase(value.first);
+        }
+    }
+
+    back = ready.exchange(back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+}
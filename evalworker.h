@@ -0,0 +1,109 @@
+#ifndef EVALWORKER_H
+#define EVALWORKER_H
+
+#include "graph.h"
+#include "nativecompiler.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+struct EvalResults
+{
+    uint64_t frame = 0; // frame of the inputs these results were computed from
+    uint64_t topologyVersion = 0;
+    std::unordered_map<Id, PortData> outputs; // keyed by output port id
+
+    // Arrays without errors are only published by size, copying their
+    // elements every update would cost more than computing them. They
+    // are left out of outputs.
+    struct ArraySize
+    {
+        PortDataType type;
+        size_t count;
+    };
+    std::unordered_map<Id, ArraySize> arrays; // keyed by output port id
+    bool native = false; // computed by natively compiled code
+};
+
+// Runs GraphEval on a dedicated thread, on its own copy of the graph.
+// submit() and results() are called from the thread owning the edited
+// Graph (the render thread, via the imgui frame func) and never wait for
+// an evaluation. Inputs are handed over as a full snapshot after topology
+// changes and as individual Static port values otherwise, while results
+// come back through a triple buffer.
+struct EvalWorker
+{
+    EvalWorker();
+    ~EvalWorker();
+
+    EvalWorker(const EvalWorker &) = delete;
+    EvalWorker &operator=(const EvalWorker &) = delete;
+
+    // starts a new frame and queues whatever changed in g since the last call
+    void submit(Graph &g);
+
+    // the latest published results; stays valid until the next call
+    const EvalResults &results();
+
+    // number of frames the current results are behind the latest submitted inputs
+    uint64_t lag() const;
+
+    // Native mode: after each topology change the graph is compiled to
+    // native code in the background (see NativeCompiler), which takes over
+    // from interpretation once loaded, until the next topology change.
+    // Takes effect with the next evaluation.
+    void setNativeEnabled(bool enable) { nativeEnabled.store(enable, std::memory_order_relaxed); }
+    bool isNativeEnabled() const { return nativeEnabled.load(std::memory_order_relaxed); }
+
+private:
+    struct StaticValueEdit
+    {
+        Id nodeId;
+        Id portId;
+        PortData data;
+    };
+
+    struct Request
+    {
+        uint64_t frame = 0;
+        std::unique_ptr<Graph> snapshot;
+        std::vector<StaticValueEdit> edits; // applied after snapshot, if any
+    };
+
+    void run();
+    void updateNative();
+    void publish(uint64_t frame);
+
+    // submitting thread
+    uint64_t currentFrame = 0;
+    uint64_t latestInputFrame = 0;
+    uint64_t submittedTopologyVersion = UINT64_MAX;
+    const Graph *submittedGraph = nullptr;
+    uint32_t front = 0;
+
+    std::mutex requestLock;
+    std::condition_variable requestAvailable;
+    Request pending;
+    bool hasPending = false;
+    bool quit = false;
+
+    // worker thread
+    // replaced as a whole by snapshots, each with its own memory pool
+    std::unique_ptr<Graph> graph { new Graph };
+    uint32_t back = 1;
+    NativeCompiler nativeCompiler;
+    uint64_t nativeTag = 0; // bumped for every snapshot
+    bool nativeRequested = false; // for nativeTag
+
+    std::atomic<bool> nativeEnabled { false };
+
+    static const uint32_t FRESH = 0x4;
+    std::atomic<uint32_t> ready { 2 };
+    EvalResults buffers[3];
+
+    std::thread thread;
+};
+
+#endif
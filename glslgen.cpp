@@ -0,0 +1,341 @@
+#include "glslgen.h"
+#include "graph.h"
+#include <unordered_set>
+#include <cmath>
+#include <cstdio>
+
+namespace GlslGen {
+
+static const char *typeName(PortDataType type)
+{
+    switch (type) {
+    case PortDataType::Float:
+        return "float";
+    case PortDataType::Vec2:
+        return "vec2";
+    case PortDataType::Vec3:
+        return "vec3";
+    case PortDataType::Vec4:
+        return "vec4";
+    case PortDataType::Mat3:
+        return "mat3";
+    case PortDataType::Mat4:
+        return "mat4";
+    default:
+        return nullptr;
+    }
+}
+
+static inline int componentCount(PortDataType type)
+{
+    switch (type) {
+    case PortDataType::Float:
+        return 1;
+    case PortDataType::Vec2:
+        return 2;
+    case PortDataType::Vec3:
+        return 3;
+    case PortDataType::Vec4:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+// exact, and always a float literal rather than an int
+static std::string floatLiteral(float f)
+{
+    if (std::isnan(f))
+        return "uintBitsToFloat(0x7fc00000u)";
+    if (std::isinf(f))
+        return f > 0 ? "uintBitsToFloat(0x7f800000u)" : "uintBitsToFloat(0xff800000u)";
+    char s[32];
+    snprintf(s, sizeof(s), "%.9g", f);
+    std::string result(s);
+    if (result.find_first_of(".e") == std::string::npos)
+        result += ".0";
+    return result;
+}
+
+static std::string constructor(const char *type, const float *v, int count)
+{
+    std::string result(type);
+    result += '(';
+    for (int i = 0; i < count; ++i) {
+        if (i)
+            result += ", ";
+        result += floatLiteral(v[i]);
+    }
+    result += ')';
+    return result;
+}
+
+static std::string literal(const PortDataVar &d)
+{
+    return std::visit([](auto &&arg) -> std::string {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, PortDataFloat>)
+            return floatLiteral(arg.v);
+        else if constexpr (std::is_same_v<T, PortDataVec2>)
+            return constructor("vec2", glm::value_ptr(arg.v), 2);
+        else if constexpr (std::is_same_v<T, PortDataVec3>)
+            return constructor("vec3", glm::value_ptr(arg.v), 3);
+        else if constexpr (std::is_same_v<T, PortDataVec4>)
+            return constructor("vec4", glm::value_ptr(arg.v), 4);
+        else if constexpr (std::is_same_v<T, PortDataMat3>)
+            return constructor("mat3", glm::value_ptr(arg.v), 9); // column major, like GLSL
+        else if constexpr (std::is_same_v<T, PortDataMat4>)
+            return constructor("mat4", glm::value_ptr(arg.v), 16);
+        else
+            return std::string();
+    }, d);
+}
+
+static std::string valueName(Id id)
+{
+    return "v" + std::to_string(id);
+}
+
+static std::string uniformName(Id id)
+{
+    return "u" + std::to_string(id);
+}
+
+// follows the swizzle kernel: components that are invalid or outside the
+// source vector read as 0
+static std::string swizzle(const Node &n, const std::string &src, PortDataType srcType)
+{
+    static const char letters[] = "xyzw";
+    const int srcCount = componentCount(srcType);
+    bool plain = true;
+    for (int i = 0; i < n.swizzle.count; ++i)
+        plain = plain && n.swizzle.comp[i] < srcCount;
+    if (plain) {
+        std::string result = src + '.';
+        for (int i = 0; i < n.swizzle.count; ++i)
+            result += letters[n.swizzle.comp[i]];
+        return result;
+    }
+
+    std::string result;
+    if (n.swizzle.count > 1)
+        result = "vec" + std::to_string(n.swizzle.count) + '(';
+    for (int i = 0; i < n.swizzle.count; ++i) {
+        if (i)
+            result += ", ";
+        if (n.swizzle.comp[i] < srcCount)
+            result += src + '.' + letters[n.swizzle.comp[i]];
+        else
+            result += "0.0";
+    }
+    if (n.swizzle.count > 1)
+        result += ')';
+    return result;
+}
+
+// like Vec2Cast, Vec3Cast and Vec4Cast: truncate, or pad with zeros
+static std::string vectorCast(int count, const std::string &a, PortDataType argType)
+{
+    const int argCount = componentCount(argType);
+    if (argCount == count)
+        return a;
+    std::string result = "vec" + std::to_string(count) + '(' + a;
+    if (argCount > 1) {
+        for (int i = argCount; i < count; ++i)
+            result += ", 0.0";
+    }
+    return result + ')';
+}
+
+static std::string binary(const char *op, const std::string &a, const std::string &b)
+{
+    return '(' + a + ' ' + op + ' ' + b + ')';
+}
+
+static std::string call(const char *func, const std::string &a)
+{
+    return std::string(func) + '(' + a + ')';
+}
+
+static std::string call(const char *func, const std::string &a, const std::string &b)
+{
+    return std::string(func) + '(' + a + ", " + b + ')';
+}
+
+// the expression computing the node from its operands, empty when the node
+// type has no GLSL equivalent
+static std::string expression(const Node &n, const std::vector<std::string> &args, const std::vector<PortDataType> &argTypes)
+{
+    switch (n.type) {
+    case NodeType::Vec2Cast:
+        return vectorCast(2, args[0], argTypes[0]);
+    case NodeType::Vec3Cast:
+        return vectorCast(3, args[0], argTypes[0]);
+    case NodeType::Vec4Cast:
+        return vectorCast(4, args[0], argTypes[0]);
+    case NodeType::Mat3Cast:
+        return argTypes[0] == PortDataType::Mat3 ? args[0] : call("mat3", args[0]);
+    case NodeType::Mat4Cast:
+        // the new row and column come from the identity, as in glm
+        return argTypes[0] == PortDataType::Mat4 ? args[0] : call("mat4", args[0]);
+    case NodeType::Vec2Combine:
+        return "vec2(" + args[0] + ", " + args[1] + ')';
+    case NodeType::Vec3Combine:
+        return "vec3(" + args[0] + ", " + args[1] + ", " + args[2] + ')';
+    case NodeType::Vec4Combine:
+        return "vec4(" + args[0] + ", " + args[1] + ", " + args[2] + ", " + args[3] + ')';
+    case NodeType::Swizzle:
+        return swizzle(n, args[0], argTypes[0]);
+    case NodeType::Plus:
+        return binary("+", args[0], args[1]);
+    case NodeType::Minus:
+        return binary("-", args[0], args[1]);
+    case NodeType::Mul:
+        // matrix and vector products follow the same conventions as glm
+        return binary("*", args[0], args[1]);
+    case NodeType::Div:
+        return binary("/", args[0], args[1]);
+    case NodeType::Negate:
+        return "(-" + args[0] + ')';
+    case NodeType::Length:
+        return call("length", args[0]);
+    case NodeType::Distance:
+        return call("distance", args[0], args[1]);
+    case NodeType::Dot:
+        return call("dot", args[0], args[1]);
+    case NodeType::Cross:
+        return call("cross", args[0], args[1]);
+    case NodeType::Normalize:
+        return call("normalize", args[0]);
+    case NodeType::Transpose:
+        return call("transpose", args[0]);
+    case NodeType::Inverse:
+        return call("inverse", args[0]);
+    case NodeType::Determinant:
+        return call("determinant", args[0]);
+    default:
+        return std::string();
+    }
+}
+
+static inline bool isConstantNode(const Node &n)
+{
+    return n.type >= NodeType::Float && n.type <= NodeType::Mat4;
+}
+
+static inline const Port *outPort(const Node &n)
+{
+    for (const Port &port : n.ports) {
+        if (port.dir == PortDirection::Output)
+            return &port;
+    }
+    return nullptr;
+}
+
+static inline const Port *staticPort(const Node &n)
+{
+    for (const Port &port : n.ports) {
+        if (port.dir == PortDirection::Static)
+            return &port;
+    }
+    return nullptr;
+}
+
+Shader generate(const Graph &g, const std::vector<Id> &sinks, const Options &options)
+{
+    Shader shader;
+
+    // everything the sinks depend on
+    std::unordered_set<Id> needed;
+    std::vector<Id> stack(sinks.begin(), sinks.end());
+    while (!stack.empty()) {
+        const Id id = stack.back();
+        stack.pop_back();
+        if (needed.insert(id).second) {
+            for (Id srcId : g.node(id).sourceNodes)
+                stack.push_back(srcId);
+        }
+    }
+
+    std::string uniforms;
+    std::string body;
+    std::vector<std::string> args;
+    std::vector<PortDataType> argTypes;
+    for (Id id : g.topoOrder) {
+        if (!id || !needed.count(id))
+            continue;
+        const Node &n(g.node(id));
+        const Port *oprt = outPort(n);
+        const char *type = oprt ? typeName(oprt->type) : nullptr;
+        if (!type || !n.kernel) {
+            shader.failedNode = id;
+            break;
+        }
+
+        if (isConstantNode(n)) {
+            if (n.live || options.allConstantsAsUniforms) {
+                uniforms += "    " + std::string(type) + ' ' + uniformName(id) + ";\n";
+                shader.uniformNodes.push_back(id);
+                body += "    " + std::string(type) + ' ' + valueName(id) + " = " + uniformName(id) + ";\n";
+            } else {
+                body += "    const " + std::string(type) + ' ' + valueName(id) + " = " + literal(staticPort(n)->data.d) + ";\n";
+            }
+            continue;
+        }
+
+        // operands in input port order, all of them connected since the
+        // node has a kernel
+        args.assign(n.descriptor().inputPortCount, std::string());
+        argTypes.assign(n.descriptor().inputPortCount, PortDataType::Empty);
+        for (const Port &port : n.ports) {
+            if (port.dir == PortDirection::Input && !port.connections.empty() && size_t(port.order) < args.size()) {
+                const Connection &c(g.connection(port.connections.front()));
+                args[port.order] = valueName(c.ep[c.ep[0].portId == port.id ? 1 : 0].nodeId);
+                argTypes[port.order] = port.type;
+            }
+        }
+        const std::string expr = expression(n, args, argTypes);
+        if (expr.empty()) {
+            shader.failedNode = id;
+            break;
+        }
+        body += "    " + std::string(type) + ' ' + valueName(id) + " = " + expr + ";\n";
+    }
+    if (shader.failedNode) {
+        shader.uniformNodes.clear();
+        return shader;
+    }
+
+    std::string &s(shader.source);
+    if (options.standalone)
+        s += "#version 440\n\n";
+    if (!uniforms.empty()) {
+        s += "layout(std140, binding = " + std::to_string(options.uniformBinding) + ") uniform "
+            + options.uniformBlockName + "\n{\n" + uniforms + "};\n\n";
+    }
+
+    s += "void " + options.functionName + '(';
+    for (size_t i = 0; i < sinks.size(); ++i) {
+        if (i)
+            s += ", ";
+        s += "out " + std::string(typeName(outPort(g.node(sinks[i]))->type)) + " result" + std::to_string(i);
+    }
+    s += ")\n{\n" + body;
+    for (size_t i = 0; i < sinks.size(); ++i)
+        s += "    result" + std::to_string(i) + " = " + valueName(sinks[i]) + ";\n";
+    s += "}\n";
+
+    if (options.standalone) {
+        s += "\nvoid main()\n{\n";
+        for (size_t i = 0; i < sinks.size(); ++i)
+            s += "    " + std::string(typeName(outPort(g.node(sinks[i]))->type)) + " result" + std::to_string(i) + ";\n";
+        s += "    " + options.functionName + '(';
+        for (size_t i = 0; i < sinks.size(); ++i)
+            s += (i ? ", result" : "result") + std::to_string(i);
+        s += ");\n}\n";
+    }
+
+    return shader;
+}
+
+} // namespace
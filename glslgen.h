@@ -0,0 +1,44 @@
+#ifndef GLSLGEN_H
+#define GLSLGEN_H
+
+#include <string>
+#include <vector>
+
+struct Graph;
+using Id = int;
+
+namespace GlslGen {
+
+struct Options
+{
+    std::string functionName = "evaluateGraph";
+    std::string uniformBlockName = "GraphUniforms";
+    int uniformBinding = 0;
+    // Constant nodes that are Node::live become members of a uniform
+    // block, the others are inlined as literals. With this set, all of
+    // them go into the block, so they can be edited without generating
+    // the shader again.
+    bool allConstantsAsUniforms = false;
+    // adds #version 440 and a main() calling the function, so that the
+    // result can be fed to a validator or qsb as a fragment shader
+    bool standalone = false;
+};
+
+struct Shader
+{
+    std::string source;
+    // the constant nodes in the order of the uniform block (std140 layout)
+    std::vector<Id> uniformNodes;
+    // the first node that cannot be translated because its inputs are
+    // missing or have no kernel; source is empty then
+    Id failedNode = 0;
+};
+
+// Emits a GLSL function equivalent to evaluating the nodes feeding sinks,
+// with one out parameter per sink, in the order given. Intermediate
+// results become locals named after the node ids.
+Shader generate(const Graph &g, const std::vector<Id> &sinks, const Options &options = Options());
+
+} // namespace
+
+#endif
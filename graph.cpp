@@ -1 +1,344 @@
 #include "graph.h"
+#include "grapheval.h"
+#include <unordered_set>
+
+static const size_t MAX_INPUT_PORTS = 4;
+
+// the port on the other end of a connection
+static inline Id otherPortId(const Connection &c, Id portId)
+{
+    return c.ep[c.ep[0].portId == portId ? 1 : 0].portId;
+}
+
+// fills argTypes (indexed by input port order) with the types of the
+// connected sources, and updates the type of the Input ports
+static void gatherOperandTypes(Graph &g, Node &n, PortDataType *argTypes)
+{
+    for (Port &port : n.ports) {
+        if (port.dir == PortDirection::Input && !port.connections.empty() && size_t(port.order) < MAX_INPUT_PORTS) {
+            const Connection &c(g.connection(port.connections.front()));
+            port.type = g.port(otherPortId(c, port.id)).type;
+            argTypes[port.order] = port.type;
+        }
+    }
+}
+
+// Rebinds the kernel for the current operand types, returns true when the
+// output type changed.
+static bool rebindKernel(Graph &g, Node &n)
+{
+    for (Port &port : n.ports) {
+        if (port.dir == PortDirection::Input)
+            port.type = PortDataType::Empty;
+    }
+    // unconnected inputs stay Empty, which no kernel accepts
+    PortDataType argTypes[MAX_INPUT_PORTS] = {};
+    gatherOperandTypes(g, n, argTypes);
+    const PortDataType resultType = GraphEval::bindKernel(n, argTypes);
+
+    bool changed = false;
+    for (Port &port : n.ports) {
+        if (port.dir == PortDirection::Output && port.type != resultType) {
+            port.type = resultType;
+            changed = true;
+        }
+    }
+    // evaluators store values by type
+    if (changed)
+        ++g.topologyVersion;
+    return changed;
+}
+
+// the nodes at the other end of the Output connections of n
+static void appendConsumers(const Graph &g, const Node &n, std::vector<Id> &ids)
+{
+    for (const Port &port : n.ports) {
+        if (port.dir == PortDirection::Output) {
+            for (Id connectionId : port.connections) {
+                const Connection &c(g.connection(connectionId));
+                ids.push_back(c.ep[c.ep[0].portId == port.id ? 1 : 0].nodeId);
+            }
+        }
+    }
+}
+
+void Graph::inferTypes(Node &startNode)
+{
+    std::vector<Id> work { startNode.id };
+
+    // terminates since addConnection keeps the graph acyclic
+    while (!work.empty()) {
+        Node &n(node(work.back()));
+        work.pop_back();
+        if (rebindKernel(*this, n))
+            appendConsumers(*this, n, work);
+    }
+}
+
+void Graph::inferPendingTypes()
+{
+    // sources come first, so every node is rebound at most once
+    std::vector<Id> consumers;
+    for (Id id : topoOrder) {
+        if (!id)
+            continue;
+        Node &n(node(id));
+        if (!n.typesPending)
+            continue;
+        n.typesPending = false;
+        if (rebindKernel(*this, n)) {
+            consumers.clear();
+            appendConsumers(*this, n, consumers);
+            for (Id consumerId : consumers)
+                node(consumerId).typesPending = true;
+        }
+    }
+}
+
+bool Graph::acceptsConnection(Id fromNode, Id fromPort, Id toNode, Id toPort) const
+{
+    const Port *ports[2] = { &port(fromPort), &port(toPort) };
+    const Id nodeIds[2] = { fromNode, toNode };
+    for (int i = 0; i < 2; ++i) {
+        if (ports[i]->dir == PortDirection::Input && ports[1 - i]->dir == PortDirection::Output) {
+            const Node &consumer(node(nodeIds[i]));
+            if (size_t(ports[i]->order) >= MAX_INPUT_PORTS)
+                return false;
+            PortDataType argTypes[MAX_INPUT_PORTS] = {};
+            for (const Port &port : consumer.ports) {
+                if (port.dir == PortDirection::Input && size_t(port.order) < MAX_INPUT_PORTS)
+                    argTypes[port.order] = port.type;
+            }
+            argTypes[ports[i]->order] = ports[1 - i]->type;
+            return GraphEval::acceptsOperands(consumer, argTypes);
+        }
+    }
+    return true;
+}
+
+bool Graph::insertDependency(Id sourceId, Id consumerId)
+{
+    if (sourceId == consumerId)
+        return false;
+
+    const size_t upperBound = node(sourceId).topoIndex;
+    const size_t lowerBound = node(consumerId).topoIndex;
+    if (lowerBound > upperBound)
+        return true; // already in order
+
+    // Pearce-Kelly: everything reachable from the consumer that is not after
+    // the source in the current order, and everything reaching the source
+    // that is not before the consumer, has to be shuffled.
+    const uint64_t visit = ++topoVisitSerial;
+    std::vector<Id> stack;
+    std::vector<Id> forward;
+    stack.push_back(consumerId);
+    node(consumerId).topoVisitSerial = visit;
+    while (!stack.empty()) {
+        Node &n(node(stack.back()));
+        stack.pop_back();
+        forward.push_back(n.id);
+        for (Id id : n.consumerNodes) {
+            Node &w(node(id));
+            if (w.topoIndex == upperBound)
+                return false; // reached the source, would be a cycle
+            if (w.topoVisitSerial != visit && w.topoIndex < upperBound) {
+                w.topoVisitSerial = visit;
+                stack.push_back(id);
+            }
+        }
+    }
+
+    std::vector<Id> backward;
+    stack.push_back(sourceId);
+    node(sourceId).topoVisitSerial = visit;
+    while (!stack.empty()) {
+        Node &n(node(stack.back()));
+        stack.pop_back();
+        backward.push_back(n.id);
+        for (Id id : n.sourceNodes) {
+            Node &w(node(id));
+            if (w.topoVisitSerial != visit && w.topoIndex > lowerBound) {
+                w.topoVisitSerial = visit;
+                stack.push_back(id);
+            }
+        }
+    }
+
+    // the affected nodes keep their relative order within each set, the
+    // source's ancestors move ahead of the consumer's descendants, and the
+    // set of positions they occupy stays the same
+    auto byIndex = [this](Id a, Id b) { return node(a).topoIndex < node(b).topoIndex; };
+    std::sort(backward.begin(), backward.end(), byIndex);
+    std::sort(forward.begin(), forward.end(), byIndex);
+    std::vector<size_t> positions;
+    positions.reserve(backward.size() + forward.size());
+    for (Id id : backward)
+        positions.push_back(node(id).topoIndex);
+    for (Id id : forward)
+        positions.push_back(node(id).topoIndex);
+    std::sort(positions.begin(), positions.end());
+
+    size_t i = 0;
+    for (Id id : backward) {
+        node(id).topoIndex = positions[i];
+        topoOrder[positions[i++]] = id;
+    }
+    for (Id id : forward) {
+        node(id).topoIndex = positions[i];
+        topoOrder[positions[i++]] = id;
+    }
+
+    return true;
+}
+
+void Graph::linkNodes(Id sourceId, Id consumerId)
+{
+    node(sourceId).consumerNodes.push_back(consumerId);
+    node(consumerId).sourceNodes.push_back(sourceId);
+}
+
+void Graph::unlinkNodes(Id sourceId, Id consumerId)
+{
+    std::pmr::vector<Id> &consumers(node(sourceId).consumerNodes);
+    consumers.erase(std::find(consumers.begin(), consumers.end(), consumerId));
+    std::pmr::vector<Id> &sources(node(consumerId).sourceNodes);
+    sources.erase(std::find(sources.begin(), sources.end(), sourceId));
+}
+
+void Graph::compactTopoOrder()
+{
+    topoOrder.erase(std::remove(topoOrder.begin(), topoOrder.end(), 0), topoOrder.end());
+    for (size_t i = 0; i < topoOrder.size(); ++i)
+        node(topoOrder[i]).topoIndex = i;
+    topoOrderHoles = 0;
+}
+
+bool Graph::rebuildTopoOrder()
+{
+    // Kahn's algorithm, counting one entry per connection like the adjacency lists
+    std::vector<Id> order;
+    order.reserve(nodes.size());
+    for (Node &n : nodes) {
+        n.topoVisitSerial = n.sourceNodes.size(); // remaining in-degree
+        if (n.sourceNodes.empty())
+            order.push_back(n.id);
+    }
+    for (size_t i = 0; i < order.size(); ++i) {
+        for (Id id : node(order[i]).consumerNodes) {
+            if (--node(id).topoVisitSerial == 0)
+                order.push_back(id);
+        }
+    }
+    for (Node &n : nodes)
+        n.topoVisitSerial = 0;
+    if (order.size() != nodes.size())
+        return false;
+
+    topoOrder = std::move(order);
+    topoOrderHoles = 0;
+    for (size_t i = 0; i < topoOrder.size(); ++i)
+        node(topoOrder[i]).topoIndex = i;
+    return true;
+}
+
+void Graph::beginEdit()
+{
+    ++editDepth;
+}
+
+std::vector<Id> Graph::commitEdit()
+{
+    std::vector<Id> rejected;
+    if (--editDepth > 0)
+        return rejected;
+
+    std::vector<Id> pending;
+    pending.swap(pendingConnections);
+    pending.erase(std::remove_if(pending.begin(), pending.end(), [this](Id id) { return !connections.contains(id); }), pending.end());
+
+    if (!rebuildTopoOrder()) {
+        // Some of the new connections close cycles. Which ones depends on
+        // the order they were made in and on which ones got rejected for
+        // their types, so take them all out and replay them like
+        // addConnection would have outside of the transaction.
+        for (Id id : pending) {
+            const Connection &c(connection(id));
+            if (const Id consumerId = consumerNodeId(c)) {
+                unlinkNodes(sourceNodeId(c), consumerId);
+                node(consumerId).typesPending = true;
+            }
+            for (int i = 0; i < 2; ++i) {
+                std::pmr::vector<Id> &portConnections(port(c.ep[i].portId).connections);
+                portConnections.erase(std::find(portConnections.begin(), portConnections.end(), id));
+            }
+        }
+        rebuildTopoOrder();
+        inferPendingTypes();
+        for (Id id : pending) {
+            const Connection c = connection(id);
+            const Id consumerId = consumerNodeId(c);
+            const Id sourceId = sourceNodeId(c);
+            if (acceptsConnection(c.ep[0].nodeId, c.ep[0].portId, c.ep[1].nodeId, c.ep[1].portId)
+                    && (!consumerId || insertDependency(sourceId, consumerId))) {
+                for (int i = 0; i < 2; ++i)
+                    port(c.ep[i].portId).connections.push_back(id);
+                if (consumerId) {
+                    linkNodes(sourceId, consumerId);
+                    inferTypes(node(consumerId));
+                }
+            } else {
+                connections.erase(id);
+                rejected.push_back(id);
+            }
+        }
+        pending.clear();
+    }
+
+    inferPendingTypes();
+
+    // Type check the new connections in the order they were made, each
+    // against the inputs of its consumer that existed before or have been
+    // accepted already, as addConnection would have with the final types.
+    std::unordered_set<Id> undecided(pending.begin(), pending.end());
+    for (Id id : pending) {
+        undecided.erase(id);
+        const Id consumerId = consumerNodeId(connection(id));
+        if (!consumerId)
+            continue;
+        Node &consumer(node(consumerId));
+        PortDataType argTypes[MAX_INPUT_PORTS] = {};
+        for (const Port &port : consumer.ports) {
+            if (port.dir == PortDirection::Input && size_t(port.order) < MAX_INPUT_PORTS
+                    && !port.connections.empty() && !undecided.count(port.connections.front())) {
+                argTypes[port.order] = port.type;
+            }
+        }
+        if (!GraphEval::acceptsOperands(consumer, argTypes)) {
+            detachConnection(id);
+            inferTypes(consumer);
+            rejected.push_back(id);
+        }
+    }
+
+    ++topologyVersion;
+    return rejected;
+}
+
+void Graph::removeNodes(const std::vector<Id> &ids)
+{
+    beginEdit();
+    for (Id id : ids) {
+        if (nodes.contains(id))
+            removeNode(id);
+    }
+    commitEdit();
+}
+
+void Graph::removeConnections(const std::vector<Id> &ids)
+{
+    beginEdit();
+    for (Id id : ids)
+        removeConnection(id);
+    commitEdit();
+}
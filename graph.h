@@ -3,12 +3,18 @@
 
 #include "nodetypes.h"
 #include "portdata.h"
+#include "slotmap.h"
 #include <vector>
+#include <memory>
+#include <memory_resource>
 #include <array>
 #include <unordered_map>
 #include <functional>
+#include <cstdint>
 
-using Id = int; // uses one global id space for everything
+// Nodes, ports and connections are addressed by SlotMap handles, each kind
+// in its own id space (as in imnodes). Never 0.
+using Id = int;
 
 struct Connection
 {
@@ -19,130 +25,438 @@ struct Connection
     } ep[2];
 };
 
-enum class PortDirection {
-    Input,
-    Output,
-    Static
-};
-
+// Port and Node take their storage from the allocator of the container
+// they live in, that is from the Graph's memory. The allocator-extended
+// constructors are what the pmr containers use to pass it on.
 struct Port
 {
+    using allocator_type = std::pmr::polymorphic_allocator<Id>;
+
+    Port(Id id, PortDirection dir, const allocator_type &alloc = {})
+        : id(id), dir(dir), connections(alloc)
+    {
+    }
+
+    Port(const Port &other, const allocator_type &alloc) : connections(alloc) { *this = other; }
+    Port(Port &&other, const allocator_type &alloc) : connections(alloc) { *this = std::move(other); }
+    Port(const Port &) = default;
+    Port(Port &&) = default;
+    Port &operator=(const Port &) = default;
+    Port &operator=(Port &&) = default;
+
     Id id;
     PortDirection dir;
-    int order;
-    std::string text;
+    // index into the port layout of the node type, see NodeTypeDescriptor
+    int order = 0;
+    // the value of a Static port; results of Output ports are kept by the
+    // evaluator, see GraphEval::result()
     PortData data;
+    // inferred when connections or upstream types change; for an Input
+    // this is the type of the connected source
+    PortDataType type = PortDataType::Empty;
+    // ids of the connections attached to the port, at most one for an Input
+    std::pmr::vector<Id> connections;
 };
 
 struct Graph;
+struct AttributeFile;
 
 struct Node
 {
-    Id id;
-    NodeType type;
-    size_t inputPortCount;
-    using EvalFunc = std::function<void(Graph&, Node&, std::vector<PortData>&)>;
-    EvalFunc evalFunc;
-    std::vector<Port> ports;
+    using allocator_type = std::pmr::polymorphic_allocator<Id>;
 
-    Port &port(Id portId)
+    explicit Node(const allocator_type &alloc = {})
+        : ports(alloc), sourceNodes(alloc), consumerNodes(alloc)
     {
-        return *std::find_if(ports.begin(), ports.end(), [portId](const Port &port) { return port.id == portId; });
     }
 
-    const Port &port(Id portId) const
-    {
-        return *std::find_if(ports.cbegin(), ports.cend(), [portId](const Port &port) { return port.id == portId; });
-    }
+    Node(const Node &other, const allocator_type &alloc) : Node(alloc) { *this = other; }
+    Node(Node &&other, const allocator_type &alloc) : Node(alloc) { *this = std::move(other); }
+    Node(const Node &) = default;
+    Node(Node &&) = default;
+    Node &operator=(const Node &) = default;
+    Node &operator=(Node &&) = default;
+
+    Id id = 0;
+    // names, port labels and arity are in nodeTypeDescriptor(type)
+    NodeType type = NodeType::Invalid;
+    std::pmr::vector<Port> ports;
+
+    // bound by type inference to the one kernel matching the current
+    // operand types; null when the operands are missing or invalid
+    // operate on values of the bound types directly, see ValueStore
+    using Kernel = void (*)(const Node &n, const void *const *args, void *result);
+    Kernel kernel = nullptr;
+
+    // The same computation for count samples at once, bound along with
+    // kernel; null when there is no batched form. Operand i points to count
+    // consecutive values when bit i of varyingArgs is set, and to a single
+    // value shared by all samples otherwise. See GraphEval::Batch.
+    using BatchKernel = void (*)(const Node &n, const void *const *args, uint32_t varyingArgs, void *result, size_t count);
+    BatchKernel batchKernel = nullptr;
+
+    // Swizzle only, parsed from the Static port when it is edited
+    struct {
+        uint8_t comp[4];
+        uint8_t count;
+    } swizzle = {};
+
+    // BinaryFile only, opened again when a Static port is edited; null
+    // when it cannot be opened
+    std::shared_ptr<const AttributeFile> file;
+
+    const NodeTypeDescriptor &descriptor() const { return nodeTypeDescriptor(type); }
+
+    // holds its value in a Static port, with no inputs
+    bool isConstant() const { return type >= NodeType::Float && type <= NodeType::Mat4; }
+
+    // last GraphEval run that evaluated this node, to guarantee each
+    // node is evaluated at most once per run
+    uint64_t evalSerial = 0;
+
+    // set when the node's own inputs (static values or connections) changed
+    // since the last evaluation; GraphEval propagates it downstream
+    bool dirty = true;
+
+    // constant nodes only: the value is expected to change on most updates
+    // (driven from outside rather than edited by hand), so neither the node
+    // nor anything downstream of it is constant folded; see Graph::setLive().
+    // Every other node is treated as live, see GraphEval::compile().
+    bool live = false;
+
+    // node level adjacency, one entry per connection, so possibly repeated
+    std::pmr::vector<Id> sourceNodes;
+    std::pmr::vector<Id> consumerNodes;
 
-    std::string text;
+    // position in Graph::topoOrder
+    size_t topoIndex = 0;
+    uint64_t topoVisitSerial = 0;
+
+    // type inference deferred to the end of a Graph edit transaction
+    bool typesPending = false;
+};
+
+// A memory pool owned by a Graph. Nodes, ports, connections and their
+// adjacency lists are carved out of large blocks that are only returned
+// to the system when the graph is cleared or destroyed, so building,
+// clearing and destroying big graphs does not go through the global heap
+// for each object. A copy of a graph gets its own pool, and assigning a
+// graph keeps the pool of the destination.
+struct GraphMemory
+{
+    GraphMemory() = default;
+    GraphMemory(const GraphMemory &) { }
+    GraphMemory &operator=(const GraphMemory &) { return *this; }
+
+    std::pmr::memory_resource *resource() { return &pool; }
+
+    // frees all blocks at once; nothing may be left allocated from them
+    void release() { pool.release(); }
+
+private:
+    std::pmr::unsynchronized_pool_resource pool;
 };
 
 struct Graph
 {
-    std::unordered_map<Id, Node> nodes;
-    std::unordered_map<Id, Id> portNodeMap;
-    std::vector<Connection> connections;
-    Id nextId = 1;
+    Graph() : nodes(memory.resource()), portNodeMap(memory.resource()), connections(memory.resource()) { }
+    Graph(const Graph &other) : Graph() { *this = other; }
+    Graph &operator=(const Graph &) = default;
+    // the containers would be left pointing at the pool of the other graph
+    Graph(Graph &&) = delete;
+    Graph &operator=(Graph &&) = delete;
+
+    // Removes everything and hands the blocks of the memory pool back in
+    // one go. topologyVersion keeps counting up, so that nothing compiled
+    // for the old contents is taken for valid, but node, port and
+    // connection ids start over. Not within an edit transaction.
+    void clear()
+    {
+        nodes.clear();
+        portNodeMap.clear();
+        connections.clear();
+        memory.release();
+        topoOrder.clear();
+        topoOrderHoles = 0;
+        pendingConnections.clear();
+        hasDirtyNodes = false;
+        ++topologyVersion;
+    }
+
+    GraphMemory memory;
+
+    // references to nodes are invalidated by newNode() and removeNode()
+    SlotMap<Node> nodes;
+
+    struct PortRef
+    {
+        Id nodeId;
+        size_t index; // in Node::ports
+    };
+    SlotMap<PortRef> portNodeMap;
+
+    // references to connections are invalidated by addConnection() and
+    // removeConnection()
+    SlotMap<Connection> connections;
+
+    // bumped on every change to nodes, ports, connections or port types,
+    // and to Static ports of nodes other than constants, so that evaluators
+    // can tell when a compiled plan needs to be rebuilt
+    uint64_t topologyVersion = 0;
+
+    // true when at least one node is dirty
+    bool hasDirtyNodes = false;
+
+    // Topological order of all nodes, kept up to date on every new
+    // connection with the Pearce-Kelly algorithm, which only reorders the
+    // region between the two endpoints. Removed nodes leave a 0 behind until
+    // there are enough of them to compact the vector.
+    std::vector<Id> topoOrder;
+    size_t topoOrderHoles = 0;
+    uint64_t topoVisitSerial = 0;
+
+    // Edit transactions: between beginEdit() and the matching commitEdit(),
+    // addConnection() only checks directions and existing Input links, and
+    // type inference is deferred. At commit the topological order is
+    // rebuilt once, connections closing a cycle are removed, types are
+    // inferred in a single pass, and connections that do not type check
+    // are removed. commitEdit() returns the ids of the removed connections.
+    // Until then such a connection still occupies its Input. Evaluators must
+    // not run on a graph with an open transaction.
+    void beginEdit();
+    std::vector<Id> commitEdit();
+    bool isEditing() const { return editDepth > 0; }
+    int editDepth = 0;
+    std::vector<Id> pendingConnections;
+
+    // bulk removal in one transaction
+    void removeNodes(const std::vector<Id> &ids);
+    void removeConnections(const std::vector<Id> &ids);
+
+    // false (and no change) when the dependency would close a cycle
+    bool insertDependency(Id sourceId, Id consumerId);
+    void linkNodes(Id sourceId, Id consumerId);
+    void unlinkNodes(Id sourceId, Id consumerId);
+    void compactTopoOrder();
+    // from scratch, false when there is a cycle
+    bool rebuildTopoOrder();
+
+    void markDirty(Node &node)
+    {
+        node.dirty = true;
+        hasDirtyNodes = true;
+    }
+
+    void markDirty(Id id) { markDirty(node(id)); }
+
+    // the node on the Input side of c, or 0
+    Id consumerNodeId(const Connection &c) const
+    {
+        for (int i = 0; i < 2; ++i) {
+            if (port(c.ep[i].portId).dir == PortDirection::Input)
+                return c.ep[i].nodeId;
+        }
+        return 0;
+    }
+
+    // the node on the other side of the Input, or 0
+    Id sourceNodeId(const Connection &c) const
+    {
+        for (int i = 0; i < 2; ++i) {
+            if (port(c.ep[i].portId).dir == PortDirection::Input)
+                return c.ep[1 - i].nodeId;
+        }
+        return 0;
+    }
+
+    // Marks the node dirty and rebinds its kernel, propagating changed
+    // output types downstream.
+    void invalidate(Node &node)
+    {
+        markDirty(node);
+        if (isEditing())
+            node.typesPending = true;
+        else
+            inferTypes(node);
+    }
+
+    void invalidate(Id id) { invalidate(node(id)); }
+
+    // To be called after modifying the data of a Static port. Except on
+    // constants, that changes what the node computes, like the components
+    // of a Swizzle or the file read, which compiled plans and native code
+    // have baked in, so it counts as a topology change.
+    void staticPortChanged(Node &node)
+    {
+        if (!node.isConstant())
+            ++topologyVersion;
+        invalidate(node);
+    }
+
+    void setLive(Node &node, bool live)
+    {
+        if (node.live != live) {
+            node.live = live;
+            // changes what gets constant folded
+            ++topologyVersion;
+        }
+    }
+
+    void inferTypes(Node &node);
+    void inferPendingTypes();
+    bool acceptsConnection(Id fromNode, Id fromPort, Id toNode, Id toPort) const;
 
     Node &newNode()
     {
-        const Id id = nextId++;
-        nodes[id] = Node { id, NodeType::Invalid, 0, nullptr };
-        return nodes[id];
+        const Id id = nodes.insert();
+        Node &n(nodes.at(id));
+        n.id = id;
+        // no connections yet, so the end of the order is as good as anywhere
+        n.topoIndex = topoOrder.size();
+        topoOrder.push_back(id);
+        ++topologyVersion;
+        hasDirtyNodes = true;
+        return n;
     }
 
     void removeNode(Id id)
     {
+        std::vector<Id> consumers;
+        for (Port &port : node(id).ports) {
+            while (!port.connections.empty()) {
+                const Id consumerId = detachConnection(port.connections.back());
+                if (consumerId && consumerId != id)
+                    consumers.push_back(consumerId);
+            }
+        }
+        for (const Port &port : node(id).ports)
+            portNodeMap.erase(port.id);
+        topoOrder[node(id).topoIndex] = 0;
+        // a transaction rebuilds the order anyway
+        if (++topoOrderHoles > topoOrder.size() / 2 && !isEditing())
+            compactTopoOrder();
         nodes.erase(id);
-        // ### portNodeMap
-        connections.erase(std::remove_if(connections.begin(), connections.end(),
-            [id](const Connection &c) { return c.ep[0].nodeId == id || c.ep[1].nodeId == id; }), connections.end());
+        ++topologyVersion;
+        for (Id consumerId : consumers)
+            invalidate(consumerId);
     }
 
     Node &node(Id id) { return nodes.at(id); }
     const Node &node(Id id) const { return nodes.at(id); }
 
+    // constant time through portNodeMap, nodes have no lookup of their own
+    Port &port(Id id)
+    {
+        const PortRef &ref(portNodeMap.at(id));
+        return node(ref.nodeId).ports[ref.index];
+    }
+
+    const Port &port(Id id) const
+    {
+        const PortRef &ref(portNodeMap.at(id));
+        return node(ref.nodeId).ports[ref.index];
+    }
+
     Port &addPort(Node &node, PortDirection dir)
     {
-        const Id id = nextId++;
-        node.ports.push_back(Port { id, dir, 0 });
-        portNodeMap[id] = node.id;
+        const Id id = portNodeMap.insert();
+        portNodeMap.at(id) = { node.id, node.ports.size() };
+        node.ports.emplace_back(id, dir);
+        ++topologyVersion;
         return node.ports[node.ports.size() - 1];
     }
 
     void removePort(Node &node, Id id)
     {
-        node.ports.erase(std::find_if(node.ports.begin(), node.ports.end(), [id](const Port &port) { return port.id == id; }));
+        std::vector<Id> consumers;
+        Port &p(port(id));
+        while (!p.connections.empty()) {
+            if (const Id consumerId = detachConnection(p.connections.back()))
+                consumers.push_back(consumerId);
+        }
+        const size_t index = portNodeMap.at(id).index;
+        node.ports.erase(node.ports.begin() + index);
+        for (size_t i = index; i < node.ports.size(); ++i)
+            portNodeMap.at(node.ports[i].id).index = i;
         portNodeMap.erase(id);
-        connections.erase(std::remove_if(connections.begin(), connections.end(),
-            [id](const Connection &c) { return c.ep[0].portId == id || c.ep[1].portId == id; }), connections.end());
+        ++topologyVersion;
+        invalidate(node.id);
+        for (Id consumerId : consumers)
+            invalidate(consumerId);
     }
 
-    Node &nodeForPort(Id id) { return nodes.at(portNodeMap[id]); }
-    const Node &nodeForPort(Id id) const { return nodes.at(portNodeMap.at(id)); }
+    Node &nodeForPort(Id id) { return nodes.at(portNodeMap.at(id).nodeId); }
+    const Node &nodeForPort(Id id) const { return nodes.at(portNodeMap.at(id).nodeId); }
+
+    Connection &connection(Id id) { return connections.at(id); }
+    const Connection &connection(Id id) const { return connections.at(id); }
 
     Id addConnection(Id fromNode, Id fromPort, Id toNode, Id toPort)
     {
+        Port &from(port(fromPort));
+        Port &to(port(toPort));
         // disallow Input - Input, Output - Output
-        if (node(fromNode).port(fromPort).dir != node(toNode).port(toPort).dir) {
-            // disallow multiple connections to an Input
-            if (std::find_if(connections.cbegin(), connections.cend(), [this, fromPort, toPort](const Connection &c) {
-                for (int i = 0; i < 2; ++i) {
-                    const Id cpid = c.ep[i].portId;
-                    if (cpid == fromPort || cpid == toPort) {
-                        if (node(c.ep[i].nodeId).port(cpid).dir == PortDirection::Input)
-                            return true;
-                    }
-                }
-                return false;
-            }) == connections.cend()) {
-                const Id id = nextId++;
-                connections.push_back({ id, { { fromNode, fromPort }, { toNode, toPort } } });
-                return id;
-            }
+        if (from.dir == to.dir)
+            return 0;
+        // disallow multiple connections to an Input, and incompatible types
+        if ((from.dir == PortDirection::Input && !from.connections.empty())
+                || (to.dir == PortDirection::Input && !to.connections.empty())
+                || (!isEditing() && !acceptsConnection(fromNode, fromPort, toNode, toPort))) {
+            return 0;
         }
-        return 0;
+        const Id consumerId = to.dir == PortDirection::Input ? toNode : from.dir == PortDirection::Input ? fromNode : 0;
+        const Id sourceId = consumerId == toNode ? fromNode : toNode;
+        // disallow cycles, checked at commit in a transaction
+        if (consumerId && !isEditing() && !insertDependency(sourceId, consumerId))
+            return 0;
+        const Id id = connections.insert();
+        connections.at(id) = { id, { { fromNode, fromPort }, { toNode, toPort } } };
+        from.connections.push_back(id);
+        to.connections.push_back(id);
+        ++topologyVersion;
+        if (isEditing())
+            pendingConnections.push_back(id);
+        if (consumerId) {
+            linkNodes(sourceId, consumerId);
+            invalidate(consumerId);
+        }
+        return id;
     }
 
     void removeConnection(Id id)
     {
-        auto it = std::find_if(connections.begin(), connections.end(), [id](const Connection &c) { return c.id == id; });
-        if (it != connections.end())
-            connections.erase(it);
+        if (connections.contains(id)) {
+            const Id consumerId = detachConnection(id);
+            if (consumerId)
+                invalidate(consumerId);
+        }
+    }
+
+    // Removes the connection from the ports, the node adjacency and the
+    // connection list, and returns its consumer node (or 0). Does not
+    // invalidate anything.
+    Id detachConnection(Id id)
+    {
+        const Connection c = connections.at(id);
+        const Id consumerId = consumerNodeId(c);
+        if (consumerId)
+            unlinkNodes(sourceNodeId(c), consumerId);
+        for (int i = 0; i < 2; ++i) {
+            std::pmr::vector<Id> &portConnections(port(c.ep[i].portId).connections);
+            portConnections.erase(std::find(portConnections.begin(), portConnections.end(), id));
+        }
+        connections.erase(id);
+        ++topologyVersion;
+        return consumerId;
     }
 
     std::vector<std::pair<Id, int>> orderedSourceNodesForNode(Id id) const
     {
         std::vector<std::pair<Id, int>> result;
-        const Node &n(node(id));
-        for (const Connection &c : connections) {
-            for (int i = 0; i < 2; ++i) {
-                if (n.id == c.ep[i].nodeId) {
-                    const Port &port(n.port(c.ep[i].portId));
-                    if (port.dir == PortDirection::Input)
-                        result.push_back({ c.ep[1 - i].nodeId, port.order });
-                }
+        for (const Port &port : node(id).ports) {
+            if (port.dir == PortDirection::Input && !port.connections.empty()) {
+                const Connection &c(connection(port.connections.front()));
+                result.push_back({ c.ep[c.ep[0].portId == port.id ? 1 : 0].nodeId, port.order });
             }
         }
         std::sort(result.begin(), result.end(), [](const std::pair<Id, int> &a, const std::pair<Id, int> &b) {
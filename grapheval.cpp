@@ -1,6 +1,19 @@
 #include "grapheval.h"
 #include "graph.h"
+#include "alloccounter.h"
+#include "threadpool.h"
+#include "mat4simd.h"
+#include "attributefile.h"
+#include <unordered_map>
 #include <unordered_set>
+#include <algorithm>
+#include <utility>
+#include <cassert>
+#include <atomic>
+#include <array>
+#include <tuple>
+#include <cstring>
+#include <limits>
 
 namespace GraphEval {
 
@@ -11,485 +24,1667 @@ static inline Port *outPort(Node &node)
     return outPort != node.ports.end() ? &*outPort : nullptr;
 }
 
-void update(Graph &g)
+static inline bool isConstantNode(const Node &n)
 {
-    static std::unordered_set<Id> evaluated;
-    evaluated.clear();
+    return n.type >= NodeType::Float && n.type <= NodeType::Mat4;
+}
+
+bool Plan::isValidFor(const Graph &g) const
+{
+    return graph == &g && topologyVersion == g.topologyVersion;
+}
+
+struct Source
+{
+    int order; // input port order
+    PortDataType type;
+    const Port *port; // output port of node
+    const Node *node;
+};
+
+struct NodeInfo
+{
+    std::vector<Source> sources; // in input port order
+    size_t level = 0;
+    bool sink = false;
+    bool alive = false;
+    bool folded = false;
+    bool fused = false; // evaluated as part of the chain of its consumer
+    bool chainRoot = false;
+    bool chainScaled = false; // the chain ending here has Float factors
+    size_t chainFactors = 0; // matrix and vector factors of the chain ending here
+};
+
+using NodeInfoMap = std::unordered_map<Id, NodeInfo>;
+
+// Matrix chains
+//
+// When only the sinks are observed, a Mul, Transpose, Inverse or Negate node
+// whose single consumer is another such node does not need a result of its
+// own. The whole chain is flattened into a product of factors, each a leaf
+// operand that is possibly inverted and/or transposed, plus Float scale
+// factors and a sign. transpose(transpose(x)) cancels out, and the product
+// is evaluated in the order found by the matrix chain ordering algorithm,
+// so that for example M * M * M * v becomes three matrix-vector products
+// instead of two matrix-matrix ones. The results are the same up to float
+// rounding, which is why this takes ChainMode::Fused. Inversions are never
+// cancelled or moved, singular matrices give the same NaN and Inf as
+// without fusion.
+
+static const size_t MAX_CHAIN_FACTORS = 16;
+
+static inline int matrixDim(PortDataType type)
+{
+    return type == PortDataType::Mat3 ? 3 : type == PortDataType::Mat4 ? 4 : 0;
+}
+
+static inline int vectorDim(PortDataType type)
+{
+    return type == PortDataType::Vec3 ? 3 : type == PortDataType::Vec4 ? 4 : 0;
+}
 
-    for (auto it = g.nodes.begin(), end = g.nodes.end(); it != end; ++it) {
-        if (evaluated.find(it->first) != evaluated.end())
+// 3 or 4 when the node can be part of a chain with the given operands, 0 otherwise
+static int chainDim(const Node &n, const std::vector<Source> &sources)
+{
+    if (!n.kernel)
+        return 0;
+
+    switch (n.type) {
+    case NodeType::Mul: {
+        const PortDataType a = sources[0].type;
+        const PortDataType b = sources[1].type;
+        if (const int dim = matrixDim(a)) {
+            if (matrixDim(b) == dim || vectorDim(b) == dim || b == PortDataType::Float)
+                return dim;
+        } else if (const int dim = matrixDim(b)) {
+            if (vectorDim(a) == dim || a == PortDataType::Float)
+                return dim;
+        }
+        return 0;
+    }
+    case NodeType::Transpose:
+    case NodeType::Inverse:
+        return matrixDim(sources[0].type);
+    case NodeType::Negate:
+        return vectorDim(sources[0].type);
+    default:
+        return 0;
+    }
+}
+
+// Marks the nodes to be fused into the chain of their consumer and the
+// nodes that end a chain, and returns the number of fused nodes.
+static size_t findChains(const Graph &g, NodeInfoMap &info)
+{
+    size_t fusedCount = 0;
+    for (Id id : g.topoOrder) {
+        if (!id)
+            continue;
+        NodeInfo &ni(info[id]);
+        const Node &n(g.node(id));
+        const int dim = ni.alive && !ni.folded ? chainDim(n, ni.sources) : 0;
+        if (!dim)
             continue;
 
-        static std::vector<PortData> evalStack;
-        evalStack.clear();
-        static std::vector<Id> dfsStack;
-        dfsStack.clear();
-        struct EvalNode { Id id; size_t sourceCount; };
-        static std::vector<EvalNode> nodes;
-        nodes.clear();
-
-        Node &n(it->second);
-        dfsStack.push_back(n.id);
-
-        while (!dfsStack.empty()) {
-            const Id id = dfsStack.back();
-            dfsStack.pop_back();
-            const auto sourceNodes = g.orderedSourceNodesForNode(id);
-            Node &node(g.node(id));
-            nodes.push_back({ id, sourceNodes.size() });
-            for (const std::pair<Id, int> &src : sourceNodes)
-                dfsStack.push_back(src.first);
-        }
-
-        while (!nodes.empty()) {
-            const EvalNode cur = nodes.back();
-            nodes.pop_back();
-            Node &node(g.node(cur.id));
-            if (cur.sourceCount != node.inputPortCount) {
-                // not enough connections
-                for (size_t i = 0; i < cur.sourceCount; ++i)
-                    evalStack.pop_back();
-                if (Port *oprt = outPort(node)) {
-                    PortData result = PortData::notEnoughArgsResult();
-                    oprt->data = result;
-                    evalStack.push_back(result);
-                }
-            } else if (evaluated.find(cur.id) != evaluated.end()) {
-                // already evaluated in this frame
-                for (size_t i = 0; i < node.inputPortCount; ++i)
-                    evalStack.pop_back();
-                if (Port *oprt = outPort(node))
-                    evalStack.push_back(oprt->data);
+        // sources come earlier in the order, and this is their only consumer
+        size_t factors = 0;
+        for (size_t i = 0; i < ni.sources.size(); ++i) {
+            const Source &src(ni.sources[i]);
+            NodeInfo &si(info[src.node->id]);
+            const size_t remaining = ni.sources.size() - i - 1;
+            bool fuse = !si.folded && !si.sink && si.chainFactors
+                && src.node->consumerNodes.size() == 1
+                && chainDim(*src.node, si.sources) == dim
+                && factors + si.chainFactors + remaining <= MAX_CHAIN_FACTORS;
+            // an Inverse only ever inverts a leaf, so that it is computed as
+            // in the graph: the inverse of a product would take one inversion
+            // per factor, and inverse(inverse(x)) is not x for singular x
+            if (n.type == NodeType::Inverse)
+                fuse = false;
+            if (fuse) {
+                si.fused = true;
+                ni.chainRoot = true;
+                ni.chainScaled = ni.chainScaled || si.chainScaled;
+                factors += si.chainFactors;
+                ++fusedCount;
+            } else if (src.type == PortDataType::Float) {
+                ni.chainScaled = true;
             } else {
-                evaluated.insert(cur.id);
-                if (node.evalFunc)
-                    node.evalFunc(g, node, evalStack);
+                factors += 1;
             }
         }
+        ni.chainFactors = factors;
     }
+
+    // a root that was fused itself after all is just an inner node
+    for (auto &p : info) {
+        if (p.second.fused)
+            p.second.chainRoot = false;
+    }
+    return fusedCount;
 }
 
-void evalConstantNode(Graph &g, Node &n, EvalStackType &evalStack)
+struct ChainFactor
 {
-    auto src = std::find_if(n.ports.cbegin(), n.ports.cend(), [](const Port &port) { return port.dir == PortDirection::Static; });
-    evalStack.push_back(src->data);
-    outPort(n)->data = src->data;
-}
+    const Source *leaf;
+    Plan::Chain::Kind kind;
+    bool transpose;
+    bool inverse;
+};
 
-static inline void pushOpResult(EvalStackType &evalStack, Node &n, const PortData &result, int argCount)
+struct ChainExpression
 {
-    for (int i = 0; i < argCount; ++i)
-        evalStack.pop_back();
-    evalStack.push_back(result);
-    outPort(n)->data = result;
-}
+    std::vector<ChainFactor> factors;
+    std::vector<const Source *> scalars;
+    bool negate = false;
+    bool dirty = false;
+};
 
-template<typename T, typename V>
-inline bool evalOp1Node(Graph &g, Node &n, EvalStackType &evalStack, std::function<PortDataVar(const T &a)> f)
+static void expandChain(Graph &g, const NodeInfoMap &info, Node &n, Plan::Chain::Kind vectorKind, ChainExpression &e)
 {
-    const PortData src = evalStack.back();
+    // a fused node is never evaluated, its consumer takes over the dirtiness
+    e.dirty = e.dirty || n.dirty;
+    n.dirty = false;
+
+    const std::vector<Source> &sources(info.at(n.id).sources);
+    const size_t first = e.factors.size();
+    for (size_t i = 0; i < sources.size(); ++i) {
+        const Source &src(sources[i]);
+        // a vector on the left of Mul is a row vector
+        Plan::Chain::Kind kind = Plan::Chain::Matrix;
+        if (!matrixDim(src.type)) {
+            kind = n.type != NodeType::Mul ? vectorKind
+                : i == 0 ? Plan::Chain::RowVector : Plan::Chain::ColumnVector;
+        }
+        if (info.at(src.node->id).fused)
+            expandChain(g, info, g.node(src.node->id), kind, e);
+        else if (src.type == PortDataType::Float)
+            e.scalars.push_back(&src);
+        else
+            e.factors.push_back({ &src, kind, false, false });
+    }
 
-    if (std::holds_alternative<V>(src.d)) {
-        const T a = std::get<V>(src.d).v;
-        PortData result;
-        result.d = f(a);
-        pushOpResult(evalStack, n, result, 1);
-        return true;
+    // (AB)^T = B^T A^T, and (A)^-1 for a single factor
+    if (n.type == NodeType::Transpose || n.type == NodeType::Inverse) {
+        std::reverse(e.factors.begin() + first, e.factors.end());
+        for (auto f = e.factors.begin() + first; f != e.factors.end(); ++f) {
+            if (n.type == NodeType::Transpose)
+                f->transpose = !f->transpose;
+            else
+                f->inverse = !f->inverse;
+        }
+    } else if (n.type == NodeType::Negate) {
+        e.negate = !e.negate;
     }
 
-    return false;
+    // a vector result used the other way around, like (M * v) * N, is the
+    // transposed product: v^T M^T N
+    auto vector = std::find_if(e.factors.begin() + first, e.factors.end(), [](const ChainFactor &f) {
+        return f.kind != Plan::Chain::Matrix;
+    });
+    if (vector != e.factors.end() && vector->kind != vectorKind) {
+        std::reverse(e.factors.begin() + first, e.factors.end());
+        for (auto f = e.factors.begin() + first; f != e.factors.end(); ++f) {
+            if (f->kind == Plan::Chain::Matrix)
+                f->transpose = !f->transpose;
+            else
+                f->kind = vectorKind;
+        }
+    }
 }
 
-template<typename T_LHS, typename V_LHS, typename T_RHS, typename V_RHS>
-inline bool evalOp2Node(Graph &g, Node &n, EvalStackType &evalStack, std::function<PortDataVar(const T_LHS &a, const T_RHS &b)> f)
+static inline Plan::Chain::Kind productKind(const ChainFactor *factors, size_t first, size_t last)
 {
-    const PortData rhs = evalStack.back();
-    const PortData lhs = evalStack[evalStack.size() - 2];
-
-    if (std::holds_alternative<V_LHS>(lhs.d) && std::holds_alternative<V_RHS>(rhs.d)) {
-        const T_LHS a = std::get<V_LHS>(lhs.d).v;
-        const T_RHS b = std::get<V_RHS>(rhs.d).v;
-        PortData result;
-        result.d = f(a, b);
-        pushOpResult(evalStack, n, result, 2);
-        return true;
+    for (size_t i = first; i <= last; ++i) {
+        if (factors[i].kind != Plan::Chain::Matrix)
+            return factors[i].kind;
     }
+    return Plan::Chain::Matrix;
+}
 
-    return false;
+static void emitChainSteps(Plan &plan, const ChainFactor *factors, const size_t (*split)[MAX_CHAIN_FACTORS], size_t first, size_t last)
+{
+    if (first == last)
+        return;
+    const size_t s = split[first][last];
+    emitChainSteps(plan, factors, split, first, s);
+    emitChainSteps(plan, factors, split, s + 1, last);
+
+    const Plan::Chain::Kind a = productKind(factors, first, s);
+    const Plan::Chain::Kind b = productKind(factors, s + 1, last);
+    const Plan::Chain::Op op = a == Plan::Chain::RowVector ? Plan::Chain::VectorMatrix
+        : b == Plan::Chain::ColumnVector ? Plan::Chain::MatrixVector : Plan::Chain::MatrixMatrix;
+    // the product of [first, last] ends up in register first
+    plan.chainSteps.push_back({ uint8_t(first), uint8_t(s + 1), op });
 }
 
-template<typename T_A, typename V_A, typename T_B, typename V_B, typename T_C, typename V_C>
-inline bool evalOp3Node(Graph &g, Node &n, EvalStackType &evalStack, std::function<PortDataVar(const T_A &a, const T_B &b, const T_C &c)> f)
+static inline const void *sourceValue(Plan &plan, const Source &src)
 {
-    const PortData vc = evalStack.back();
-    const PortData vb = evalStack[evalStack.size() - 2];
-    const PortData va = evalStack[evalStack.size() - 3];
+    return plan.values.pointer(plan.outputValues.at(src.port->id));
+}
 
-    if (std::holds_alternative<V_A>(va.d) && std::holds_alternative<V_B>(vb.d) && std::holds_alternative<V_C>(vc.d)) {
-        const T_A a = std::get<V_A>(va.d).v;
-        const T_B b = std::get<V_B>(vb.d).v;
-        const T_C c = std::get<V_C>(vc.d).v;
-        PortData result;
-        result.d = f(a, b, c);
-        pushOpResult(evalStack, n, result, 3);
-        return true;
+// Appends the operands of the chain ending in root to the plan and returns
+// the index of the chain.
+static int32_t compileChain(Graph &g, const NodeInfoMap &info, Node &root, Plan &plan)
+{
+    ChainExpression e;
+    expandChain(g, info, root, Plan::Chain::ColumnVector, e);
+    if (e.dirty)
+        g.markDirty(root);
+
+    const std::vector<ChainFactor> &factors(e.factors);
+
+    Plan::Chain chain;
+    chain.dim = uint8_t(std::max(matrixDim(outPort(root)->type), vectorDim(outPort(root)->type)));
+    chain.negate = e.negate;
+    chain.resultKind = productKind(factors.data(), 0, factors.size() - 1);
+    chain.firstFactor = uint32_t(plan.chainFactors.size());
+    chain.factorCount = uint32_t(factors.size());
+    chain.firstStep = uint32_t(plan.chainSteps.size());
+    chain.scalarCount = uint32_t(e.scalars.size());
+
+    // classic O(n^3) matrix chain ordering, a factor is dim x dim, dim x 1
+    // or 1 x dim
+    const size_t n = factors.size();
+    size_t rows[MAX_CHAIN_FACTORS], cols[MAX_CHAIN_FACTORS];
+    size_t cost[MAX_CHAIN_FACTORS][MAX_CHAIN_FACTORS];
+    size_t split[MAX_CHAIN_FACTORS][MAX_CHAIN_FACTORS];
+    for (size_t i = 0; i < n; ++i) {
+        rows[i] = factors[i].kind == Plan::Chain::RowVector ? 1 : chain.dim;
+        cols[i] = factors[i].kind == Plan::Chain::ColumnVector ? 1 : chain.dim;
+        cost[i][i] = 0;
+    }
+    for (size_t length = 2; length <= n; ++length) {
+        for (size_t first = 0; first + length <= n; ++first) {
+            const size_t last = first + length - 1;
+            cost[first][last] = SIZE_MAX;
+            for (size_t s = first; s < last; ++s) {
+                const size_t c = cost[first][s] + cost[s + 1][last] + rows[first] * cols[s] * cols[last];
+                if (c < cost[first][last]) {
+                    cost[first][last] = c;
+                    split[first][last] = s;
+                }
+            }
+        }
+    }
+    if (n)
+        emitChainSteps(plan, factors.data(), split, 0, n - 1);
+    chain.stepCount = uint32_t(plan.chainSteps.size() - chain.firstStep);
+
+    // operands: the factors, then the scalars
+    for (const ChainFactor &f : factors) {
+        plan.chainFactors.push_back({ f.kind, f.transpose, f.inverse });
+        plan.operands.push_back(sourceValue(plan, *f.leaf));
+        plan.operandNodes.push_back(f.leaf->node);
+    }
+    for (const Source *src : e.scalars) {
+        plan.operands.push_back(sourceValue(plan, *src));
+        plan.operandNodes.push_back(src->node);
     }
 
-    return false;
+    plan.chains.push_back(chain);
+    return int32_t(plan.chains.size() - 1);
 }
 
-template<typename T_A, typename V_A, typename T_B, typename V_B, typename T_C, typename V_C, typename T_D, typename V_D>
-inline bool evalOp4Node(Graph &g, Node &n, EvalStackType &evalStack, std::function<PortDataVar(const T_A &a, const T_B &b, const T_C &c, const T_D &d)> f)
+// Mat4Simd for 4x4 where possible, it works in place
+template<int N>
+static inline void chainInverse(glm::mat<N, N, float> &m)
 {
-    const PortData vd = evalStack.back();
-    const PortData vc = evalStack[evalStack.size() - 2];
-    const PortData vb = evalStack[evalStack.size() - 3];
-    const PortData va = evalStack[evalStack.size() - 4];
+    if constexpr (N == 4) {
+        if (Mat4Simd::available())
+            return Mat4Simd::inverse(&m[0][0], &m[0][0]);
+    }
+    m = glm::inverse(m);
+}
 
-    if (std::holds_alternative<V_A>(va.d) && std::holds_alternative<V_B>(vb.d) && std::holds_alternative<V_C>(vc.d) && std::holds_alternative<V_D>(vd.d)) {
-        const T_A a = std::get<V_A>(va.d).v;
-        const T_B b = std::get<V_B>(vb.d).v;
-        const T_C c = std::get<V_C>(vc.d).v;
-        const T_D d = std::get<V_D>(vd.d).v;
-        PortData result;
-        result.d = f(a, b, c, d);
-        pushOpResult(evalStack, n, result, 4);
-        return true;
+template<int N>
+static inline void chainMul(glm::mat<N, N, float> &a, const glm::mat<N, N, float> &b)
+{
+    if constexpr (N == 4) {
+        if (Mat4Simd::hasAvx())
+            return Mat4Simd::mulAvx(&a[0][0], &b[0][0], &a[0][0]);
+        if (Mat4Simd::available())
+            return Mat4Simd::mul(&a[0][0], &b[0][0], &a[0][0]);
     }
+    a = a * b;
+}
 
-    return false;
+template<int N>
+static inline void chainMul(const glm::mat<N, N, float> &m, glm::vec<N, float> &v)
+{
+    if constexpr (N == 4) {
+        if (Mat4Simd::available())
+            return Mat4Simd::mulVec(&m[0][0], &v[0], &v[0]);
+    }
+    v = m * v;
 }
 
-void evalPlusNode(Graph &g, Node &n, EvalStackType &evalStack)
+template<int N>
+static inline void chainMul(glm::vec<N, float> &v, const glm::mat<N, N, float> &m)
 {
-    if (evalOp2Node<float, PortDataFloat, float, PortDataFloat>(g, n, evalStack, [](float a, float b) { return PortDataFloat { a + b }; }))
-        return;
+    if constexpr (N == 4) {
+        if (Mat4Simd::available())
+            return Mat4Simd::vecMul(&v[0], &m[0][0], &v[0]);
+    }
+    v = v * m;
+}
 
-    if (evalOp2Node<glm::vec2, PortDataVec2, glm::vec2, PortDataVec2>(g, n, evalStack, [](const glm::vec2 &a, const glm::vec2 &b) { return PortDataVec2 { a + b }; }))
-        return;
+template<int N>
+static void runChain(const Plan &plan, const Plan::Chain &chain, const void *const *args, void *result)
+{
+    using Mat = glm::mat<N, N, float>;
+    using Vec = glm::vec<N, float>;
+
+    // there is at most one vector in a chain, any product with it is a vector again
+    alignas(16) Mat m[MAX_CHAIN_FACTORS];
+    alignas(16) Vec v;
+    const Plan::Chain::Factor *factors = plan.chainFactors.data() + chain.firstFactor;
+    for (size_t i = 0; i < chain.factorCount; ++i) {
+        if (factors[i].kind == Plan::Chain::Matrix) {
+            m[i] = *static_cast<const Mat *>(args[i]);
+            if (factors[i].inverse)
+                chainInverse<N>(m[i]);
+            if (factors[i].transpose)
+                m[i] = glm::transpose(m[i]);
+        } else {
+            v = *static_cast<const Vec *>(args[i]);
+        }
+    }
 
-    if (evalOp2Node<glm::vec3, PortDataVec3, glm::vec3, PortDataVec3>(g, n, evalStack, [](const glm::vec3 &a, const glm::vec3 &b) { return PortDataVec3 { a + b }; }))
-        return;
+    const Plan::Chain::Step *steps = plan.chainSteps.data() + chain.firstStep;
+    for (size_t i = 0; i < chain.stepCount; ++i) {
+        const Plan::Chain::Step &step(steps[i]);
+        switch (step.op) {
+        case Plan::Chain::MatrixMatrix:
+            chainMul<N>(m[step.a], m[step.b]);
+            break;
+        case Plan::Chain::MatrixVector:
+            chainMul<N>(m[step.a], v);
+            break;
+        case Plan::Chain::VectorMatrix:
+            chainMul<N>(v, m[step.b]);
+            break;
+        }
+    }
 
-    if (evalOp2Node<glm::vec4, PortDataVec4, glm::vec4, PortDataVec4>(g, n, evalStack, [](const glm::vec4 &a, const glm::vec4 &b) { return PortDataVec4 { a + b }; }))
-        return;
+    float scale = chain.negate ? -1.0f : 1.0f;
+    for (size_t i = 0; i < chain.scalarCount; ++i)
+        scale *= *static_cast<const float *>(args[chain.factorCount + i]);
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 2);
+    if (chain.resultKind == Plan::Chain::Matrix) {
+        *static_cast<Mat *>(result) = chain.negate || chain.scalarCount ? scale * m[0] : m[0];
+    } else {
+        *static_cast<Vec *>(result) = chain.negate || chain.scalarCount ? scale * v : v;
+    }
 }
 
-void evalMinusNode(Graph &g, Node &n, EvalStackType &evalStack)
+static inline void runChain(const Plan &plan, const Plan::Chain &chain, const void *const *args, void *result)
 {
-    if (evalOp2Node<float, PortDataFloat, float, PortDataFloat>(g, n, evalStack, [](float a, float b) { return PortDataFloat { a - b }; }))
-        return;
-
-    if (evalOp2Node<glm::vec2, PortDataVec2, glm::vec2, PortDataVec2>(g, n, evalStack, [](const glm::vec2 &a, const glm::vec2 &b) { return PortDataVec2 { a - b }; }))
-        return;
-
-    if (evalOp2Node<glm::vec3, PortDataVec3, glm::vec3, PortDataVec3>(g, n, evalStack, [](const glm::vec3 &a, const glm::vec3 &b) { return PortDataVec3 { a - b }; }))
-        return;
-
-    if (evalOp2Node<glm::vec4, PortDataVec4, glm::vec4, PortDataVec4>(g, n, evalStack, [](const glm::vec4 &a, const glm::vec4 &b) { return PortDataVec4 { a - b }; }))
-        return;
+    if (chain.dim == 3)
+        runChain<3>(plan, chain, args, result);
+    else
+        runChain<4>(plan, chain, args, result);
+}
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 2);
+// Computes the result of instr and its error code.
+static inline void evaluate(const Plan &plan, const Plan::Instruction &instr)
+{
+    if (!instr.error)
+        return;
+
+    Node &node(*instr.node);
+    if (instr.operandCount != node.descriptor().inputPortCount && instr.chain < 0) {
+        // not enough connections
+        *instr.error = PortDataError::NotEnoughArgs;
+    } else if (!instr.result) {
+        // no kernel for these operand types
+        *instr.error = PortDataError::InvalidArgs;
+    } else if (instr.chain >= 0) {
+        runChain(plan, plan.chains[instr.chain], plan.operands.data() + instr.firstOperand, instr.result);
+        *instr.error = PortDataError::None;
+    } else {
+        // bound at link time for exactly these operand types
+        node.kernel(node, plan.operands.data() + instr.firstOperand, instr.result);
+        *instr.error = PortDataError::None;
+    }
 }
 
-void evalMulNode(Graph &g, Node &n, EvalStackType &evalStack)
+// Returns true if the node was evaluated. Nodes only touch their own state
+// and read the results of nodes in earlier levels, so any number of
+// instructions of the same level can run concurrently.
+static inline bool runInstruction(const Plan &plan, const Plan::Instruction &instr, UpdateMode mode, uint64_t serial)
 {
-    if (evalOp2Node<float, PortDataFloat, float, PortDataFloat>(g, n, evalStack, [](float a, float b) { return PortDataFloat { a * b }; }))
-        return;
+    Node &node(*instr.node);
+    // shared nodes are computed once, consumers read the cached value
+    if (node.evalSerial == serial)
+        return false;
+
+    bool needed = mode == UpdateMode::Full || node.dirty;
+    // pull dirtiness from the sources, which all come earlier in this run
+    for (size_t i = 0; i < instr.operandCount && !needed; ++i)
+        needed = plan.operandNodes[instr.firstOperand + i]->evalSerial == serial;
+    if (!needed)
+        return false;
+
+    node.evalSerial = serial;
+    node.dirty = false;
+    evaluate(plan, instr);
+    return true;
+}
 
-    if (evalOp2Node<glm::vec2, PortDataVec2, glm::vec2, PortDataVec2>(g, n, evalStack, [](const glm::vec2 &a, const glm::vec2 &b) { return PortDataVec2 { a * b }; }))
-        return;
+struct LevelJob
+{
+    const Plan *plan;
+    const Plan::Instruction *instructions;
+    UpdateMode mode;
+    uint64_t serial;
+    std::atomic<size_t> evaluationCount;
+};
+
+static void runLevelRange(void *context, size_t begin, size_t end)
+{
+    LevelJob *job = static_cast<LevelJob *>(context);
+    size_t evaluationCount = 0;
+    for (size_t i = begin; i < end; ++i)
+        evaluationCount += runInstruction(*job->plan, job->instructions[i], job->mode, job->serial);
+    job->evaluationCount.fetch_add(evaluationCount, std::memory_order_relaxed);
+}
 
-    if (evalOp2Node<glm::vec2, PortDataVec2, float, PortDataFloat>(g, n, evalStack, [](const glm::vec2 &a, float b) { return PortDataVec2 { a * b }; }))
-        return;
+void compile(Graph &g, Plan &plan, const std::vector<Id> &sinks, ChainMode chains)
+{
+    plan.graph = &g;
+    plan.topologyVersion = g.topologyVersion;
+    plan.instructions.clear();
+    plan.foldedInstructions.clear();
+    plan.operands.clear();
+    plan.operandNodes.clear();
+    plan.levels.clear();
+    plan.chains.clear();
+    plan.chainFactors.clear();
+    plan.chainSteps.clear();
+    plan.deadNodeCount = 0;
+    plan.fusedNodeCount = 0;
+    plan.values.clear();
+    plan.outputValues.clear();
+    plan.native = nullptr;
+    plan.nativeLibrary.reset();
+    plan.nativeValues.clear();
+    plan.nativeInputs.clear();
+    plan.nativeNodes.clear();
+    plan.nativeRest.clear();
+
+    NodeInfoMap info;
+    info.reserve(g.nodes.size());
+
+    for (const Connection &c : g.connections) {
+        for (int i = 0; i < 2; ++i) {
+            const Port &port(g.port(c.ep[i].portId));
+            if (port.dir == PortDirection::Input) {
+                const Node &srcNode(g.node(c.ep[1 - i].nodeId));
+                const Port &srcPort(g.port(c.ep[1 - i].portId));
+                info[c.ep[i].nodeId].sources.push_back({ port.order, srcPort.type, &srcPort, &srcNode });
+            }
+        }
+    }
 
-    if (evalOp2Node<float, PortDataFloat, glm::vec2, PortDataVec2>(g, n, evalStack, [](float a, const glm::vec2 &b) { return PortDataVec2 { a * b }; }))
-        return;
+    for (auto &p : info) {
+        std::sort(p.second.sources.begin(), p.second.sources.end(), [](const Source &a, const Source &b) {
+            return a.order < b.order;
+        });
+    }
 
-    if (evalOp2Node<glm::vec3, PortDataVec3, glm::vec3, PortDataVec3>(g, n, evalStack, [](const glm::vec3 &a, const glm::vec3 &b) { return PortDataVec3 { a * b }; }))
-        return;
+    // dead node elimination: only what feeds a sink is worth evaluating
+    if (sinks.empty()) {
+        for (const Node &n : g.nodes)
+            info[n.id].alive = true;
+    } else {
+        std::vector<Id> stack;
+        for (Id id : sinks) {
+            NodeInfo &ni(info[id]);
+            ni.sink = true;
+            if (!ni.alive) {
+                ni.alive = true;
+                stack.push_back(id);
+            }
+        }
+        while (!stack.empty()) {
+            const Id id = stack.back();
+            stack.pop_back();
+            for (Id srcId : g.node(id).sourceNodes) {
+                NodeInfo &src(info[srcId]);
+                if (!src.alive) {
+                    src.alive = true;
+                    stack.push_back(srcId);
+                }
+            }
+        }
+    }
 
-    if (evalOp2Node<glm::vec3, PortDataVec3, float, PortDataFloat>(g, n, evalStack, [](const glm::vec3 &a, float b) { return PortDataVec3 { a * b }; }))
-        return;
+    // Constant folding: a constant node that is not live, and a node whose
+    // whole input cone is such constants, gives the same result until one
+    // of the constants is edited, which marks it dirty. These are evaluated
+    // in the first run after compiling, and afterwards only when dirtiness
+    // reaches them, regardless of the update mode. Every other node counts
+    // as live, Node::live or not, since anything further down is where the
+    // work of a graph built in the editor is. That is grouped into levels
+    // (longest path from a folded node or one without inputs) derived from
+    // the topological order of the graph.
+    for (Id id : g.topoOrder) {
+        if (!id)
+            continue;
+        NodeInfo &ni(info[id]);
+        if (!ni.alive) {
+            ++plan.deadNodeCount;
+            continue;
+        }
+        const Node &n(g.node(id));
+        ni.folded = n.isConstant() ? !n.live : !ni.sources.empty();
+        for (const Source &src : ni.sources) {
+            const NodeInfo &srcInfo(info[src.node->id]);
+            if (!srcInfo.folded || !src.node->isConstant())
+                ni.folded = false;
+            if (!srcInfo.folded)
+                ni.level = std::max(ni.level, srcInfo.level + 1);
+        }
+    }
 
-    if (evalOp2Node<float, PortDataFloat, glm::vec3, PortDataVec3>(g, n, evalStack, [](float a, const glm::vec3 &b) { return PortDataVec3 { a * b }; }))
-        return;
+    // intermediate results are only observable when compiling for sinks
+    if (!sinks.empty() && chains == ChainMode::Fused)
+        plan.fusedNodeCount = findChains(g, info);
 
-    if (evalOp2Node<glm::vec4, PortDataVec4, glm::vec4, PortDataVec4>(g, n, evalStack, [](const glm::vec4 &a, const glm::vec4 &b) { return PortDataVec4 { a * b }; }))
-        return;
+    std::vector<size_t> levelSizes;
+    for (Id id : g.topoOrder) {
+        if (!id)
+            continue;
+        const NodeInfo &ni(info[id]);
+        if (!ni.alive || ni.folded || ni.fused)
+            continue;
+        if (ni.level >= levelSizes.size())
+            levelSizes.resize(ni.level + 1);
+        levelSizes[ni.level] += 1;
+    }
 
-    if (evalOp2Node<glm::vec4, PortDataVec4, float, PortDataFloat>(g, n, evalStack, [](const glm::vec4 &a, float b) { return PortDataVec4 { a * b }; }))
-        return;
+    size_t start = 0;
+    for (size_t size : levelSizes) {
+        plan.levels.push_back(start);
+        start += size;
+    }
+    plan.levels.push_back(start);
+
+    // execution order: folded nodes, then level by level
+    std::vector<Node *> order;
+    std::vector<Node *> levelOrder(start);
+    std::vector<size_t> levelFill(plan.levels.begin(), plan.levels.end() - 1);
+    for (Id id : g.topoOrder) {
+        if (!id)
+            continue;
+        const NodeInfo &ni(info[id]);
+        if (!ni.alive || ni.fused)
+            continue;
+        if (ni.folded)
+            order.push_back(&g.node(id));
+        else
+            levelOrder[levelFill[ni.level]++] = &g.node(id);
+    }
+    const size_t foldedCount = order.size();
+    order.insert(order.end(), levelOrder.begin(), levelOrder.end());
 
-    if (evalOp2Node<float, PortDataFloat, glm::vec4, PortDataVec4>(g, n, evalStack, [](float a, const glm::vec4 &b) { return PortDataVec4 { a * b }; }))
-        return;
+    // values in the same order, so that a run writes them front to back
+    for (Node *node : order) {
+        if (const Port *oprt = outPort(*node))
+            plan.outputValues[oprt->id] = plan.values.add(oprt->type);
+    }
 
-    if (evalOp2Node<glm::mat3, PortDataMat3, glm::mat3, PortDataMat3>(g, n, evalStack, [](const glm::mat3 &a, const glm::mat3 &b) { return PortDataMat3 { a * b }; }))
-        return;
+    plan.foldedInstructions.reserve(foldedCount);
+    plan.instructions.reserve(start);
+    for (Node *node : order) {
+        const NodeInfo &ni(info[node->id]);
+        Plan::Instruction instr { node, nullptr, nullptr, plan.operands.size(), 0 };
+        if (const Port *oprt = outPort(*node)) {
+            const uint32_t value = plan.outputValues.at(oprt->id);
+            instr.result = plan.values.pointer(value);
+            instr.error = &plan.values.errors[value];
+        }
+        if (ni.chainRoot) {
+            instr.chain = compileChain(g, info, *node, plan);
+        } else {
+            for (const Source &src : ni.sources) {
+                plan.operands.push_back(sourceValue(plan, src));
+                plan.operandNodes.push_back(src.node);
+            }
+        }
+        instr.operandCount = plan.operands.size() - instr.firstOperand;
+        if (ni.folded)
+            plan.foldedInstructions.push_back(instr);
+        else
+            plan.instructions.push_back(instr);
+
+        // the values are new, so have the next run evaluate everything
+        // once, folded nodes included
+        g.markDirty(*node);
+    }
+}
 
-    if (evalOp2Node<glm::mat3, PortDataMat3, float, PortDataFloat>(g, n, evalStack, [](const glm::mat3 &a, float b) { return PortDataMat3 { a * b }; }))
-        return;
+// identifies a run for Node::evalSerial
+static uint64_t runSerial = 0;
 
-    if (evalOp2Node<float, PortDataFloat, glm::mat3, PortDataMat3>(g, n, evalStack, [](float a, const glm::mat3 &b) { return PortDataMat3 { a * b }; }))
-        return;
+void run(Graph &g, const Plan &plan, UpdateMode mode, Stats *stats)
+{
+    const uint64_t serial = ++runSerial;
+
+    // folded nodes are up to date unless an edited constant made them dirty
+    size_t evaluationCount = 0;
+    for (const Plan::Instruction &instr : plan.foldedInstructions)
+        evaluationCount += runInstruction(plan, instr, UpdateMode::Incremental, serial);
+
+    for (size_t level = 0; level + 1 < plan.levels.size(); ++level) {
+        const Plan::Instruction *first = plan.instructions.data() + plan.levels[level];
+        const size_t count = plan.levels[level + 1] - plan.levels[level];
+        if (count < PARALLEL_MIN_LEVEL_SIZE) {
+            // threading overhead would dominate
+            for (size_t i = 0; i < count; ++i)
+                evaluationCount += runInstruction(plan, first[i], mode, serial);
+        } else {
+            LevelJob job { &plan, first, mode, serial, { 0 } };
+            ThreadPool::instance().parallelFor(count, PARALLEL_GRAIN_SIZE, runLevelRange, &job);
+            evaluationCount += job.evaluationCount.load(std::memory_order_relaxed);
+        }
+    }
 
-    if (evalOp2Node<glm::mat3, PortDataMat3, glm::vec3, PortDataVec3>(g, n, evalStack, [](const glm::mat3 &a, const glm::vec3 &b) { return PortDataVec3 { a * b }; }))
-        return;
+    g.hasDirtyNodes = false;
 
-    if (evalOp2Node<glm::vec3, PortDataVec3, glm::mat3, PortDataMat3>(g, n, evalStack, [](const glm::vec3 &a, const glm::mat3 &b) { return PortDataVec3 { a * b }; }))
-        return;
+    if (stats) {
+        stats->nodeCount = g.nodes.size();
+        stats->evaluationCount = evaluationCount;
+        stats->foldedNodeCount = plan.foldedInstructions.size();
+        stats->deadNodeCount = plan.deadNodeCount;
+        stats->fusedNodeCount = plan.fusedNodeCount;
+        stats->native = false;
+    }
+}
 
-    if (evalOp2Node<glm::mat4, PortDataMat4, glm::mat4, PortDataMat4>(g, n, evalStack, [](const glm::mat4 &a, const glm::mat4 &b) { return PortDataMat4 { a * b }; }))
-        return;
+// The native function computes everything it covers in one go, so there
+// is no dirty tracking between its constants and its results. The nodes
+// it does not cover only read from constants, from each other or from
+// its results, never the other way round.
+static void runNative(Graph &g, const Plan &plan, UpdateMode mode, Stats *stats)
+{
+    const uint64_t serial = ++runSerial;
 
-    if (evalOp2Node<glm::mat4, PortDataMat4, float, PortDataFloat>(g, n, evalStack, [](const glm::mat4 &a, float b) { return PortDataMat4 { a * b }; }))
-        return;
+    size_t evaluationCount = 0;
+    for (const Plan::Instruction &instr : plan.nativeInputs)
+        evaluationCount += runInstruction(plan, instr, mode, serial);
 
-    if (evalOp2Node<float, PortDataFloat, glm::mat4, PortDataMat4>(g, n, evalStack, [](float a, const glm::mat4 &b) { return PortDataMat4 { a * b }; }))
-        return;
+    if (evaluationCount || mode == UpdateMode::Full) {
+        plan.native(plan.nativeValues.data());
+        for (Node *node : plan.nativeNodes) {
+            node->evalSerial = serial;
+            node->dirty = false;
+        }
+        evaluationCount += plan.nativeNodes.size();
+    }
 
-    if (evalOp2Node<glm::mat4, PortDataMat4, glm::vec4, PortDataVec4>(g, n, evalStack, [](const glm::mat4 &a, const glm::vec4 &b) { return PortDataVec4 { a * b }; }))
-        return;
+    for (const Plan::Instruction &instr : plan.nativeRest)
+        evaluationCount += runInstruction(plan, instr, mode, serial);
 
-    if (evalOp2Node<glm::vec4, PortDataVec4, glm::mat4, PortDataMat4>(g, n, evalStack, [](const glm::vec4 &a, const glm::mat4 &b) { return PortDataVec4 { a * b }; }))
-        return;
+    g.hasDirtyNodes = false;
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 2);
+    if (stats) {
+        stats->nodeCount = g.nodes.size();
+        stats->evaluationCount = evaluationCount;
+        stats->foldedNodeCount = 0;
+        stats->deadNodeCount = plan.deadNodeCount;
+        stats->fusedNodeCount = plan.fusedNodeCount;
+        stats->native = true;
+    }
 }
 
-void evalDivNode(Graph &g, Node &n, EvalStackType &evalStack)
+static Plan cachedPlan;
+static Stats lastStats;
+
+void update(Graph &g, UpdateMode mode)
 {
-    if (evalOp2Node<float, PortDataFloat, float, PortDataFloat>(g, n, evalStack, [](float a, float b) { return PortDataFloat { a / b }; }))
-        return;
+    assert(!g.isEditing());
+    const uint64_t allocationCount = AllocCounter::count();
 
-    if (evalOp2Node<glm::vec2, PortDataVec2, glm::vec2, PortDataVec2>(g, n, evalStack, [](const glm::vec2 &a, const glm::vec2 &b) { return PortDataVec2 { a / b }; }))
+    if (!cachedPlan.isValidFor(g)) {
+        compile(g, cachedPlan);
+    } else if (mode == UpdateMode::Incremental && !g.hasDirtyNodes) {
+        lastStats.nodeCount = g.nodes.size();
+        lastStats.evaluationCount = 0;
+        lastStats.allocationCount = 0;
         return;
+    }
 
-    if (evalOp2Node<glm::vec3, PortDataVec3, glm::vec3, PortDataVec3>(g, n, evalStack, [](const glm::vec3 &a, const glm::vec3 &b) { return PortDataVec3 { a / b }; }))
-        return;
+    if (cachedPlan.native)
+        runNative(g, cachedPlan, mode, &lastStats);
+    else
+        run(g, cachedPlan, mode, &lastStats);
+    assert(lastStats.evaluationCount <= lastStats.nodeCount);
 
-    if (evalOp2Node<glm::vec4, PortDataVec4, glm::vec4, PortDataVec4>(g, n, evalStack, [](const glm::vec4 &a, const glm::vec4 &b) { return PortDataVec4 { a / b }; }))
-        return;
+    lastStats.allocationCount = size_t(AllocCounter::count() - allocationCount);
+}
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 2);
+const Stats &stats()
+{
+    return lastStats;
 }
 
-void evalDistanceNode(Graph &g, Node &n, EvalStackType &evalStack)
+const Plan &updatePlan()
 {
-    if (evalOp2Node<glm::vec2, PortDataVec2, glm::vec2, PortDataVec2>(g, n, evalStack, [](const glm::vec2 &a, const glm::vec2 &b) { return PortDataFloat { glm::distance(a, b) }; }))
-        return;
+    return cachedPlan;
+}
 
-    if (evalOp2Node<glm::vec3, PortDataVec3, glm::vec3, PortDataVec3>(g, n, evalStack, [](const glm::vec3 &a, const glm::vec3 &b) { return PortDataFloat { glm::distance(a, b) }; }))
-        return;
+bool attachNative(Graph &g, Plan::NativeFunction function, std::shared_ptr<void> library, const std::vector<Id> &nodes)
+{
+    Plan &plan(cachedPlan);
+    if (!plan.isValidFor(g) || !function)
+        return false;
+
+    std::unordered_map<const Node *, const Plan::Instruction *> instructions;
+    instructions.reserve(plan.foldedInstructions.size() + plan.instructions.size());
+    for (const Plan::Instruction &instr : plan.foldedInstructions)
+        instructions[instr.node] = &instr;
+    for (const Plan::Instruction &instr : plan.instructions)
+        instructions[instr.node] = &instr;
+
+    std::vector<void *> values;
+    std::vector<Plan::Instruction> inputs;
+    std::vector<Node *> computed;
+    std::unordered_set<const Node *> covered;
+    values.reserve(nodes.size());
+    for (Id id : nodes) {
+        Node *node = g.nodes.find(id);
+        auto instr = node ? instructions.find(node) : instructions.end();
+        if (instr == instructions.end() || !instr->second->result || instr->second->chain >= 0)
+            return false;
+        values.push_back(instr->second->result);
+        if (isConstantNode(*node))
+            inputs.push_back(*instr->second);
+        else
+            computed.push_back(node);
+        covered.insert(node);
+    }
 
-    if (evalOp2Node<glm::vec4, PortDataVec4, glm::vec4, PortDataVec4>(g, n, evalStack, [](const glm::vec4 &a, const glm::vec4 &b) { return PortDataFloat { glm::distance(a, b) }; }))
-        return;
+    std::vector<Plan::Instruction> rest;
+    for (const std::vector<Plan::Instruction> *list : { &plan.foldedInstructions, &plan.instructions }) {
+        for (const Plan::Instruction &instr : *list) {
+            if (!covered.count(instr.node))
+                rest.push_back(instr);
+        }
+    }
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 2);
+    plan.native = function;
+    plan.nativeLibrary = std::move(library);
+    plan.nativeValues = std::move(values);
+    plan.nativeInputs = std::move(inputs);
+    plan.nativeNodes = std::move(computed);
+    plan.nativeRest = std::move(rest);
+    return true;
 }
 
-void evalDotNode(Graph &g, Node &n, EvalStackType &evalStack)
+void detachNative()
 {
-    if (evalOp2Node<glm::vec2, PortDataVec2, glm::vec2, PortDataVec2>(g, n, evalStack, [](const glm::vec2 &a, const glm::vec2 &b) { return PortDataFloat { glm::dot(a, b) }; }))
-        return;
+    cachedPlan.native = nullptr;
+    cachedPlan.nativeLibrary.reset();
+    cachedPlan.nativeValues.clear();
+    cachedPlan.nativeInputs.clear();
+    cachedPlan.nativeNodes.clear();
+    cachedPlan.nativeRest.clear();
+}
 
-    if (evalOp2Node<glm::vec3, PortDataVec3, glm::vec3, PortDataVec3>(g, n, evalStack, [](const glm::vec3 &a, const glm::vec3 &b) { return PortDataFloat { glm::dot(a, b) }; }))
-        return;
+PortData result(const Plan &plan, Id portId)
+{
+    auto value = plan.outputValues.find(portId);
+    return value != plan.outputValues.end() ? plan.values.portData(value->second) : PortData();
+}
 
-    if (evalOp2Node<glm::vec4, PortDataVec4, glm::vec4, PortDataVec4>(g, n, evalStack, [](const glm::vec4 &a, const glm::vec4 &b) { return PortDataFloat { glm::dot(a, b) }; }))
-        return;
+size_t valueSize(PortDataType type)
+{
+    switch (type) {
+    case PortDataType::Float:
+        return sizeof(float);
+    case PortDataType::Vec2:
+        return sizeof(glm::vec2);
+    case PortDataType::Vec3:
+        return sizeof(glm::vec3);
+    case PortDataType::Vec4:
+        return sizeof(glm::vec4);
+    case PortDataType::Mat3:
+        return sizeof(glm::mat3);
+    case PortDataType::Mat4:
+        return sizeof(glm::mat4);
+    default:
+        return 0;
+    }
+}
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 2);
+// room for laneCount values in lane memory, cache line aligned
+static size_t allocateLanes(Batch &batch, PortDataType type)
+{
+    const size_t offset = (batch.laneMemorySize + 63) & ~size_t(63);
+    batch.laneMemorySize = offset + batch.laneCount * valueSize(type);
+    return offset;
 }
 
-void evalCrossNode(Graph &g, Node &n, EvalStackType &evalStack)
+bool compileBatch(const Plan &plan, const std::vector<Id> &varied, const std::vector<Id> &outputs, size_t laneCount,
+                  Batch &batch)
 {
-    if (evalOp2Node<glm::vec3, PortDataVec3, glm::vec3, PortDataVec3>(g, n, evalStack, [](const glm::vec3 &a, const glm::vec3 &b) { return PortDataVec3 { glm::cross(a, b) }; }))
-        return;
+    batch = Batch();
+    batch.laneCount = laneCount;
+    const Graph &g(*plan.graph);
+
+    std::unordered_map<const Node *, const Plan::Instruction *> instructions;
+    instructions.reserve(plan.foldedInstructions.size() + plan.instructions.size());
+    for (const Plan::Instruction &instr : plan.foldedInstructions)
+        instructions[instr.node] = &instr;
+    for (const Plan::Instruction &instr : plan.instructions)
+        instructions[instr.node] = &instr;
+
+    // plan value -> its lanes
+    std::unordered_map<const void *, Batch::Value> lanes;
+
+    for (Id id : varied) {
+        const Node *node = g.nodes.find(id);
+        if (!node || !isConstantNode(*node)) {
+            batch.failedNode = id;
+            return false;
+        }
+        Batch::Input input;
+        auto instr = instructions.find(node);
+        if (instr != instructions.end() && instr->second->result) {
+            const void *value = instr->second->result;
+            auto known = lanes.find(value);
+            if (known == lanes.end()) {
+                const PortDataType type = outPort(*instr->second->node)->type;
+                if (!valueSize(type)) {
+                    // arrays are not batched
+                    batch.failedNode = id;
+                    return false;
+                }
+                known = lanes.insert({ value, { type, nullptr, allocateLanes(batch, type) } }).first;
+            }
+            input.type = known->second.type;
+            input.offset = known->second.offset;
+            input.current = value;
+        }
+        batch.inputs.push_back(input);
+    }
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 2);
+    // Returns false when the instruction depends on a varied node but
+    // cannot be evaluated. Plan order is topological, folded instructions
+    // first.
+    auto add = [&plan, &batch, &lanes](const Plan::Instruction &instr) {
+        if (!instr.error || lanes.count(instr.result))
+            return true;
+        uint32_t varying = 0;
+        bool depends = false;
+        for (size_t i = 0; i < instr.operandCount; ++i) {
+            if (lanes.count(plan.operands[instr.firstOperand + i])) {
+                depends = true;
+                if (i < 32)
+                    varying |= 1u << i;
+            }
+        }
+        if (!depends)
+            return true;
+        if (!instr.result || (instr.chain < 0 && instr.operandCount != instr.node->descriptor().inputPortCount))
+            return false;
+
+        const PortDataType type = outPort(*instr.node)->type;
+        if (!valueSize(type))
+            return false;
+        Batch::Instruction bi { &instr, batch.operands.size(), varying, allocateLanes(batch, type), valueSize(type) };
+        for (size_t i = 0; i < instr.operandCount; ++i) {
+            const void *operand = plan.operands[instr.firstOperand + i];
+            auto l = lanes.find(operand);
+            batch.operands.push_back(l != lanes.end() ? l->second : Batch::Value { PortDataType::Empty, operand, 0 });
+        }
+        lanes[instr.result] = { type, nullptr, bi.result };
+        batch.maxOperandCount = std::max(batch.maxOperandCount, instr.operandCount);
+        batch.instructions.push_back(bi);
+        return true;
+    };
+    for (const std::vector<Plan::Instruction> *list : { &plan.foldedInstructions, &plan.instructions }) {
+        for (const Plan::Instruction &instr : *list) {
+            if (!add(instr)) {
+                batch.failedNode = instr.node->id;
+                return false;
+            }
+        }
+    }
+
+    for (Id id : outputs) {
+        const Node *node = g.nodes.find(id);
+        auto instr = node ? instructions.find(node) : instructions.end();
+        if (instr == instructions.end() || !instr->second->result || !valueSize(outPort(*instr->second->node)->type)) {
+            batch.failedNode = id;
+            return false;
+        }
+        auto l = lanes.find(instr->second->result);
+        if (l != lanes.end()) {
+            batch.outputs.push_back(l->second);
+        } else if (*instr->second->error == PortDataError::None) {
+            batch.outputs.push_back({ outPort(*instr->second->node)->type, instr->second->result, 0 });
+        } else {
+            batch.failedNode = id;
+            return false;
+        }
+    }
+
+    return true;
 }
 
-void evalNegateNode(Graph &g, Node &n, EvalStackType &evalStack)
+void runBatch(const Plan &plan, const Batch &batch, void *laneMemory, size_t count)
 {
-    if (evalOp1Node<float, PortDataFloat>(g, n, evalStack, [](float a) { return PortDataFloat { -a }; }))
-        return;
+    char *lanes = static_cast<char *>(laneMemory);
+    // the operands of all lanes, then those of one lane
+    std::vector<const void *> operandPointers(2 * batch.maxOperandCount);
+    const void **args = operandPointers.data();
+    const void **laneArgs = args + batch.maxOperandCount;
+
+    for (const Batch::Instruction &bi : batch.instructions) {
+        const Plan::Instruction &instr(*bi.instr);
+        const Node &node(*instr.node);
+        const Batch::Value *operands = batch.operands.data() + bi.firstOperand;
+        for (size_t i = 0; i < instr.operandCount; ++i)
+            args[i] = operands[i].fixed ? operands[i].fixed : lanes + operands[i].offset;
+        char *result = lanes + bi.result;
+
+        if (instr.chain < 0 && node.batchKernel) {
+            node.batchKernel(node, args, bi.varyingOperands, result, count);
+            continue;
+        }
 
-    if (evalOp1Node<glm::vec2, PortDataVec2>(g, n, evalStack, [](const glm::vec2 &a) { return PortDataVec2 { -a }; }))
-        return;
+        for (size_t lane = 0; lane < count; ++lane) {
+            for (size_t i = 0; i < instr.operandCount; ++i) {
+                laneArgs[i] = operands[i].fixed ? operands[i].fixed
+                                                : lanes + operands[i].offset + lane * valueSize(operands[i].type);
+            }
+            if (instr.chain >= 0)
+                runChain(plan, plan.chains[size_t(instr.chain)], laneArgs, result + lane * bi.resultSize);
+            else
+                node.kernel(node, laneArgs, result + lane * bi.resultSize);
+        }
+    }
+}
 
-    if (evalOp1Node<glm::vec3, PortDataVec3>(g, n, evalStack, [](const glm::vec3 &a) { return PortDataVec3 { -a }; }))
-        return;
+// The operand and result types are known when the kernel is bound, so
+// the values are accessed without any checks.
+template<typename Op, typename... Ts, size_t... I>
+static inline void opKernelImpl(const void *const *args, void *result, std::index_sequence<I...>)
+{
+    using R = std::decay_t<decltype(Op()(std::declval<const Ts &>()...))>;
+    *static_cast<R *>(result) = Op()(*static_cast<const Ts *>(args[I])...);
+}
 
-    if (evalOp1Node<glm::vec4, PortDataVec4>(g, n, evalStack, [](const glm::vec4 &a) { return PortDataVec4 { -a }; }))
-        return;
+template<typename Op, typename... Ts>
+static void opKernel(const Node &, const void *const *args, void *result)
+{
+    opKernelImpl<Op, Ts...>(args, result, std::index_sequence_for<Ts...>());
+}
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 1);
+// Batched: one loop per combination of varying operands, so that the
+// strides are known at compile time and the compiler can vectorize.
+template<typename Op, uint32_t VARYING, typename... Ts, size_t... I>
+static inline void opBatchKernelImpl(const void *const *args, void *result, size_t count, std::index_sequence<I...>)
+{
+    using R = std::decay_t<decltype(Op()(std::declval<const Ts &>()...))>;
+    R *r = static_cast<R *>(result);
+    for (size_t lane = 0; lane < count; ++lane)
+        r[lane] = Op()(static_cast<const Ts *>(args[I])[(VARYING >> I) & 1 ? lane : 0]...);
 }
 
-void evalVec2CastNode(Graph &g, Node &n, EvalStackType &evalStack)
+template<typename Op, uint32_t VARYING, typename... Ts>
+static void opBatchLoop(const void *const *args, void *result, size_t count)
 {
-    if (evalOp1Node<glm::vec2, PortDataVec2>(g, n, evalStack, [](const glm::vec2 &a) { return PortDataVec2 { a }; }))
-        return;
+    opBatchKernelImpl<Op, VARYING, Ts...>(args, result, count, std::index_sequence_for<Ts...>());
+}
 
-    if (evalOp1Node<float, PortDataFloat>(g, n, evalStack, [](float a) { return PortDataVec2 { glm::vec2(a) }; }))
-        return;
+template<typename Op, typename... Ts>
+struct OpBatchLoops
+{
+    using Loop = void (*)(const void *const *args, void *result, size_t count);
 
-    if (evalOp1Node<glm::vec3, PortDataVec3>(g, n, evalStack, [](const glm::vec3 &a) { return PortDataVec2 { glm::vec2(a) }; }))
-        return;
+    template<uint32_t... VARYING>
+    static constexpr std::array<Loop, sizeof...(VARYING)> make(std::integer_sequence<uint32_t, VARYING...>)
+    {
+        return { { opBatchLoop<Op, VARYING, Ts...>... } };
+    }
 
-    if (evalOp1Node<glm::vec4, PortDataVec4>(g, n, evalStack, [](const glm::vec4 &a) { return PortDataVec2 { glm::vec2(a) }; }))
-        return;
+    static constexpr std::array<Loop, (1u << sizeof...(Ts))> loops =
+        make(std::make_integer_sequence<uint32_t, (1u << sizeof...(Ts))>());
+};
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 1);
+template<typename Op, typename... Ts>
+static void opBatchKernel(const Node &, const void *const *args, uint32_t varyingArgs, void *result, size_t count)
+{
+    OpBatchLoops<Op, Ts...>::loops[varyingArgs](args, result, count);
 }
 
-void evalVec3CastNode(Graph &g, Node &n, EvalStackType &evalStack)
-{
-    if (evalOp1Node<glm::vec3, PortDataVec3>(g, n, evalStack, [](const glm::vec3 &a) { return PortDataVec3 { a }; }))
-        return;
+// Arrays: the same operators element by element, with the values that
+// are not arrays used for every element. The results of a tile of
+// elements go to a local buffer first and are copied out from there, so
+// that the loop around Op only writes memory the compiler knows not to
+// alias the operands and gets vectorized across elements, the components
+// of a vector or matrix each taking one SIMD lane of consecutive elements.
 
-    if (evalOp1Node<float, PortDataFloat>(g, n, evalStack, [](float a) { return PortDataVec3 { glm::vec3(a) }; }))
-        return;
+static const size_t ARRAY_TILE_SIZE = 256; // a multiple of ValueArray::PADDING
 
-    if (evalOp1Node<glm::vec2, PortDataVec2>(g, n, evalStack, [](const glm::vec2 &a) { return PortDataVec3 { glm::vec3(a.x, a.y, 0.0f) }; }))
-        return;
+template<typename T>
+static constexpr bool hasArrayType = arrayType(ValueTraits<T>::type) != PortDataType::Empty;
 
-    if (evalOp1Node<glm::vec4, PortDataVec4>(g, n, evalStack, [](const glm::vec4 &a) { return PortDataVec3 { glm::vec3(a.x, a.y, a.z) }; }))
-        return;
+// Element i of the components c, and back. Built from scalars rather
+// than through memory, so that elements stay in registers and nothing
+// stalls on store forwarding where the loop is not vectorized.
+template<typename T>
+static inline T gather(const float *const *c, size_t i)
+{
+    if constexpr (std::is_same_v<T, float>) {
+        return c[0][i];
+    } else if constexpr (std::is_same_v<T, glm::vec2>) {
+        return T(c[0][i], c[1][i]);
+    } else if constexpr (std::is_same_v<T, glm::vec3>) {
+        return T(c[0][i], c[1][i], c[2][i]);
+    } else if constexpr (std::is_same_v<T, glm::vec4>) {
+        return T(c[0][i], c[1][i], c[2][i], c[3][i]);
+    } else {
+        static_assert(std::is_same_v<T, glm::mat4>);
+        return T(gather<glm::vec4>(c, i), gather<glm::vec4>(c + 4, i), gather<glm::vec4>(c + 8, i),
+                 gather<glm::vec4>(c + 12, i));
+    }
+}
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 1);
+template<typename T, size_t STRIDE>
+static inline void scatter(const T &v, float (*c)[STRIDE], size_t i)
+{
+    if constexpr (std::is_same_v<T, float>) {
+        c[0][i] = v;
+    } else if constexpr (std::is_same_v<T, glm::mat4>) {
+        for (int k = 0; k < 4; ++k)
+            scatter(v[k], c + 4 * k, i);
+    } else {
+        for (int k = 0; k < T::length(); ++k)
+            c[k][i] = v[k];
+    }
 }
 
-void evalVec4CastNode(Graph &g, Node &n, EvalStackType &evalStack)
+template<typename T, bool ARRAY>
+struct ArrayOperand;
+
+template<typename T>
+struct ArrayOperand<T, false>
 {
-    if (evalOp1Node<glm::vec4, PortDataVec4>(g, n, evalStack, [](const glm::vec4 &a) { return PortDataVec4 { a }; }))
-        return;
+    T v;
 
-    if (evalOp1Node<float, PortDataFloat>(g, n, evalStack, [](float a) { return PortDataVec4 { glm::vec4(a) }; }))
-        return;
+    explicit ArrayOperand(const void *arg) : v(*static_cast<const T *>(arg)) { }
+    size_t count() const { return SIZE_MAX; }
+    const T &operator[](size_t) const { return v; }
+};
 
-    if (evalOp1Node<glm::vec2, PortDataVec2>(g, n, evalStack, [](const glm::vec2 &a) { return PortDataVec4 { glm::vec4(a.x, a.y, 0.0f, 0.0f) }; }))
-        return;
+template<typename T>
+struct ArrayOperand<T, true>
+{
+    static constexpr int COMPONENTS = ValueArray<T>::COMPONENTS;
+    const float *c[COMPONENTS];
+    size_t n;
+
+    explicit ArrayOperand(const void *arg)
+    {
+        const ValueArray<T> &a(*static_cast<const ValueArray<T> *>(arg));
+        for (int i = 0; i < COMPONENTS; ++i)
+            c[i] = a.component(i);
+        n = a.count;
+    }
 
-    if (evalOp1Node<glm::vec3, PortDataVec3>(g, n, evalStack, [](const glm::vec3 &a) { return PortDataVec4 { glm::vec4(a.x, a.y, a.z, 0.0f) }; }))
-        return;
+    size_t count() const { return n; }
+
+    T operator[](size_t i) const { return gather<T>(c, i); }
+};
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 1);
+// The result has as many elements as the shortest array operand.
+template<typename Op, uint32_t ARRAYS, typename... Ts, size_t... I>
+static inline void opArrayKernelImpl(const void *const *args, void *result, std::index_sequence<I...>)
+{
+    using R = std::decay_t<decltype(Op()(std::declval<const Ts &>()...))>;
+    constexpr int COMPONENTS = ValueArray<R>::COMPONENTS;
+    std::tuple<ArrayOperand<Ts, ((ARRAYS >> I) & 1) != 0>...> operands { args[I]... };
+    const size_t count = std::min({ std::get<I>(operands).count()... });
+    ValueArray<R> &r(*static_cast<ValueArray<R> *>(result));
+    r.resize(count);
+
+    // whole runs of PADDING elements, the padding of the last one is
+    // computed as well, which keeps the inner loop free of a remainder
+    constexpr size_t RUN = ValueArray<R>::PADDING;
+    alignas(64) float tile[COMPONENTS][ARRAY_TILE_SIZE];
+    for (size_t first = 0; first < count; first += ARRAY_TILE_SIZE) {
+        const size_t n = std::min(ARRAY_TILE_SIZE, count - first);
+        for (size_t run = 0; run < n; run += RUN) {
+            for (size_t i = run; i < run + RUN; ++i)
+                scatter(Op()(std::get<I>(operands)[first + i]...), tile, i);
+        }
+        for (int c = 0; c < COMPONENTS; ++c)
+            memcpy(r.component(c) + first, tile[c], n * sizeof(float));
+    }
 }
 
-void evalMat3CastNode(Graph &g, Node &n, EvalStackType &evalStack)
+template<typename Op, uint32_t ARRAYS, typename... Ts>
+static void opArrayKernel(const Node &, const void *const *args, void *result)
 {
-    if (evalOp1Node<glm::mat3, PortDataMat3>(g, n, evalStack, [](const glm::mat3 &a) { return PortDataMat3 { a }; }))
-        return;
+    opArrayKernelImpl<Op, ARRAYS, Ts...>(args, result, std::index_sequence_for<Ts...>());
+}
 
-    if (evalOp1Node<glm::mat4, PortDataMat4>(g, n, evalStack, [](const glm::mat4 &a) { return PortDataMat3 { glm::mat3(a) }; }))
-        return;
+// ARRAYS has a bit set for each operand that is an array
+template<typename Op, uint32_t ARRAYS, typename... Ts, size_t... I>
+static constexpr Node::Kernel arrayKernel(std::index_sequence<I...>)
+{
+    using R = std::decay_t<decltype(Op()(std::declval<const Ts &>()...))>;
+    if constexpr (ARRAYS == 0 || ARRAYS >> sizeof...(Ts) || !hasArrayType<R>
+                  || !((!((ARRAYS >> I) & 1) || hasArrayType<Ts>) && ...))
+        return nullptr;
+    else
+        return opArrayKernel<Op, ARRAYS, Ts...>;
+}
+
+static const uint32_t ARRAY_KERNEL_COUNT = 16; // for up to 4 operands
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 1);
+template<typename Op, typename... Ts, uint32_t... ARRAYS>
+static constexpr std::array<Node::Kernel, ARRAY_KERNEL_COUNT> arrayKernels(std::integer_sequence<uint32_t, ARRAYS...>)
+{
+    return { { arrayKernel<Op, ARRAYS, Ts...>(std::index_sequence_for<Ts...>())... } };
 }
 
-void evalMat4CastNode(Graph &g, Node &n, EvalStackType &evalStack)
+struct Signature
 {
-    if (evalOp1Node<glm::mat4, PortDataMat4>(g, n, evalStack, [](const glm::mat4 &a) { return PortDataMat4 { a }; }))
-        return;
+    PortDataType args[4];
+    PortDataType result;
+    Node::Kernel kernel;
+    Node::BatchKernel batchKernel;
+    std::array<Node::Kernel, ARRAY_KERNEL_COUNT> arrayKernels; // by ARRAYS, null where there is no array type
+};
+
+template<typename Op, typename... Ts>
+static constexpr Signature sig()
+{
+    using R = std::decay_t<decltype(Op()(std::declval<const Ts &>()...))>;
+    return Signature { { ValueTraits<Ts>::type... }, ValueTraits<R>::type, opKernel<Op, Ts...>, opBatchKernel<Op, Ts...>,
+                       arrayKernels<Op, Ts...>(std::make_integer_sequence<uint32_t, ARRAY_KERNEL_COUNT>()) };
+}
 
-    if (evalOp1Node<glm::mat3, PortDataMat3>(g, n, evalStack, [](const glm::mat3 &a) { return PortDataMat4 { glm::mat4(a) }; }))
-        return;
+// Mat4Simd versions of Mat4 kernels; the values of a ValueStore are
+// suitably aligned
+template<void (*F)(const float *, const float *, float *)>
+static void simdKernel(const Node &, const void *const *args, void *result)
+{
+    F(static_cast<const float *>(args[0]), static_cast<const float *>(args[1]), static_cast<float *>(result));
+}
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 1);
+static void simdInverseKernel(const Node &, const void *const *args, void *result)
+{
+    Mat4Simd::inverse(static_cast<const float *>(args[0]), static_cast<float *>(result));
 }
 
-void evalLengthNode(Graph &g, Node &n, EvalStackType &evalStack)
+static void simdDeterminantKernel(const Node &, const void *const *args, void *result)
 {
-    if (evalOp1Node<glm::vec2, PortDataVec2>(g, n, evalStack, [](const glm::vec2 &a) { return PortDataFloat { glm::length(a) }; }))
-        return;
+    *static_cast<float *>(result) = Mat4Simd::determinant(static_cast<const float *>(args[0]));
+}
 
-    if (evalOp1Node<glm::vec3, PortDataVec3>(g, n, evalStack, [](const glm::vec3 &a) { return PortDataFloat { glm::length(a) }; }))
-        return;
+// s with kernel instead, if the CPU can run Mat4Simd code; batches then
+// call it lane by lane, which beats the glm loop
+static Signature simd(Signature s, Node::Kernel kernel)
+{
+    if (Mat4Simd::available()) {
+        s.kernel = kernel;
+        s.batchKernel = nullptr;
+    }
+    return s;
+}
 
-    if (evalOp1Node<glm::vec4, PortDataVec4>(g, n, evalStack, [](const glm::vec4 &a) { return PortDataFloat { glm::length(a) }; }))
-        return;
+struct Plus { template<typename A, typename B> auto operator()(const A &a, const B &b) const { return a + b; } };
+struct Minus { template<typename A, typename B> auto operator()(const A &a, const B &b) const { return a - b; } };
+struct Mul { template<typename A, typename B> auto operator()(const A &a, const B &b) const { return a * b; } };
+struct Div { template<typename A, typename B> auto operator()(const A &a, const B &b) const { return a / b; } };
+struct Negate { template<typename A> A operator()(const A &a) const { return -a; } };
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 1);
-}
+struct Length { template<typename A> float operator()(const A &a) const { return glm::length(a); } };
+struct Distance { template<typename A> float operator()(const A &a, const A &b) const { return glm::distance(a, b); } };
+struct Dot { template<typename A> float operator()(const A &a, const A &b) const { return glm::dot(a, b); } };
+struct Cross { glm::vec3 operator()(const glm::vec3 &a, const glm::vec3 &b) const { return glm::cross(a, b); } };
+struct Normalize { template<typename A> A operator()(const A &a) const { return glm::normalize(a); } };
 
-void evalNormalizeNode(Graph &g, Node &n, EvalStackType &evalStack)
+struct Transpose { template<typename A> A operator()(const A &a) const { return glm::transpose(a); } };
+struct Inverse { template<typename A> A operator()(const A &a) const { return glm::inverse(a); } };
+struct Determinant { template<typename A> float operator()(const A &a) const { return glm::determinant(a); } };
+
+struct Vec2Cast
 {
-    if (evalOp1Node<glm::vec2, PortDataVec2>(g, n, evalStack, [](const glm::vec2 &a) { return PortDataVec2 { glm::normalize(a) }; }))
-        return;
+    glm::vec2 operator()(float a) const { return glm::vec2(a); }
+    glm::vec2 operator()(const glm::vec2 &a) const { return a; }
+    glm::vec2 operator()(const glm::vec3 &a) const { return glm::vec2(a); }
+    glm::vec2 operator()(const glm::vec4 &a) const { return glm::vec2(a); }
+};
 
-    if (evalOp1Node<glm::vec3, PortDataVec3>(g, n, evalStack, [](const glm::vec3 &a) { return PortDataVec3 { glm::normalize(a) }; }))
-        return;
+struct Vec3Cast
+{
+    glm::vec3 operator()(float a) const { return glm::vec3(a); }
+    glm::vec3 operator()(const glm::vec2 &a) const { return glm::vec3(a.x, a.y, 0.0f); }
+    glm::vec3 operator()(const glm::vec3 &a) const { return a; }
+    glm::vec3 operator()(const glm::vec4 &a) const { return glm::vec3(a.x, a.y, a.z); }
+};
 
-    if (evalOp1Node<glm::vec4, PortDataVec4>(g, n, evalStack, [](const glm::vec4 &a) { return PortDataVec4 { glm::normalize(a) }; }))
-        return;
+struct Vec4Cast
+{
+    glm::vec4 operator()(float a) const { return glm::vec4(a); }
+    glm::vec4 operator()(const glm::vec2 &a) const { return glm::vec4(a.x, a.y, 0.0f, 0.0f); }
+    glm::vec4 operator()(const glm::vec3 &a) const { return glm::vec4(a.x, a.y, a.z, 0.0f); }
+    glm::vec4 operator()(const glm::vec4 &a) const { return a; }
+};
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 1);
-}
+struct Mat3Cast
+{
+    glm::mat3 operator()(const glm::mat3 &a) const { return a; }
+    glm::mat3 operator()(const glm::mat4 &a) const { return glm::mat3(a); }
+};
 
-void evalTransposeNode(Graph &g, Node &n, EvalStackType &evalStack)
+struct Mat4Cast
 {
-    if (evalOp1Node<glm::mat3, PortDataMat3>(g, n, evalStack, [](const glm::mat3 &a) { return PortDataMat3 { glm::transpose(a) }; }))
-        return;
+    glm::mat4 operator()(const glm::mat3 &a) const { return glm::mat4(a); }
+    glm::mat4 operator()(const glm::mat4 &a) const { return a; }
+};
+
+struct Vec2Combine { glm::vec2 operator()(float a, float b) const { return glm::vec2(a, b); } };
+struct Vec3Combine { glm::vec3 operator()(float a, float b, float c) const { return glm::vec3(a, b, c); } };
+struct Vec4Combine { glm::vec4 operator()(float a, float b, float c, float d) const { return glm::vec4(a, b, c, d); } };
+
+static const Signature plusSignatures[] = {
+    sig<Plus, float, float>(),
+    sig<Plus, glm::vec2, glm::vec2>(),
+    sig<Plus, glm::vec3, glm::vec3>(),
+    sig<Plus, glm::vec4, glm::vec4>()
+};
+
+static const Signature minusSignatures[] = {
+    sig<Minus, float, float>(),
+    sig<Minus, glm::vec2, glm::vec2>(),
+    sig<Minus, glm::vec3, glm::vec3>(),
+    sig<Minus, glm::vec4, glm::vec4>()
+};
+
+static const Signature mulSignatures[] = {
+    sig<Mul, float, float>(),
+    sig<Mul, glm::vec2, glm::vec2>(),
+    sig<Mul, glm::vec2, float>(),
+    sig<Mul, float, glm::vec2>(),
+    sig<Mul, glm::vec3, glm::vec3>(),
+    sig<Mul, glm::vec3, float>(),
+    sig<Mul, float, glm::vec3>(),
+    sig<Mul, glm::vec4, glm::vec4>(),
+    sig<Mul, glm::vec4, float>(),
+    sig<Mul, float, glm::vec4>(),
+    sig<Mul, glm::mat3, glm::mat3>(),
+    sig<Mul, glm::mat3, float>(),
+    sig<Mul, float, glm::mat3>(),
+    sig<Mul, glm::mat3, glm::vec3>(),
+    sig<Mul, glm::vec3, glm::mat3>(),
+    simd(sig<Mul, glm::mat4, glm::mat4>(), Mat4Simd::hasAvx() ? simdKernel<Mat4Simd::mulAvx> : simdKernel<Mat4Simd::mul>),
+    sig<Mul, glm::mat4, float>(),
+    sig<Mul, float, glm::mat4>(),
+    simd(sig<Mul, glm::mat4, glm::vec4>(), simdKernel<Mat4Simd::mulVec>),
+    simd(sig<Mul, glm::vec4, glm::mat4>(), simdKernel<Mat4Simd::vecMul>)
+};
+
+static const Signature divSignatures[] = {
+    sig<Div, float, float>(),
+    sig<Div, glm::vec2, glm::vec2>(),
+    sig<Div, glm::vec3, glm::vec3>(),
+    sig<Div, glm::vec4, glm::vec4>()
+};
+
+static const Signature negateSignatures[] = {
+    sig<Negate, float>(),
+    sig<Negate, glm::vec2>(),
+    sig<Negate, glm::vec3>(),
+    sig<Negate, glm::vec4>()
+};
+
+static const Signature vec2CastSignatures[] = {
+    sig<Vec2Cast, glm::vec2>(),
+    sig<Vec2Cast, float>(),
+    sig<Vec2Cast, glm::vec3>(),
+    sig<Vec2Cast, glm::vec4>()
+};
+
+static const Signature vec3CastSignatures[] = {
+    sig<Vec3Cast, glm::vec3>(),
+    sig<Vec3Cast, float>(),
+    sig<Vec3Cast, glm::vec2>(),
+    sig<Vec3Cast, glm::vec4>()
+};
+
+static const Signature vec4CastSignatures[] = {
+    sig<Vec4Cast, glm::vec4>(),
+    sig<Vec4Cast, float>(),
+    sig<Vec4Cast, glm::vec2>(),
+    sig<Vec4Cast, glm::vec3>()
+};
+
+static const Signature mat3CastSignatures[] = {
+    sig<Mat3Cast, glm::mat3>(),
+    sig<Mat3Cast, glm::mat4>()
+};
+
+static const Signature mat4CastSignatures[] = {
+    sig<Mat4Cast, glm::mat4>(),
+    sig<Mat4Cast, glm::mat3>()
+};
+
+static const Signature lengthSignatures[] = {
+    sig<Length, glm::vec2>(),
+    sig<Length, glm::vec3>(),
+    sig<Length, glm::vec4>()
+};
+
+static const Signature distanceSignatures[] = {
+    sig<Distance, glm::vec2, glm::vec2>(),
+    sig<Distance, glm::vec3, glm::vec3>(),
+    sig<Distance, glm::vec4, glm::vec4>()
+};
+
+static const Signature dotSignatures[] = {
+    sig<Dot, glm::vec2, glm::vec2>(),
+    sig<Dot, glm::vec3, glm::vec3>(),
+    sig<Dot, glm::vec4, glm::vec4>()
+};
+
+static const Signature crossSignatures[] = {
+    sig<Cross, glm::vec3, glm::vec3>()
+};
+
+static const Signature normalizeSignatures[] = {
+    sig<Normalize, glm::vec2>(),
+    sig<Normalize, glm::vec3>(),
+    sig<Normalize, glm::vec4>()
+};
+
+static const Signature transposeSignatures[] = {
+    sig<Transpose, glm::mat3>(),
+    sig<Transpose, glm::mat4>()
+};
+
+static const Signature inverseSignatures[] = {
+    sig<Inverse, glm::mat3>(),
+    simd(sig<Inverse, glm::mat4>(), simdInverseKernel)
+};
+
+static const Signature determinantSignatures[] = {
+    sig<Determinant, glm::mat3>(),
+    simd(sig<Determinant, glm::mat4>(), simdDeterminantKernel)
+};
+
+static const Signature vec2CombineSignatures[] = {
+    sig<Vec2Combine, float, float>()
+};
+
+static const Signature vec3CombineSignatures[] = {
+    sig<Vec3Combine, float, float, float>()
+};
+
+static const Signature vec4CombineSignatures[] = {
+    sig<Vec4Combine, float, float, float, float>()
+};
+
+struct SignatureList
+{
+    const Signature *first = nullptr;
+    size_t count = 0;
 
-    if (evalOp1Node<glm::mat4, PortDataMat4>(g, n, evalStack, [](const glm::mat4 &a) { return PortDataMat4 { glm::transpose(a) }; }))
-        return;
+    template<size_t N>
+    SignatureList(const Signature (&a)[N]) : first(a), count(N) { }
+    SignatureList() = default;
+
+    const Signature *begin() const { return first; }
+    const Signature *end() const { return first + count; }
+};
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 1);
+static SignatureList signatures(NodeType type)
+{
+    switch (type) {
+    case NodeType::Vec2Cast:
+        return vec2CastSignatures;
+    case NodeType::Vec3Cast:
+        return vec3CastSignatures;
+    case NodeType::Vec4Cast:
+        return vec4CastSignatures;
+    case NodeType::Mat3Cast:
+        return mat3CastSignatures;
+    case NodeType::Mat4Cast:
+        return mat4CastSignatures;
+    case NodeType::Vec2Combine:
+        return vec2CombineSignatures;
+    case NodeType::Vec3Combine:
+        return vec3CombineSignatures;
+    case NodeType::Vec4Combine:
+        return vec4CombineSignatures;
+    case NodeType::Plus:
+        return plusSignatures;
+    case NodeType::Minus:
+        return minusSignatures;
+    case NodeType::Mul:
+        return mulSignatures;
+    case NodeType::Div:
+        return divSignatures;
+    case NodeType::Negate:
+        return negateSignatures;
+    case NodeType::Length:
+        return lengthSignatures;
+    case NodeType::Distance:
+        return distanceSignatures;
+    case NodeType::Dot:
+        return dotSignatures;
+    case NodeType::Cross:
+        return crossSignatures;
+    case NodeType::Normalize:
+        return normalizeSignatures;
+    case NodeType::Transpose:
+        return transposeSignatures;
+    case NodeType::Inverse:
+        return inverseSignatures;
+    case NodeType::Determinant:
+        return determinantSignatures;
+    default:
+        break;
+    }
+    return SignatureList();
 }
 
-void evalInverseNode(Graph &g, Node &n, EvalStackType &evalStack)
+// Reductions: the Sum, Minimum or Maximum of the elements of an array,
+// component by component. Each component keeps REDUCTION_LANES partial
+// results, element i going to partial result i % REDUCTION_LANES, which
+// vectorizes, and these are combined in a fixed order at the end. The
+// partial results are a state that carries over from one call of
+// accumulate to the next, so an array that is streamed in chunks (see
+// Stream) reduces to exactly the same value as the whole array, provided
+// the chunks are a multiple of REDUCTION_LANES long.
+static const size_t REDUCTION_LANES = 16;
+
+struct SumOp
 {
-    if (evalOp1Node<glm::mat3, PortDataMat3>(g, n, evalStack, [](const glm::mat3 &a) { return PortDataMat3 { glm::inverse(a) }; }))
-        return;
+    static constexpr float IDENTITY = 0.0f;
+    float operator()(float a, float b) const { return a + b; }
+};
 
-    if (evalOp1Node<glm::mat4, PortDataMat4>(g, n, evalStack, [](const glm::mat4 &a) { return PortDataMat4 { glm::inverse(a) }; }))
-        return;
+struct MinimumOp
+{
+    static constexpr float IDENTITY = std::numeric_limits<float>::infinity();
+    float operator()(float a, float b) const { return b < a ? b : a; }
+};
+
+struct MaximumOp
+{
+    static constexpr float IDENTITY = -std::numeric_limits<float>::infinity();
+    float operator()(float a, float b) const { return b > a ? b : a; }
+};
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 1);
+template<typename Op, typename T>
+static void reduceInit(float *state)
+{
+    std::fill_n(state, ValueArray<T>::COMPONENTS * REDUCTION_LANES, Op::IDENTITY);
 }
 
-void evalDeterminantNode(Graph &g, Node &n, EvalStackType &evalStack)
+template<typename Op, typename T>
+static void reduceAccumulate(const void *array, float *state)
 {
-    if (evalOp1Node<glm::mat3, PortDataMat3>(g, n, evalStack, [](const glm::mat3 &a) { return PortDataFloat { glm::determinant(a) }; }))
-        return;
+    const ValueArray<T> &a(*static_cast<const ValueArray<T> *>(array));
+    const size_t whole = a.count / REDUCTION_LANES * REDUCTION_LANES;
+    for (int c = 0; c < ValueArray<T>::COMPONENTS; ++c) {
+        // a local copy that the compiler keeps in registers
+        float partial[REDUCTION_LANES];
+        std::copy_n(state + c * REDUCTION_LANES, REDUCTION_LANES, partial);
+        const float *x = a.component(c);
+        for (size_t i = 0; i < whole; i += REDUCTION_LANES) {
+            for (size_t j = 0; j < REDUCTION_LANES; ++j)
+                partial[j] = Op()(partial[j], x[i + j]);
+        }
+        for (size_t j = 0; whole + j < a.count; ++j)
+            partial[j] = Op()(partial[j], x[whole + j]);
+        std::copy_n(partial, REDUCTION_LANES, state + c * REDUCTION_LANES);
+    }
+}
 
-    if (evalOp1Node<glm::mat4, PortDataMat4>(g, n, evalStack, [](const glm::mat4 &a) { return PortDataFloat { glm::determinant(a) }; }))
-        return;
+template<typename Op, typename T>
+static void reduceFinish(const float *state, void *result)
+{
+    float *r = static_cast<float *>(result);
+    for (int c = 0; c < ValueArray<T>::COMPONENTS; ++c) {
+        float partial[REDUCTION_LANES];
+        std::copy_n(state + c * REDUCTION_LANES, REDUCTION_LANES, partial);
+        for (size_t width = REDUCTION_LANES / 2; width > 0; width /= 2) {
+            for (size_t j = 0; j < width; ++j)
+                partial[j] = Op()(partial[j], partial[j + width]);
+        }
+        r[c] = partial[0];
+    }
+}
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 1);
+// the whole array in one go
+template<typename Op, typename T>
+static void reduceKernel(const Node &, const void *const *args, void *result)
+{
+    float state[ValueArray<T>::COMPONENTS * REDUCTION_LANES];
+    reduceInit<Op, T>(state);
+    reduceAccumulate<Op, T>(args[0], state);
+    reduceFinish<Op, T>(state, result);
 }
 
-void evalVec2CombineNode(Graph &g, Node &n, EvalStackType &evalStack)
+struct Reducer
 {
-    if (evalOp2Node<float, PortDataFloat, float, PortDataFloat>(g, n, evalStack, [](float a, float b) { return PortDataVec2 { glm::vec2(a, b) }; }))
-        return;
+    PortDataType type; // of the elements and the result
+    Node::Kernel kernel;
+    Stream::Reduction::Init init;
+    Stream::Reduction::Accumulate accumulate;
+    Stream::Reduction::Finish finish;
+    size_t stateSize; // floats
+};
+
+template<typename Op, typename T>
+static constexpr Reducer reducer()
+{
+    return Reducer { ValueTraits<T>::type, reduceKernel<Op, T>, reduceInit<Op, T>, reduceAccumulate<Op, T>,
+                     reduceFinish<Op, T>, ValueArray<T>::COMPONENTS * REDUCTION_LANES };
+}
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 2);
+static const Reducer sumReducers[] = {
+    reducer<SumOp, float>(),
+    reducer<SumOp, glm::vec2>(),
+    reducer<SumOp, glm::vec3>(),
+    reducer<SumOp, glm::vec4>(),
+    reducer<SumOp, glm::mat4>()
+};
+
+static const Reducer minimumReducers[] = {
+    reducer<MinimumOp, float>(),
+    reducer<MinimumOp, glm::vec2>(),
+    reducer<MinimumOp, glm::vec3>(),
+    reducer<MinimumOp, glm::vec4>()
+};
+
+static const Reducer maximumReducers[] = {
+    reducer<MaximumOp, float>(),
+    reducer<MaximumOp, glm::vec2>(),
+    reducer<MaximumOp, glm::vec3>(),
+    reducer<MaximumOp, glm::vec4>()
+};
+
+static inline bool isReduction(NodeType type)
+{
+    return type == NodeType::Sum || type == NodeType::Minimum || type == NodeType::Maximum;
 }
 
-void evalVec3CombineNode(Graph &g, Node &n, EvalStackType &evalStack)
+// null when a node of the given type cannot reduce an operand of argType
+static const Reducer *reducerFor(NodeType type, PortDataType argType)
 {
-    if (evalOp3Node<float, PortDataFloat, float, PortDataFloat, float, PortDataFloat>(g, n, evalStack,
-            [](float a, float b, float c) { return PortDataVec3 { glm::vec3(a, b, c) }; }))
-        return;
+    auto find = [argType](const auto &reducers) -> const Reducer * {
+        for (const Reducer &r : reducers) {
+            if (arrayType(r.type) == argType)
+                return &r;
+        }
+        return nullptr;
+    };
+    switch (type) {
+    case NodeType::Sum:
+        return find(sumReducers);
+    case NodeType::Minimum:
+        return find(minimumReducers);
+    case NodeType::Maximum:
+        return find(maximumReducers);
+    default:
+        return nullptr;
+    }
+}
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 1);
+static inline const Port *staticPort(const Node &n)
+{
+    auto port = std::find_if(n.ports.cbegin(), n.ports.cend(), [](const Port &port) { return port.dir == PortDirection::Static; });
+    return port != n.ports.cend() ? &*port : nullptr;
 }
 
-void evalVec4CombineNode(Graph &g, Node &n, EvalStackType &evalStack)
+template<typename T>
+static void constantKernel(const Node &n, const void *const *, void *result)
 {
-    if (evalOp4Node<float, PortDataFloat, float, PortDataFloat, float, PortDataFloat, float, PortDataFloat>(g, n, evalStack,
-            [](float a, float b, float c, float d) { return PortDataVec4 { glm::vec4(a, b, c, d) }; }))
-        return;
+    *static_cast<T *>(result) = std::get<typename ValueTraits<T>::Data>(staticPort(n)->data.d).v;
+}
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 1);
+static Node::Kernel constantKernelFor(PortDataType type)
+{
+    switch (type) {
+    case PortDataType::Float:
+        return constantKernel<float>;
+    case PortDataType::Vec2:
+        return constantKernel<glm::vec2>;
+    case PortDataType::Vec3:
+        return constantKernel<glm::vec3>;
+    case PortDataType::Vec4:
+        return constantKernel<glm::vec4>;
+    case PortDataType::Mat3:
+        return constantKernel<glm::mat3>;
+    case PortDataType::Mat4:
+        return constantKernel<glm::mat4>;
+    case PortDataType::FloatArray:
+        return constantKernel<FloatArray>;
+    case PortDataType::Vec2Array:
+        return constantKernel<Vec2Array>;
+    case PortDataType::Vec3Array:
+        return constantKernel<Vec3Array>;
+    case PortDataType::Vec4Array:
+        return constantKernel<Vec4Array>;
+    case PortDataType::Mat4Array:
+        return constantKernel<Mat4Array>;
+    default:
+        return nullptr;
+    }
 }
 
-static inline size_t componentIndexForSwizzle(char c)
+static inline uint8_t componentIndexForSwizzle(char c)
 {
     switch (c) {
         case 'r':
@@ -507,92 +1702,473 @@ static inline size_t componentIndexForSwizzle(char c)
         case 'w':
             return 3;
     }
-    return INT_MAX;
-}
-
-static inline float swizzleToFloat(const float *src, size_t srcCompCount, const char *swizzle)
-{
-    const size_t idx = componentIndexForSwizzle(swizzle[0]);
-    return idx < srcCompCount ? src[idx] : 0.0f;
-}
-
-static inline glm::vec2 swizzleToVec2(const float *src, size_t srcCompCount, const char *swizzle)
-{
-    const size_t idx0 = componentIndexForSwizzle(swizzle[0]);
-    const size_t idx1 = componentIndexForSwizzle(swizzle[1]);
-    const float a = idx0 < srcCompCount ? src[idx0] : 0.0f;
-    const float b = idx1 < srcCompCount ? src[idx1] : 0.0f;
-    return glm::vec2(a, b);
-}
-
-static inline glm::vec3 swizzleToVec3(const float *src, size_t srcCompCount, const char *swizzle)
-{
-    const size_t idx0 = componentIndexForSwizzle(swizzle[0]);
-    const size_t idx1 = componentIndexForSwizzle(swizzle[1]);
-    const size_t idx2 = componentIndexForSwizzle(swizzle[2]);
-    const float a = idx0 < srcCompCount ? src[idx0] : 0.0f;
-    const float b = idx1 < srcCompCount ? src[idx1] : 0.0f;
-    const float c = idx2 < srcCompCount ? src[idx2] : 0.0f;
-    return glm::vec3(a, b, c);
-}
-
-static inline glm::vec4 swizzleToVec4(const float *src, size_t srcCompCount, const char *swizzle)
-{
-    const size_t idx0 = componentIndexForSwizzle(swizzle[0]);
-    const size_t idx1 = componentIndexForSwizzle(swizzle[1]);
-    const size_t idx2 = componentIndexForSwizzle(swizzle[2]);
-    const size_t idx3 = componentIndexForSwizzle(swizzle[3]);
-    const float a = idx0 < srcCompCount ? src[idx0] : 0.0f;
-    const float b = idx1 < srcCompCount ? src[idx1] : 0.0f;
-    const float c = idx2 < srcCompCount ? src[idx2] : 0.0f;
-    const float d = idx3 < srcCompCount ? src[idx3] : 0.0f;
-    return glm::vec4(a, b, c, d);
-}
-
-void evalSwizzleNode(Graph &g, Node &n, EvalStackType &evalStack)
-{
-    auto swizzleSrc = std::find_if(n.ports.cbegin(), n.ports.cend(), [](const Port &port) { return port.dir == PortDirection::Static; });
-    const std::string swizzleStr = std::get<PortDataString>(swizzleSrc->data.d).v;
-    const PortData src = evalStack.back();
-
-    const size_t outCompCount = swizzleStr.size();
-    if (outCompCount >= 1 && outCompCount <= 4) {
-        const float *srcData = nullptr;
-        size_t srcCompCount = 0;
-        if (std::holds_alternative<PortDataVec2>(src.d)) {
-            srcData = glm::value_ptr(std::get<PortDataVec2>(src.d).v);
-            srcCompCount = 2;
-        } else if (std::holds_alternative<PortDataVec3>(src.d)) {
-            srcData = glm::value_ptr(std::get<PortDataVec3>(src.d).v);
-            srcCompCount = 3;
-        } else if (std::holds_alternative<PortDataVec4>(src.d)) {
-            srcData = glm::value_ptr(std::get<PortDataVec4>(src.d).v);
-            srcCompCount = 4;
-        }
-        if (srcData) {
-            PortData result;
-            switch (outCompCount) {
-                case 1:
-                    result.d = PortDataFloat { swizzleToFloat(srcData, srcCompCount, swizzleStr.c_str()) };
-                    break;
-                case 2:
-                    result.d = PortDataVec2 { swizzleToVec2(srcData, srcCompCount, swizzleStr.c_str()) };
-                    break;
-                case 3:
-                    result.d = PortDataVec3 { swizzleToVec3(srcData, srcCompCount, swizzleStr.c_str()) };
-                    break;
-                case 4:
-                    result.d = PortDataVec4 { swizzleToVec4(srcData, srcCompCount, swizzleStr.c_str()) };
-                    break;
-                default:
-                    break;
+    return UINT8_MAX;
+}
+
+// components outside the source vector (or invalid characters) read as 0
+template<typename T_SRC, int OUT_COMP_COUNT>
+static void swizzleKernel(const Node &n, const void *const *args, void *result)
+{
+    const T_SRC &src(*static_cast<const T_SRC *>(args[0]));
+    float v[4];
+    for (int i = 0; i < OUT_COMP_COUNT; ++i) {
+        const uint8_t idx = n.swizzle.comp[i];
+        v[i] = idx < T_SRC::length() ? src[idx] : 0.0f;
+    }
+    switch (OUT_COMP_COUNT) {
+    case 1:
+        *static_cast<float *>(result) = v[0];
+        break;
+    case 2:
+        *static_cast<glm::vec2 *>(result) = glm::vec2(v[0], v[1]);
+        break;
+    case 3:
+        *static_cast<glm::vec3 *>(result) = glm::vec3(v[0], v[1], v[2]);
+        break;
+    default:
+        *static_cast<glm::vec4 *>(result) = glm::vec4(v[0], v[1], v[2], v[3]);
+        break;
+    }
+}
+
+// the components of an array are runs of floats of their own, so
+// swizzling them is copying runs
+template<typename T_SRC, int OUT_COMP_COUNT>
+static void swizzleArrayKernel(const Node &n, const void *const *args, void *result)
+{
+    using Out = std::conditional_t<OUT_COMP_COUNT == 1, float, glm::vec<OUT_COMP_COUNT, float>>;
+    const ValueArray<T_SRC> &src(*static_cast<const ValueArray<T_SRC> *>(args[0]));
+    ValueArray<Out> &r(*static_cast<ValueArray<Out> *>(result));
+    r.resize(src.count);
+    for (int i = 0; i < OUT_COMP_COUNT; ++i) {
+        const uint8_t idx = n.swizzle.comp[i];
+        if (idx < T_SRC::length())
+            std::copy_n(src.component(idx), src.count, r.component(i));
+        else
+            std::fill_n(r.component(i), src.count, 0.0f);
+    }
+}
+
+template<typename T_SRC>
+static inline Node::Kernel swizzleKernelFor(int outCompCount, bool array)
+{
+    switch (outCompCount) {
+    case 1:
+        return array ? swizzleArrayKernel<T_SRC, 1> : swizzleKernel<T_SRC, 1>;
+    case 2:
+        return array ? swizzleArrayKernel<T_SRC, 2> : swizzleKernel<T_SRC, 2>;
+    case 3:
+        return array ? swizzleArrayKernel<T_SRC, 3> : swizzleKernel<T_SRC, 3>;
+    default:
+        return array ? swizzleArrayKernel<T_SRC, 4> : swizzleKernel<T_SRC, 4>;
+    }
+}
+
+static PortDataType bindSwizzleKernel(Node &n, PortDataType srcType)
+{
+    // parse the swizzle string here, not per evaluation
+    const Port *swizzleSrc = staticPort(n);
+    const std::string &swizzleStr(std::get<PortDataString>(swizzleSrc->data.d).v);
+    n.swizzle.count = uint8_t(std::min<size_t>(swizzleStr.size(), 5));
+    for (size_t i = 0; i < 4; ++i)
+        n.swizzle.comp[i] = i < swizzleStr.size() ? componentIndexForSwizzle(swizzleStr[i]) : UINT8_MAX;
+
+    if (n.swizzle.count < 1 || n.swizzle.count > 4)
+        return PortDataType::Empty;
+
+    const bool array = isArrayType(srcType);
+    switch (elementType(srcType)) {
+    case PortDataType::Vec2:
+        n.kernel = swizzleKernelFor<glm::vec2>(n.swizzle.count, array);
+        break;
+    case PortDataType::Vec3:
+        n.kernel = swizzleKernelFor<glm::vec3>(n.swizzle.count, array);
+        break;
+    case PortDataType::Vec4:
+        n.kernel = swizzleKernelFor<glm::vec4>(n.swizzle.count, array);
+        break;
+    default:
+        return PortDataType::Empty;
+    }
+
+    static const PortDataType resultTypes[] = { PortDataType::Float, PortDataType::Vec2, PortDataType::Vec3, PortDataType::Vec4 };
+    const PortDataType type = resultTypes[n.swizzle.count - 1];
+    return array ? arrayType(type) : type;
+}
+
+// The whole file: the mapping itself when it is laid out like an array,
+// a copy otherwise. A view keeps the mapping alive, so results stay
+// valid when the node opens the file again.
+template<typename T>
+static void binaryFileKernel(const Node &n, const void *const *, void *result)
+{
+    ValueArray<T> &r(*static_cast<ValueArray<T> *>(result));
+    const AttributeFile &file(*n.file);
+    if (file.viewable())
+        r = ValueArray<T>::view(const_cast<float *>(file.first), file.stride, file.count, n.file);
+    else
+        file.read(0, file.count, &r);
+}
+
+static PortDataType bindBinaryFileKernel(Node &n)
+{
+    // File, Raw records
+    const std::string *params[2] = {};
+    for (const Port &port : n.ports) {
+        if (port.dir == PortDirection::Static && port.order < 2)
+            params[port.order] = &std::get<PortDataString>(port.data.d).v;
+    }
+    n.file = params[0] && params[1] ? AttributeFile::open(*params[0], *params[1]) : nullptr;
+    switch (n.file ? n.file->type : PortDataType::Empty) {
+    case PortDataType::FloatArray:
+        n.kernel = binaryFileKernel<float>;
+        break;
+    case PortDataType::Vec2Array:
+        n.kernel = binaryFileKernel<glm::vec2>;
+        break;
+    case PortDataType::Vec3Array:
+        n.kernel = binaryFileKernel<glm::vec3>;
+        break;
+    case PortDataType::Vec4Array:
+        n.kernel = binaryFileKernel<glm::vec4>;
+        break;
+    case PortDataType::Mat4Array:
+        n.kernel = binaryFileKernel<glm::mat4>;
+        break;
+    default:
+        return PortDataType::Empty;
+    }
+    return n.file->type;
+}
+
+// bit i set when operand i is an array
+static inline uint32_t arrayOperands(const PortDataType *argTypes, size_t count)
+{
+    uint32_t arrays = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (isArrayType(argTypes[i]))
+            arrays |= 1u << i;
+    }
+    return arrays;
+}
+
+PortDataType bindKernel(Node &n, const PortDataType *argTypes)
+{
+    n.kernel = nullptr;
+    n.batchKernel = nullptr;
+
+    if (isConstantNode(n)) {
+        const PortDataType type = portDataType(staticPort(n)->data.d);
+        n.kernel = constantKernelFor(type);
+        return n.kernel ? type : PortDataType::Empty;
+    }
+
+    if (n.type == NodeType::Swizzle)
+        return bindSwizzleKernel(n, argTypes[0]);
+
+    if (n.type == NodeType::BinaryFile)
+        return bindBinaryFileKernel(n);
+
+    if (isReduction(n.type)) {
+        const Reducer *r = reducerFor(n.type, argTypes[0]);
+        n.kernel = r ? r->kernel : nullptr;
+        return r ? r->type : PortDataType::Empty;
+    }
+
+    // array operands select the kernel for their element types
+    const size_t argCount = n.descriptor().inputPortCount;
+    const uint32_t arrays = arrayOperands(argTypes, argCount);
+    auto sameElements = [](PortDataType actual, PortDataType expected) { return elementType(actual) == expected; };
+    for (const Signature &s : signatures(n.type)) {
+        if (std::equal(argTypes, argTypes + argCount, s.args, sameElements)) {
+            if (arrays) {
+                n.kernel = s.arrayKernels[arrays];
+                return n.kernel ? arrayType(s.result) : PortDataType::Empty;
             }
-            pushOpResult(evalStack, n, result, 1);
-            return;
+            n.kernel = s.kernel;
+            n.batchKernel = s.batchKernel;
+            return s.result;
         }
     }
 
-    pushOpResult(evalStack, n, PortData::invalidArgsResult(), 1);
+    return PortDataType::Empty;
+}
+
+bool acceptsOperands(const Node &n, const PortDataType *argTypes)
+{
+    auto matches = [](PortDataType actual, PortDataType expected) {
+        return actual == PortDataType::Empty || elementType(actual) == expected;
+    };
+
+    if (isConstantNode(n))
+        return true;
+
+    if (n.type == NodeType::Swizzle) {
+        return matches(argTypes[0], PortDataType::Vec2)
+            || matches(argTypes[0], PortDataType::Vec3)
+            || matches(argTypes[0], PortDataType::Vec4);
+    }
+
+    if (isReduction(n.type))
+        return argTypes[0] == PortDataType::Empty || reducerFor(n.type, argTypes[0]);
+
+    const size_t argCount = n.descriptor().inputPortCount;
+    const uint32_t arrays = arrayOperands(argTypes, argCount);
+    for (const Signature &s : signatures(n.type)) {
+        if (std::equal(argTypes, argTypes + argCount, s.args, matches) && (!arrays || s.arrayKernels[arrays]))
+            return true;
+    }
+
+    return false;
+}
+
+// f(a) with the ValueArray of type at array
+template<typename F>
+static inline void withArray(PortDataType type, void *array, F f)
+{
+    switch (type) {
+    case PortDataType::FloatArray:
+        f(*static_cast<FloatArray *>(array));
+        break;
+    case PortDataType::Vec2Array:
+        f(*static_cast<Vec2Array *>(array));
+        break;
+    case PortDataType::Vec3Array:
+        f(*static_cast<Vec3Array *>(array));
+        break;
+    case PortDataType::Vec4Array:
+        f(*static_cast<Vec4Array *>(array));
+        break;
+    case PortDataType::Mat4Array:
+        f(*static_cast<Mat4Array *>(array));
+        break;
+    default:
+        break;
+    }
+}
+
+bool compileStream(const Plan &plan, const std::vector<Id> &outputs, size_t chunkSize, Stream &stream)
+{
+    stream = Stream();
+    stream.chunkSize = std::max<size_t>(FloatArray::PADDING, chunkSize / FloatArray::PADDING * FloatArray::PADDING);
+    const Graph &g(*plan.graph);
+
+    // what a value of the plan is to the stream
+    struct Streamed
+    {
+        enum Kind { Fixed, Source, File, Chunk } kind;
+        size_t pass; // Fixed: the first pass it is known in, Chunk: the pass computing it
+        size_t chunk; // the view of a Source or File, the chunk of a Chunk
+    };
+    std::unordered_map<const void *, Streamed> streamed;
+    std::unordered_map<const Node *, const Plan::Instruction *> instructions;
+    instructions.reserve(plan.foldedInstructions.size() + plan.instructions.size());
+
+    // Plan order is topological, folded instructions first, so operands
+    // are known by the time they are used.
+    auto add = [&plan, &stream, &streamed](const Plan::Instruction &instr) {
+        if (!instr.result || (instr.chain < 0 && instr.operandCount != instr.node->descriptor().inputPortCount))
+            return false;
+        const PortDataType type = outPort(*instr.node)->type;
+        bool arrays = false;
+        size_t pass = 0;
+        for (size_t i = 0; i < instr.operandCount; ++i) {
+            auto s = streamed.find(plan.operands[instr.firstOperand + i]);
+            if (s != streamed.end()) {
+                arrays |= s->second.kind != Streamed::Fixed;
+                pass = std::max(pass, s->second.pass);
+            }
+        }
+
+        if (!arrays) {
+            if (isArrayType(type)) {
+                // read in chunks, so it must be known before the first one
+                if (pass)
+                    return false;
+                const size_t view = stream.chunks.add(type);
+                const Node &node(*instr.node);
+                const bool file = node.type == NodeType::BinaryFile;
+                const bool read = file && !node.file->viewable();
+                stream.sources.push_back({ instr.result, view, file ? node.file : nullptr, read });
+                streamed[instr.result] = { read ? Streamed::File : Streamed::Source, 0, view };
+                if (read)
+                    return true;
+            } else {
+                streamed[instr.result] = { Streamed::Fixed, pass, 0 };
+            }
+            if (pass)
+                stream.afterPass[pass - 1].push_back(&instr);
+            else
+                stream.setup.push_back(&instr);
+            return true;
+        }
+        if (instr.chain >= 0)
+            return false;
+
+        Stream::Instruction si { &instr, stream.operands.size(), 0, pass, pass, false };
+        for (size_t i = 0; i < instr.operandCount; ++i) {
+            const void *operand = plan.operands[instr.firstOperand + i];
+            auto s = streamed.find(operand);
+            if (s != streamed.end() && s->second.kind != Streamed::Fixed)
+                stream.operands.push_back({ nullptr, s->second.chunk });
+            else
+                stream.operands.push_back({ operand, 0 });
+        }
+        if (isArrayType(type)) {
+            si.result = stream.chunks.add(type);
+            streamed[instr.result] = { Streamed::Chunk, pass, si.result };
+        } else {
+            // the single operand of a reduction is the streamed array
+            const PortDataType operandType = stream.chunks.values[stream.operands[si.firstOperand].chunk].type;
+            const Reducer *r = reducerFor(instr.node->type, operandType);
+            if (!r)
+                return false;
+            si.result = stream.reductions.size();
+            si.reduction = true;
+            stream.reductions.push_back({ r->init, r->accumulate, r->finish, stream.reductionState.size(), instr.result, instr.error });
+            stream.reductionState.resize(stream.reductionState.size() + r->stateSize);
+            // known once all chunks went through
+            streamed[instr.result] = { Streamed::Fixed, pass + 1, 0 };
+        }
+        stream.passCount = std::max(stream.passCount, pass + 1);
+        stream.afterPass.resize(stream.passCount);
+        stream.maxOperandCount = std::max(stream.maxOperandCount, instr.operandCount);
+        stream.instructions.push_back(si);
+        return true;
+    };
+    for (const std::vector<Plan::Instruction> *list : { &plan.foldedInstructions, &plan.instructions }) {
+        for (const Plan::Instruction &instr : *list) {
+            instructions[instr.node] = &instr;
+            if (!add(instr)) {
+                stream.failedNode = instr.node->id;
+                return false;
+            }
+        }
+    }
+
+    for (Id id : outputs) {
+        const Node *node = g.nodes.find(id);
+        auto instr = node ? instructions.find(node) : instructions.end();
+        if (instr == instructions.end()) {
+            stream.failedNode = id;
+            return false;
+        }
+        Streamed &s(streamed.at(instr->second->result));
+        if (s.kind == Streamed::File) {
+            // read whole after all
+            stream.setup.push_back(instr->second);
+            s.kind = Streamed::Source;
+        }
+        if (s.kind == Streamed::Chunk)
+            stream.outputs.push_back({ { nullptr, s.chunk }, s.pass });
+        else
+            stream.outputs.push_back({ { instr->second->result, 0 }, 0 });
+    }
+
+    // An array is computed again in each pass that reads it, which may be
+    // later than the one it is first computed in.
+    std::vector<size_t> producers(stream.chunks.values.size(), SIZE_MAX);
+    for (size_t i = 0; i < stream.instructions.size(); ++i) {
+        if (!stream.instructions[i].reduction)
+            producers[stream.instructions[i].result] = i;
+    }
+    for (size_t i = stream.instructions.size(); i-- > 0;) {
+        const Stream::Instruction &si(stream.instructions[i]);
+        for (size_t j = 0; j < si.instr->operandCount; ++j) {
+            const Stream::Value &operand(stream.operands[si.firstOperand + j]);
+            if (!operand.fixed && producers[operand.chunk] != SIZE_MAX) {
+                Stream::Instruction &producer(stream.instructions[producers[operand.chunk]]);
+                producer.lastPass = std::max(producer.lastPass, si.lastPass);
+            }
+        }
+    }
+
+    // room for whole chunks, so that kernels never allocate
+    for (size_t i = 0; i < stream.chunks.values.size(); ++i)
+        withArray(stream.chunks.values[i].type, stream.chunks.pointer(uint32_t(i)), [&stream](auto &a) { a.resize(stream.chunkSize); });
+
+    return true;
+}
+
+void runStream(const Plan &plan, Stream &stream, ChunkFunction function, void *context)
+{
+    for (const Plan::Instruction *instr : stream.setup)
+        evaluate(plan, *instr);
+
+    std::vector<void *> chunks(stream.chunks.values.size());
+    for (size_t i = 0; i < chunks.size(); ++i)
+        chunks[i] = stream.chunks.pointer(uint32_t(i));
+    std::vector<const void *> args(stream.maxOperandCount);
+
+    size_t length = 0;
+    for (const Stream::Source &src : stream.sources) {
+        if (src.read) {
+            length = std::max(length, src.file->count);
+            continue;
+        }
+        withArray(stream.chunks.values[src.view].type, const_cast<void *>(src.array),
+                  [&length](const auto &a) { length = std::max(length, a.count); });
+    }
+
+    for (size_t pass = 0; pass < stream.passCount; ++pass) {
+        for (const Stream::Instruction &si : stream.instructions) {
+            if (si.firstPass == pass && si.reduction)
+                stream.reductions[si.result].init(stream.reductionState.data() + stream.reductions[si.result].state);
+        }
+
+        for (size_t first = 0; first < length; first += stream.chunkSize) {
+            // the sources from first on, shorter ones running out
+            for (const Stream::Source &src : stream.sources) {
+                if (src.read) {
+                    src.file->read(first, stream.chunkSize, chunks[src.view]);
+                    continue;
+                }
+                withArray(stream.chunks.values[src.view].type, chunks[src.view], [&stream, &src, first](auto &view) {
+                    using A = std::decay_t<decltype(view)>;
+                    const A &a(*static_cast<const A *>(src.array));
+                    const size_t start = std::min(first, a.count);
+                    view = A::view(const_cast<float *>(a.component(0)) + start, a.stride,
+                                   std::min(stream.chunkSize, a.count - start));
+                });
+            }
+
+            for (const Stream::Instruction &si : stream.instructions) {
+                if (pass < si.firstPass || pass > si.lastPass)
+                    continue;
+                const Plan::Instruction &instr(*si.instr);
+                const Stream::Value *operands = stream.operands.data() + si.firstOperand;
+                for (size_t i = 0; i < instr.operandCount; ++i)
+                    args[i] = operands[i].fixed ? operands[i].fixed : chunks[operands[i].chunk];
+                if (si.reduction) {
+                    Stream::Reduction &r(stream.reductions[si.result]);
+                    r.accumulate(args[0], stream.reductionState.data() + r.state);
+                } else {
+                    instr.node->kernel(*instr.node, args.data(), chunks[si.result]);
+                }
+            }
+
+            for (size_t i = 0; function && i < stream.outputs.size(); ++i) {
+                const Stream::Output &output(stream.outputs[i]);
+                if (!output.value.fixed && output.pass == pass)
+                    function(context, i, chunks[output.value.chunk], first);
+            }
+
+            for (const Stream::Source &src : stream.sources) {
+                if (src.file)
+                    src.file->release(first, stream.chunkSize);
+            }
+        }
+
+        for (const Stream::Instruction &si : stream.instructions) {
+            if (si.firstPass == pass && si.reduction) {
+                const Stream::Reduction &r(stream.reductions[si.result]);
+                r.finish(stream.reductionState.data() + r.state, r.result);
+                *r.error = PortDataError::None;
+            }
+        }
+        for (const Plan::Instruction *instr : stream.afterPass[pass])
+            evaluate(plan, *instr);
+    }
 }
 
 } // namespace
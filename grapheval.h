@@ -2,45 +2,335 @@
 #define GRAPHEVAL_H
 
 #include <vector>
-#include "portdata.h"
+#include <unordered_map>
+#include <memory>
+#include <cstdint>
+#include "valuestore.h"
 
 struct Graph;
 struct Node;
+struct AttributeFile;
+using Id = int;
 
 namespace GraphEval {
 
-void update(Graph &g);
+// Flat, topologically ordered list of node evaluations. The results live
+// in values, one per output port in the order the instructions run. Each
+// instruction refers to a range in operands, which point directly at the
+// values of the source nodes in input port order (operandNodes holds the
+// source nodes themselves). Instructions are grouped into levels: level i
+// is [levels[i], levels[i + 1]) and only depends on earlier levels.
+// Constant folded nodes are kept apart in foldedInstructions (topologically
+// ordered), which run before the levels. Only valid as long as the
+// topologyVersion of the graph does not change.
+struct Plan
+{
+    // A chain of Mul, Transpose, Inverse and Negate nodes evaluated by the
+    // instruction of its last node, only when compiling for sinks. The
+    // operands of the instruction are the factors, then the Float scale
+    // factors. Factor i is loaded into register i, the product of all ends
+    // up in register 0.
+    struct Chain
+    {
+        enum Kind : uint8_t { Matrix, ColumnVector, RowVector };
+        enum Op : uint8_t { MatrixMatrix, MatrixVector, VectorMatrix };
+        struct Factor
+        {
+            Kind kind;
+            bool transpose; // applied after inverse
+            bool inverse;
+        };
+        struct Step
+        {
+            uint8_t a; // a = a * b
+            uint8_t b;
+            Op op;
+        };
 
-using EvalStackType = std::vector<PortData>;
+        uint8_t dim; // 3 or 4
+        bool negate;
+        Kind resultKind;
+        uint32_t firstFactor;
+        uint32_t factorCount;
+        uint32_t firstStep;
+        uint32_t stepCount;
+        uint32_t scalarCount;
+    };
 
-void evalConstantNode(Graph &g, Node &n, EvalStackType &evalStack);
+    struct Instruction
+    {
+        Node *node;
+        void *result; // in values, null when the output type is Empty
+        PortDataError *error; // in values, null when node has no output port
+        size_t firstOperand;
+        size_t operandCount;
+        int32_t chain = -1; // index into chains, or -1 to call the node's kernel
+    };
 
-void evalPlusNode(Graph &g, Node &n, EvalStackType &evalStack);
-void evalMinusNode(Graph &g, Node &n, EvalStackType &evalStack);
-void evalMulNode(Graph &g, Node &n, EvalStackType &evalStack);
-void evalDivNode(Graph &g, Node &n, EvalStackType &evalStack);
-void evalNegateNode(Graph &g, Node &n, EvalStackType &evalStack);
+    const Graph *graph = nullptr;
+    uint64_t topologyVersion = 0;
+    std::vector<Instruction> instructions;
+    std::vector<Instruction> foldedInstructions;
+    std::vector<const void *> operands;
+    std::vector<const Node *> operandNodes;
+    std::vector<size_t> levels;
+    std::vector<Chain> chains;
+    std::vector<Chain::Factor> chainFactors;
+    std::vector<Chain::Step> chainSteps;
+    size_t deadNodeCount = 0; // left out, not feeding any sink
+    size_t fusedNodeCount = 0; // left out, evaluated as part of a chain
+    ValueStore values;
+    std::unordered_map<Id, uint32_t> outputValues; // output port id -> index in values
 
-void evalVec2CastNode(Graph &g, Node &n, EvalStackType &evalStack);
-void evalVec3CastNode(Graph &g, Node &n, EvalStackType &evalStack);
-void evalVec4CastNode(Graph &g, Node &n, EvalStackType &evalStack);
-void evalMat3CastNode(Graph &g, Node &n, EvalStackType &evalStack);
-void evalMat4CastNode(Graph &g, Node &n, EvalStackType &evalStack);
+    // native mode, see attachNative()
+    using NativeFunction = void (*)(void *const *values);
+    NativeFunction native = nullptr;
+    std::shared_ptr<void> nativeLibrary; // keeps native loaded
+    std::vector<void *> nativeValues; // argument of native
+    std::vector<Instruction> nativeInputs; // the constants read by native
+    std::vector<Node *> nativeNodes; // computed by native
+    std::vector<Instruction> nativeRest; // interpreted after native, in plan order
 
-void evalLengthNode(Graph &g, Node &n, EvalStackType &evalStack);
-void evalDistanceNode(Graph &g, Node &n, EvalStackType &evalStack);
-void evalDotNode(Graph &g, Node &n, EvalStackType &evalStack);
-void evalCrossNode(Graph &g, Node &n, EvalStackType &evalStack);
-void evalNormalizeNode(Graph &g, Node &n, EvalStackType &evalStack);
+    Plan() = default;
+    // instructions and operands point into values
+    Plan(const Plan &) = delete;
+    Plan &operator=(const Plan &) = delete;
+    Plan(Plan &&) = default;
+    Plan &operator=(Plan &&) = default;
 
-void evalTransposeNode(Graph &g, Node &n, EvalStackType &evalStack);
-void evalInverseNode(Graph &g, Node &n, EvalStackType &evalStack);
-void evalDeterminantNode(Graph &g, Node &n, EvalStackType &evalStack);
+    bool isValidFor(const Graph &g) const;
+};
 
-void evalVec2CombineNode(Graph &g, Node &n, EvalStackType &evalStack);
-void evalVec3CombineNode(Graph &g, Node &n, EvalStackType &evalStack);
-void evalVec4CombineNode(Graph &g, Node &n, EvalStackType &evalStack);
-void evalSwizzleNode(Graph &g, Node &n, EvalStackType &evalStack);
+// levels with fewer instructions than this are evaluated on the calling
+// thread, wider ones are spread over ThreadPool::instance()
+static const size_t PARALLEL_MIN_LEVEL_SIZE = 1024;
+static const size_t PARALLEL_GRAIN_SIZE = 128;
+
+struct Stats
+{
+    size_t nodeCount = 0;
+    size_t evaluationCount = 0;
+    size_t foldedNodeCount = 0; // only evaluated when an upstream constant changes
+    size_t deadNodeCount = 0;
+    size_t fusedNodeCount = 0;
+    bool native = false; // computed by the plan's native function
+    // heap allocations on the calling thread during update(), including plan
+    // compilation; 0 in steady state, always 0 without NODESTUFF_COUNT_ALLOCATIONS
+    size_t allocationCount = 0;
+};
+
+enum class UpdateMode {
+    Full,       // evaluate every node that is not constant folded
+    Incremental // evaluate only dirty nodes and everything downstream of them
+};
+
+enum class ChainMode {
+    Exact, // every node computed as in the graph
+    Fused  // matrix chains multiplied in the cheapest order, see compile()
+};
+
+// Only nodes feeding one of sinks are compiled in, all nodes when sinks is
+// empty. Constant nodes that are not Node::live, and nodes reading only
+// from such constants, are constant folded; their results are the same
+// either way. With sinks and ChainMode::Fused, intermediate results of
+// matrix chains that only feed the next node of the chain are fused away,
+// so their output ports get no value, and the results at the end of the
+// chains are only the same up to float rounding.
+void compile(Graph &g, Plan &plan, const std::vector<Id> &sinks = {}, ChainMode chains = ChainMode::Exact);
+void run(Graph &g, const Plan &plan, UpdateMode mode, Stats *stats = nullptr);
+
+// recompiles the cached plan if the topology changed, then runs it; in
+// Incremental mode this returns immediately when nothing is dirty
+void update(Graph &g, UpdateMode mode = UpdateMode::Incremental);
+
+// counters from the last update()
+const Stats &stats();
+
+// the plan used by update(), holding the results of the last one
+const Plan &updatePlan();
+
+// Switches the plan used by update() from interpreting instructions to
+// calling function, a compiled CppGen::generateModule() of g, with the
+// values of nodes. The constants among them are still copied from their
+// Static ports first. Nodes the module leaves out, like array constants,
+// binary files and whatever reads from them, are interpreted after it as
+// before. library is held on to while the plan uses function. Fails when
+// the plan is not compiled for g or misses some of the nodes. The next
+// compile, on any topology change, goes back to interpretation.
+bool attachNative(Graph &g, Plan::NativeFunction function, std::shared_ptr<void> library, const std::vector<Id> &nodes);
+void detachNative();
+
+// Evaluation of a plan for many samples of some of its constants at once,
+// laneCount samples per batch (see Sweep). Every value downstream of the
+// varied constants gets one lane per sample, laneCount of them stored
+// contiguously in lane memory, and its instruction runs for all lanes in
+// one call to the node's batch kernel, or lane by lane when there is none.
+// Everything else is the same for all samples and is read from the
+// values of the plan, which therefore has to be run once beforehand. Any
+// number of threads can run batches concurrently, each with lane memory
+// of its own.
+struct Batch
+{
+    struct Instruction
+    {
+        const Plan::Instruction *instr;
+        size_t firstOperand; // in operands
+        uint32_t varyingOperands; // bit i set: operand i is in lane memory
+        size_t result; // offset of the lanes in lane memory
+        size_t resultSize; // bytes per lane
+    };
+
+    // the lanes of a value, or the one value shared by all lanes
+    struct Value
+    {
+        PortDataType type = PortDataType::Empty;
+        const void *fixed = nullptr; // in the plan's values when not per lane
+        size_t offset = 0; // of the lanes in lane memory
+    };
+
+    // a varied constant, for the caller to fill in its lanes
+    struct Input
+    {
+        PortDataType type = PortDataType::Empty;
+        size_t offset = 0; // of the lanes in lane memory
+        const void *current = nullptr; // value in the plan, null when the plan does not use the node
+    };
+
+    size_t laneCount = 0;
+    size_t laneMemorySize = 0; // bytes, lane memory is 64 byte aligned
+    size_t maxOperandCount = 0;
+    std::vector<Instruction> instructions;
+    std::vector<Value> operands;
+    std::vector<Input> inputs; // parallel to the varied nodes
+    std::vector<Value> outputs; // parallel to the output nodes
+    Id failedNode = 0;
+};
+
+// Prepares batches for plan, which must be valid, compiled with the
+// outputs as sinks, and run. varied are constant nodes. Fails, setting
+// failedNode, when a varied node is not a constant, an output is not in
+// the plan, or a node the outputs depend on cannot be evaluated. Arrays
+// are not batched: fails as well for a varied node, a node depending on
+// one or an output of an array type.
+bool compileBatch(const Plan &plan, const std::vector<Id> &varied, const std::vector<Id> &outputs, size_t laneCount,
+                  Batch &batch);
+
+// Evaluates the first count lanes, after the caller wrote the lanes of
+// the inputs. laneMemory holds laneMemorySize bytes.
+void runBatch(const Plan &plan, const Batch &batch, void *laneMemory, size_t count);
+
+// Evaluation of a plan over arrays of any length in chunks of chunkSize
+// elements. The arrays the others are computed from, like array
+// constants, are evaluated by the plan and read through views of a chunk
+// of them. Binary files that cannot be viewed in place are read a chunk
+// at a time instead, and the pages of binary files are released once
+// their chunks are through. Arrays computed from other arrays only ever
+// exist one chunk at a time, so memory use is bounded by the chunk size,
+// whatever the length of the arrays. Sum, Minimum and Maximum accumulate
+// over the chunks and what depends on them is evaluated once all chunks
+// have gone through. Arrays depending on such a result take another pass
+// over the chunks. Chunks of array outputs go to a callback as they are
+// computed, other outputs end up in the values of the plan.
+struct Stream
+{
+    // an operand, in the plan's values or a chunk
+    struct Value
+    {
+        const void *fixed = nullptr; // in the plan's values
+        size_t chunk = 0; // in chunks, when not fixed
+    };
+
+    struct Instruction
+    {
+        const Plan::Instruction *instr;
+        size_t firstOperand; // in operands
+        size_t result; // in chunks, or in reductions for a reduction
+        size_t firstPass;
+        size_t lastPass; // later passes may read the result again
+        bool reduction;
+    };
+
+    // a Sum, Minimum or Maximum node, accumulating into reductionState
+    struct Reduction
+    {
+        using Init = void (*)(float *state);
+        using Accumulate = void (*)(const void *array, float *state);
+        using Finish = void (*)(const float *state, void *result);
+
+        Init init;
+        Accumulate accumulate;
+        Finish finish;
+        size_t state; // offset in reductionState
+        void *result; // in the plan's values
+        PortDataError *error;
+    };
+
+    // a whole array of the plan, read through a view in chunks
+    struct Source
+    {
+        const void *array;
+        size_t view; // in chunks
+        // a binary file: records that cannot be viewed are read chunk by
+        // chunk instead of evaluated whole
+        std::shared_ptr<const AttributeFile> file;
+        bool read;
+    };
+
+    struct Output
+    {
+        Value value;
+        size_t pass; // in which the chunks of an array output are computed
+    };
+
+    size_t chunkSize = 0;
+    size_t passCount = 0;
+    size_t maxOperandCount = 0;
+    std::vector<const Plan::Instruction *> setup; // run before the first pass
+    std::vector<std::vector<const Plan::Instruction *>> afterPass; // run after the chunks of a pass
+    std::vector<Instruction> instructions; // run for each chunk of their pass
+    std::vector<Value> operands;
+    std::vector<Source> sources;
+    std::vector<Reduction> reductions;
+    std::vector<Output> outputs; // parallel to the output nodes
+    ValueStore chunks;
+    std::vector<float> reductionState;
+    Id failedNode = 0;
+};
+
+// Prepares streaming plan, which must be valid and compiled with the
+// outputs as sinks, in chunks of chunkSize elements, rounded to a
+// multiple of ValueArray::PADDING. Fails, setting failedNode, when an
+// output is not in the plan or a node cannot be evaluated.
+bool compileStream(const Plan &plan, const std::vector<Id> &outputs, size_t chunkSize, Stream &stream);
+
+// Receives chunk of output, a ValueArray of the output's type holding the
+// elements from first on of the whole array.
+using ChunkFunction = void (*)(void *context, size_t output, const void *chunk, size_t first);
+
+// Evaluates the plan, the chunks of streamed arrays going to function.
+// The streams are as long as the longest source array. Not to be called
+// while something else runs the plan.
+void runStream(const Plan &plan, Stream &stream, ChunkFunction function = nullptr, void *context = nullptr);
+
+// bytes per value, 0 for types without a fixed size
+size_t valueSize(PortDataType type);
+
+// The result of an output port as of the last run of the plan, converted
+// for display. Empty when the plan does not evaluate the port.
+PortData result(const Plan &plan, Id portId);
+
+// Binds n.kernel to the kernel for the given operand types (one per
+// input port) and returns the result type, or leaves it null and returns
+// PortDataType::Empty when the node cannot take such operands. Parses
+// per-node parameters, like the swizzle string, as well. An operation on
+// values takes arrays of them too, giving an array: mixed with single
+// values, these are used for every element, and arrays of different
+// lengths give a result as long as the shortest one.
+PortDataType bindKernel(Node &n, const PortDataType *argTypes);
+
+// true if some kernel of the node's type would accept argTypes, where
+// PortDataType::Empty (unconnected or unknown) matches anything
+bool acceptsOperands(const Node &n, const PortDataType *argTypes);
 
 } // namespace
 
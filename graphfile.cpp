@@ -0,0 +1,349 @@
+#include "graphfile.h"
+#include "graph.h"
+#include "nodeconstructors.h"
+#include <sstream>
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+#include <cstdlib>
+
+namespace GraphFile {
+
+static const char *const MAGIC = "nodestuff-graph";
+static const int VERSION = 1;
+
+static const char *valueTypeNames[] = { nullptr, "float", "vec2", "vec3", "vec4", "mat3", "mat4", "string",
+                                        "floatarray", "vec2array", "vec3array", "vec4array", "mat4array" };
+
+// number of floats in a value, or in an element of an array
+static inline int floatCount(PortDataType type)
+{
+    static const int counts[] = { 0, 1, 2, 3, 4, 9, 16, 0, 1, 2, 3, 4, 16 };
+    return counts[size_t(type)];
+}
+
+template<typename T> struct IsArrayData : std::false_type { };
+template<> struct IsArrayData<PortDataFloatArray> : std::true_type { };
+template<> struct IsArrayData<PortDataVec2Array> : std::true_type { };
+template<> struct IsArrayData<PortDataVec3Array> : std::true_type { };
+template<> struct IsArrayData<PortDataVec4Array> : std::true_type { };
+template<> struct IsArrayData<PortDataMat4Array> : std::true_type { };
+
+// null for strings and arrays
+static const float *floats(const PortDataVar &d)
+{
+    return std::visit([](auto &&arg) -> const float * {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, PortDataFloat>)
+            return &arg.v;
+        else if constexpr (std::is_same_v<T, PortDataEmpty> || std::is_same_v<T, PortDataString> || IsArrayData<T>::value)
+            return nullptr;
+        else
+            return glm::value_ptr(arg.v);
+    }, d);
+}
+
+// arrays are written as their element count, then the elements one after the other
+static void writeArray(std::string &s, const PortDataVar &d)
+{
+    std::visit([&s](auto &&arg) {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (IsArrayData<T>::value) {
+            char buf[32];
+            s += ' ' + std::to_string(arg.v.count);
+            for (size_t i = 0; i < arg.v.count; ++i) {
+                for (int c = 0; c < arg.v.COMPONENTS; ++c) {
+                    snprintf(buf, sizeof(buf), " %.9g", arg.v.component(c)[i]);
+                    s += buf;
+                }
+            }
+        }
+    }, d);
+}
+
+static bool readArray(std::istream &in, PortDataVar &d)
+{
+    return std::visit([&in](auto &&arg) {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (IsArrayData<T>::value) {
+            size_t count = 0;
+            if (!(in >> count))
+                return false;
+            arg.v.resize(count);
+            std::string f;
+            for (size_t i = 0; i < count; ++i) {
+                for (int c = 0; c < arg.v.COMPONENTS; ++c) {
+                    if (!(in >> f))
+                        return false;
+                    arg.v.component(c)[i] = strtof(f.c_str(), nullptr);
+                }
+            }
+            return true;
+        }
+        return false;
+    }, d);
+}
+
+static float *floats(PortDataVar &d)
+{
+    return const_cast<float *>(floats(static_cast<const PortDataVar &>(d)));
+}
+
+static PortDataVar defaultValue(PortDataType type)
+{
+    switch (type) {
+    case PortDataType::Float:
+        return PortDataFloat { 0.0f };
+    case PortDataType::Vec2:
+        return PortDataVec2 { glm::vec2() };
+    case PortDataType::Vec3:
+        return PortDataVec3 { glm::vec3() };
+    case PortDataType::Vec4:
+        return PortDataVec4 { glm::vec4() };
+    case PortDataType::Mat3:
+        return PortDataMat3 { glm::mat3(), false };
+    case PortDataType::Mat4:
+        return PortDataMat4 { glm::mat4(), false };
+    case PortDataType::String:
+        return PortDataString { std::string() };
+    case PortDataType::FloatArray:
+        return PortDataFloatArray { };
+    case PortDataType::Vec2Array:
+        return PortDataVec2Array { };
+    case PortDataType::Vec3Array:
+        return PortDataVec3Array { };
+    case PortDataType::Vec4Array:
+        return PortDataVec4Array { };
+    case PortDataType::Mat4Array:
+        return PortDataMat4Array { };
+    default:
+        return PortDataEmpty { };
+    }
+}
+
+static const Port *portForOrder(const Node &n, int order)
+{
+    for (const Port &port : n.ports) {
+        if (port.order == order)
+            return &port;
+    }
+    return nullptr;
+}
+
+std::string write(const Graph &g)
+{
+    std::string s;
+    char buf[64];
+    s += MAGIC;
+    s += ' ' + std::to_string(VERSION) + '\n';
+
+    // topological order, so that reading it back gives the same order
+    for (Id id : g.topoOrder) {
+        if (!id)
+            continue;
+        const Node &n(g.node(id));
+        s += "node " + std::to_string(id) + ' ' + n.descriptor().name + '\n';
+        for (const Port &port : n.ports) {
+            if (port.dir != PortDirection::Static)
+                continue;
+            const PortDataType type = portDataType(port.data.d);
+            if (type == PortDataType::Empty)
+                continue;
+            s += "value " + std::to_string(id) + ' ' + valueTypeNames[size_t(type)];
+            if (type == PortDataType::String) {
+                s += ' ' + std::get<PortDataString>(port.data.d).v;
+            } else if (isArrayType(type)) {
+                writeArray(s, port.data.d);
+            } else {
+                const float *v = floats(port.data.d);
+                for (int i = 0; i < floatCount(type); ++i) {
+                    // %.9g is enough to round trip any float
+                    snprintf(buf, sizeof(buf), " %.9g", v[i]);
+                    s += buf;
+                }
+            }
+            s += '\n';
+        }
+        if (n.live)
+            s += "live " + std::to_string(id) + '\n';
+    }
+
+    for (const Connection &c : g.connections) {
+        const Id consumerId = g.consumerNodeId(c);
+        if (!consumerId)
+            continue;
+        const int in = c.ep[0].nodeId == consumerId ? 0 : 1;
+        s += "link " + std::to_string(c.ep[1 - in].nodeId) + ' ' + std::to_string(g.port(c.ep[1 - in].portId).order)
+            + ' ' + std::to_string(consumerId) + ' ' + std::to_string(g.port(c.ep[in].portId).order) + '\n';
+    }
+
+    return s;
+}
+
+static Id (*constructorForName(const std::string &name))(Graph *)
+{
+    for (NodeConstructorSet *s = nodeConstructorSets; s->category && s->constructors; ++s) {
+        for (NodeConstructor *c = s->constructors; c->text && c->func; ++c) {
+            if (name == c->text)
+                return c->func;
+        }
+    }
+    return nullptr;
+}
+
+bool read(Graph &g, const std::string &text, std::unordered_map<Id, Id> *ids, std::string *error)
+{
+    std::unordered_map<Id, Id> idMap;
+    std::unordered_map<Id, size_t> valueCounts; // value lines read per node
+    std::vector<Id> added;
+    std::istringstream in(text);
+    std::string line;
+    int lineNumber = 0;
+    bool header = false;
+    std::string failure;
+
+    g.beginEdit();
+    while (failure.empty() && std::getline(in, line)) {
+        ++lineNumber;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        std::istringstream ls(line);
+        std::string keyword;
+        if (!(ls >> keyword))
+            continue;
+
+        if (!header) {
+            int version = 0;
+            if (keyword != MAGIC || !(ls >> version) || version != VERSION)
+                failure = "not a graph file, or an unsupported version";
+            header = true;
+            continue;
+        }
+
+        Id fileId = 0;
+        if (!(ls >> fileId)) {
+            failure = "missing node id";
+            continue;
+        }
+        auto node = idMap.find(fileId);
+        if (keyword != "node" && node == idMap.end()) {
+            failure = "unknown node " + std::to_string(fileId);
+            continue;
+        }
+
+        if (keyword == "node") {
+            std::string name;
+            std::getline(ls >> std::ws, name);
+            auto constructor = constructorForName(name);
+            if (!constructor) {
+                failure = "unknown node type '" + name + "'";
+            } else if (idMap.count(fileId)) {
+                failure = "duplicate node " + std::to_string(fileId);
+            } else {
+                const Id id = constructor(&g);
+                idMap[fileId] = id;
+                added.push_back(id);
+            }
+        } else if (keyword == "value") {
+            std::string typeName;
+            ls >> typeName;
+            size_t type = 1;
+            while (type < std::size(valueTypeNames) && typeName != valueTypeNames[type])
+                ++type;
+            // one line per Static port, in port order
+            Node &n(g.node(node->second));
+            Port *port = nullptr;
+            size_t index = valueCounts[fileId]++;
+            for (Port &p : n.ports) {
+                if (p.dir != PortDirection::Static)
+                    continue;
+                if (!index) {
+                    port = &p;
+                    break;
+                }
+                --index;
+            }
+            if (type == std::size(valueTypeNames)) {
+                failure = "unknown value type '" + typeName + "'";
+            } else if (!port) {
+                failure = "node " + std::to_string(fileId) + " has no value";
+            } else {
+                PortDataVar d = defaultValue(PortDataType(type));
+                if (PortDataType(type) == PortDataType::String) {
+                    std::getline(ls >> std::ws, std::get<PortDataString>(d).v);
+                } else if (isArrayType(PortDataType(type))) {
+                    if (!readArray(ls, d))
+                        failure = "not enough elements";
+                } else {
+                    float *v = floats(d);
+                    for (int i = 0; i < floatCount(PortDataType(type)); ++i) {
+                        std::string f;
+                        if (!(ls >> f)) {
+                            failure = "not enough components";
+                            break;
+                        }
+                        v[i] = strtof(f.c_str(), nullptr);
+                    }
+                }
+                port->data.d = std::move(d);
+                g.staticPortChanged(n);
+            }
+        } else if (keyword == "live") {
+            g.setLive(g.node(node->second), true);
+        } else if (keyword == "link") {
+            int outOrder = -1, inOrder = -1;
+            Id consumerFileId = 0;
+            ls >> outOrder >> consumerFileId >> inOrder;
+            auto consumer = idMap.find(consumerFileId);
+            const Port *out = portForOrder(g.node(node->second), outOrder);
+            const Port *input = consumer != idMap.end() ? portForOrder(g.node(consumer->second), inOrder) : nullptr;
+            if (!out || out->dir != PortDirection::Output || !input || input->dir != PortDirection::Input
+                    || !g.addConnection(node->second, out->id, consumer->second, input->id)) {
+                failure = "invalid link";
+            }
+        } else {
+            failure = "unknown keyword '" + keyword + "'";
+        }
+    }
+    if (!header)
+        failure = "empty file";
+
+    // links that close a cycle or do not type check are dropped as in the editor
+    g.commitEdit();
+
+    if (!failure.empty()) {
+        // nothing to keep when reading into an empty graph
+        if (added.size() == g.nodes.size())
+            g.clear();
+        else
+            g.removeNodes(added);
+        if (error)
+            *error = "line " + std::to_string(lineNumber) + ": " + failure;
+        return false;
+    }
+    if (ids)
+        *ids = std::move(idMap);
+    return true;
+}
+
+bool save(const Graph &g, const std::string &fileName)
+{
+    std::ofstream f(fileName, std::ios::binary);
+    f << write(g);
+    return bool(f);
+}
+
+bool load(Graph &g, const std::string &fileName, std::unordered_map<Id, Id> *ids, std::string *error)
+{
+    std::ifstream f(fileName, std::ios::binary);
+    if (!f) {
+        if (error)
+            *error = "cannot open " + fileName;
+        return false;
+    }
+    std::stringstream s;
+    s << f.rdbuf();
+    return read(g, s.str(), ids, error);
+}
+
+} // namespace
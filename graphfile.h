@@ -0,0 +1,39 @@
+#ifndef GRAPHFILE_H
+#define GRAPHFILE_H
+
+#include <string>
+#include <unordered_map>
+
+struct Graph;
+using Id = int;
+
+// Plain text serialization of a graph, one item per line:
+//
+//     nodestuff-graph 1
+//     node <id> <type name, as in the node's descriptor>
+//     value <id> <float|vec2|vec3|vec4|mat3|mat4> <floats, column-major>
+//     value <id> string <text>
+//     value <id> <floatarray|vec2array|vec3array|vec4array|mat4array> <count> <floats, element by element>
+//     live <id>
+//     link <source id> <output port order> <consumer id> <input port order>
+//
+// Node lines come before any line referring to the node. A node has a
+// value line per Static port, in port order. Ports are addressed by their
+// order in the node type's layout, and node ids are only names within the
+// file.
+namespace GraphFile {
+
+std::string write(const Graph &g);
+
+// Adds the contents of text to g in one edit transaction. ids (when not
+// null) receives the id of the new node for each id in the file. On
+// failure, error says which line is wrong and g is left without any of
+// the new nodes.
+bool read(Graph &g, const std::string &text, std::unordered_map<Id, Id> *ids = nullptr, std::string *error = nullptr);
+
+bool save(const Graph &g, const std::string &fileName);
+bool load(Graph &g, const std::string &fileName, std::unordered_map<Id, Id> *ids = nullptr, std::string *error = nullptr);
+
+} // namespace
+
+#endif
@@ -1,10 +1,16 @@
 #include "gui.h"
 #include "nodeconstructors.h"
 #include "imnodes.h"
+#include "evalworker.h"
+#include "glslgen.h"
+#include "cppgen.h"
+#include "graphfile.h"
+#include <cstdio>
 
-void Gui::init(Graph *g)
+void Gui::init(Graph *g, EvalWorker *e)
 {
     graph = g;
+    evaluator = e;
     imnodes::Initialize();
 }
 
@@ -13,28 +19,30 @@ void Gui::cleanup()
     imnodes::Shutdown();
 }
 
-static void valueEditor(Port &port, bool *active)
+// returns true when the value was changed
+static bool valueEditor(Port &port, bool *active)
 {
-    std::visit([active](auto&& arg) {
+    bool changed = false;
+    std::visit([active, &changed](auto&& arg) {
         using T = std::decay_t<decltype(arg)>;
         if constexpr (std::is_same_v<T, PortDataFloat>) {
             ImGui::PushItemWidth(60);
-            ImGui::InputFloat("", &arg.v);
+            changed |= ImGui::InputFloat("", &arg.v);
             *active |= ImGui::IsItemActive();
             ImGui::PopItemWidth();
         } else if constexpr (std::is_same_v<T, PortDataVec2>) {
             ImGui::PushItemWidth(120);
-            ImGui::InputFloat2("", glm::value_ptr(arg.v));
+            changed |= ImGui::InputFloat2("", glm::value_ptr(arg.v));
             *active |= ImGui::IsItemActive();
             ImGui::PopItemWidth();
         } else if constexpr (std::is_same_v<T, PortDataVec3>) {
             ImGui::PushItemWidth(180);
-            ImGui::InputFloat3("", glm::value_ptr(arg.v));
+            changed |= ImGui::InputFloat3("", glm::value_ptr(arg.v));
             *active |= ImGui::IsItemActive();
             ImGui::PopItemWidth();
         } else if constexpr (std::is_same_v<T, PortDataVec4>) {
             ImGui::PushItemWidth(240);
-            ImGui::InputFloat4("", glm::value_ptr(arg.v));
+            changed |= ImGui::InputFloat4("", glm::value_ptr(arg.v));
             *active |= ImGui::IsItemActive();
             ImGui::PopItemWidth();
         } else if constexpr (std::is_same_v<T, PortDataMat3>) {
@@ -44,13 +52,13 @@ static void valueEditor(Port &port, bool *active)
                 static const char *labels[3] = { "ROW 0", "ROW 1", "ROW 2" };
                 for (int row = 0; row < 3; ++row) {
                     float v[3] = { arg.v[0][row], arg.v[1][row], arg.v[2][row] };
-                    ImGui::InputFloat3(labels[row], v);
+                    changed |= ImGui::InputFloat3(labels[row], v);
                     arg.v[0][row] = v[0]; arg.v[1][row] = v[1]; arg.v[2][row] = v[2];
                 }
             } else {
                 static const char *labels[3] = { "COL 0", "COL 1", "COL 2" };
                 for (int col = 0; col < 3; ++col)
-                    ImGui::InputFloat3(labels[col], glm::value_ptr(arg.v) + 3 * col);
+                    changed |= ImGui::InputFloat3(labels[col], glm::value_ptr(arg.v) + 3 * col);
             }
             *active |= ImGui::IsItemActive();
             ImGui::PopItemWidth();
@@ -61,28 +69,41 @@ static void valueEditor(Port &port, bool *active)
                 static const char *labels[4] = { "ROW 0", "ROW 1", "ROW 2", "ROW 3" };
                 for (int row = 0; row < 4; ++row) {
                     float v[4] = { arg.v[0][row], arg.v[1][row], arg.v[2][row], arg.v[3][row] };
-                    ImGui::InputFloat4(labels[row], v);
+                    changed |= ImGui::InputFloat4(labels[row], v);
                     arg.v[0][row] = v[0]; arg.v[1][row] = v[1]; arg.v[2][row] = v[2]; arg.v[3][row] = v[3];
                 }
             } else {
                 static const char *labels[4] = { "COL 0", "COL 1", "COL 2", "COL 3" };
                 for (int col = 0; col < 4; ++col)
-                    ImGui::InputFloat4(labels[col], glm::value_ptr(arg.v) + 4 * col);
+                    changed |= ImGui::InputFloat4(labels[col], glm::value_ptr(arg.v) + 4 * col);
             }
             *active |= ImGui::IsItemActive();
             ImGui::PopItemWidth();
         } else if constexpr (std::is_same_v<T, PortDataString>) {
-            char s[5];
-            strcpy(s, arg.v.c_str());
-            ImGui::PushItemWidth(50);
+            // swizzles and record types are short, file names grow the field
+            char s[1024];
+            snprintf(s, sizeof(s), "%s", arg.v.c_str());
+            ImGui::PushItemWidth(std::min(std::max(ImGui::CalcTextSize(s).x + 20.0f, 50.0f), 400.0f));
             ImGui::InputText("", s, sizeof(s));
             ImGui::PopItemWidth();
-            arg.v = s;
+            if (arg.v != s) {
+                arg.v = s;
+                changed = true;
+            }
         }
     }, port.data.d);
+    return changed;
+}
+
+static void writeFile(const char *fileName, const std::string &contents)
+{
+    if (FILE *f = fopen(fileName, "w")) {
+        fwrite(contents.data(), 1, contents.size(), f);
+        fclose(f);
+    }
 }
 
-static void valueLabel(const Port &port)
+static void valueLabel(const PortData &data)
 {
     std::visit([](auto&& arg) {
         using T = std::decay_t<decltype(arg)>;
@@ -114,7 +135,30 @@ static void valueLabel(const Port &port)
         } else if constexpr (std::is_same_v<T, PortDataString>) {
             ImGui::Text("%s", arg.v.c_str());
         }
-    }, port.data.d);
+    }, data.d);
+}
+
+static void arrayLabel(const EvalResults::ArraySize &array)
+{
+    switch (array.type) {
+    case PortDataType::FloatArray:
+        ImGui::Text("float[%zu]", array.count);
+        break;
+    case PortDataType::Vec2Array:
+        ImGui::Text("vec2[%zu]", array.count);
+        break;
+    case PortDataType::Vec3Array:
+        ImGui::Text("vec3[%zu]", array.count);
+        break;
+    case PortDataType::Vec4Array:
+        ImGui::Text("vec4[%zu]", array.count);
+        break;
+    case PortDataType::Mat4Array:
+        ImGui::Text("mat4[%zu]", array.count);
+        break;
+    default:
+        break;
+    }
 }
 
 void Gui::frame()
@@ -123,42 +167,62 @@ void Gui::frame()
     ImGui::SetNextWindowSize(ImVec2(1260, 640), ImGuiCond_FirstUseEver);
     ImGui::Begin("Graph");
 
+    // output values come from the evaluator thread and may be a few frames old
+    const EvalResults &results(evaluator->results());
+    ImGui::Text("Evaluation lag: %d frame(s)%s", int(evaluator->lag()), results.native ? ", native" : "");
+    if (NativeCompiler::isSupported()) {
+        ImGui::SameLine();
+        bool native = evaluator->isNativeEnabled();
+        if (ImGui::Checkbox("Compile to native code", &native))
+            evaluator->setNativeEnabled(native);
+    }
+
     imnodes::PushAttributeFlag(imnodes::AttributeFlags_EnableLinkDetachWithDragClick);
     imnodes::BeginNodeEditor();
 
     bool editorActive = false;
-    for (auto it = graph->nodes.begin(), end = graph->nodes.end(); it != end; ++it) {
-        Node &n(it->second);
-        imnodes::BeginNode(it->first);
+    for (Node &n : graph->nodes) {
+        const NodeTypeDescriptor &desc(n.descriptor());
+        imnodes::BeginNode(n.id);
         imnodes::BeginNodeTitleBar();
-        ImGui::TextUnformatted(n.text.c_str());
+        ImGui::Text("%s [%d]", desc.name, n.id);
         imnodes::EndNodeTitleBar();
         for (const Port &port : n.ports) {
             if (port.dir == PortDirection::Input) {
                 imnodes::BeginInputAttribute(port.id);
-                ImGui::Text(port.text.c_str());
+                ImGui::TextUnformatted(desc.portText(port.order));
                 imnodes::EndInputAttribute();
             }
         }
         for (Port &port : n.ports) {
             if (port.dir == PortDirection::Static) {
                 imnodes::BeginStaticAttribute(port.id);
-                ImGui::Text(port.text.c_str());
+                ImGui::TextUnformatted(desc.portText(port.order));
                 ImGui::SameLine();
-                valueEditor(port, &editorActive);
+                if (valueEditor(port, &editorActive))
+                    graph->staticPortChanged(n);
                 imnodes::EndStaticAttribute();
             }
         }
         for (const Port &port : n.ports) {
             if (port.dir == PortDirection::Output) {
                 imnodes::BeginOutputAttribute(port.id);
-                ImGui::Text(port.text.c_str());
-                ImGui::SameLine();
-                if (!port.data.desc.empty()) {
-                    ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "%s", port.data.desc.c_str());
+                ImGui::TextUnformatted(desc.portText(port.order));
+                auto result = results.outputs.find(port.id);
+                if (result != results.outputs.end()) {
                     ImGui::SameLine();
+                    if (const char *desc = result->second.desc()) {
+                        ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "%s", desc);
+                        ImGui::SameLine();
+                    }
+                    valueLabel(result->second);
+                } else {
+                    auto array = results.arrays.find(port.id);
+                    if (array != results.arrays.end()) {
+                        ImGui::SameLine();
+                        arrayLabel(array->second);
+                    }
                 }
-                valueLabel(port);
                 imnodes::EndOutputAttribute();
             }
         }
@@ -200,6 +264,31 @@ void Gui::frame()
             }
             ImGui::EndMenu();
         }
+        const int selectedNodeCount = imnodes::NumSelectedNodes();
+        if (ImGui::MenuItem("Copy selection as GLSL", nullptr, false, selectedNodeCount > 0)) {
+            std::vector<int> selected(static_cast<size_t>(selectedNodeCount));
+            imnodes::GetSelectedNodes(selected.data());
+            const GlslGen::Shader shader = GlslGen::generate(*graph, selected);
+            if (!shader.failedNode)
+                ImGui::SetClipboardText(shader.source.c_str());
+        }
+        // into the working directory, along with a program checking it against GraphEval
+        if (ImGui::MenuItem("Export selection as C++ header", nullptr, false, selectedNodeCount > 0)) {
+            std::vector<int> selected(static_cast<size_t>(selectedNodeCount));
+            imnodes::GetSelectedNodes(selected.data());
+            const CppGen::Header header = CppGen::generate(*graph, selected);
+            if (!header.failedNode) {
+                writeFile("nodegraph.h", header.source);
+                writeFile("nodegraph_check.cpp", CppGen::generateCheck(*graph, selected, "nodegraph.h"));
+            }
+        }
+        // graph.txt in the working directory, which is also what nodesweep reads
+        if (ImGui::MenuItem("Save graph"))
+            GraphFile::save(*graph, "graph.txt");
+        if (ImGui::MenuItem("Open graph")) {
+            graph->clear();
+            GraphFile::load(*graph, "graph.txt");
+        }
         ImGui::EndPopup();
     }
 
@@ -211,15 +300,13 @@ void Gui::frame()
         if (selectedLinkCount > 0) {
             selected.resize(size_t(selectedLinkCount));
             imnodes::GetSelectedLinks(selected.data());
-            for (Id edgeId : selected)
-                graph->removeConnection(edgeId);
+            graph->removeConnections(selected);
         }
         const int selectedNodeCount = imnodes::NumSelectedNodes();
         if (selectedNodeCount > 0) {
             selected.resize(size_t(selectedNodeCount));
             imnodes::GetSelectedNodes(selected.data());
-            for (Id nodeId : selected)
-                graph->removeNode(nodeId);
+            graph->removeNodes(selected);
         }
     }
 
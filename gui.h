@@ -4,13 +4,16 @@
 #include "imgui.h"
 #include "graph.h"
 
+struct EvalWorker;
+
 struct Gui
 {
-    void init(Graph *g);
+    void init(Graph *g, EvalWorker *e);
     void cleanup();
     void frame();
 
     Graph *graph = nullptr;
+    EvalWorker *evaluator = nullptr;
 };
 
 #endif
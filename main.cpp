@@ -2,7 +2,7 @@
 #include <QQuickView>
 #include "qrhiimgui.h"
 #include "gui.h"
-#include "grapheval.h"
+#include "evalworker.h"
 
 struct ImGuiQuick
 {
@@ -94,6 +94,7 @@ int main(int argc, char *argv[])
     QGuiApplication app(argc, argv);
 
     Graph graph;
+    EvalWorker evaluator;
     Gui gui;
     ImGuiQuick ig;
     QQuickView view;
@@ -105,11 +106,12 @@ int main(int argc, char *argv[])
 
     ImGui::GetIO().IniFilename = nullptr;
     ig.setWindow(&view);
-    ig.d.setFrameFunc([&gui, &graph] {
+    // evaluation happens on the EvalWorker thread, the render thread only hands over edits
+    ig.d.setFrameFunc([&gui, &graph, &evaluator] {
         gui.frame();
-        GraphEval::update(graph);
+        evaluator.submit(graph);
     });
-    gui.init(&graph);
+    gui.init(&graph, &evaluator);
 
     view.setColor(Qt::black);
     view.setResizeMode(QQuickView::SizeRootObjectToView);
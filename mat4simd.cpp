@@ -0,0 +1,185 @@
+#include "mat4simd.h"
+
+// glm/simd needs GLM_ARCH, which is only set up with intrinsics enabled.
+// Only the raw __m128 functions are used here, no glm types, so this
+// does not change any glm code shared with other translation units.
+#define GLM_FORCE_INTRINSICS
+#include "glm/detail/setup.hpp"
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+
+#include "glm/simd/matrix.h"
+#include <immintrin.h>
+#if GLM_COMPILER & GLM_COMPILER_VC
+#include <intrin.h>
+#define TARGET_AVX
+#else
+#define TARGET_AVX __attribute__((target("avx")))
+#endif
+
+namespace Mat4Simd {
+
+bool available()
+{
+    return true;
+}
+
+static bool detectAvx()
+{
+#if GLM_COMPILER & GLM_COMPILER_VC
+    int info[4];
+    __cpuid(info, 1);
+    const bool osxsave = info[2] & (1 << 27);
+    const bool avx = info[2] & (1 << 28);
+    // the OS must save the ymm registers
+    return osxsave && avx && (_xgetbv(0) & 6) == 6;
+#else
+    return __builtin_cpu_supports("avx");
+#endif
+}
+
+bool hasAvx()
+{
+    static const bool avx = detectAvx();
+    return avx;
+}
+
+static inline __m128 splat(__m128 v, int i)
+{
+    switch (i) {
+    case 0:
+        return _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0));
+    case 1:
+        return _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1));
+    case 2:
+        return _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2));
+    default:
+        return _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+}
+
+// column j of the result is ((a0 * b[j].x + a1 * b[j].y) + a2 * b[j].z) + a3 * b[j].w
+void mul(const float *a, const float *b, float *result)
+{
+    const __m128 a0 = _mm_load_ps(a);
+    const __m128 a1 = _mm_load_ps(a + 4);
+    const __m128 a2 = _mm_load_ps(a + 8);
+    const __m128 a3 = _mm_load_ps(a + 12);
+    for (int j = 0; j < 4; ++j) {
+        const __m128 bj = _mm_load_ps(b + 4 * j);
+        __m128 r = _mm_mul_ps(a0, splat(bj, 0));
+        r = _mm_add_ps(r, _mm_mul_ps(a1, splat(bj, 1)));
+        r = _mm_add_ps(r, _mm_mul_ps(a2, splat(bj, 2)));
+        r = _mm_add_ps(r, _mm_mul_ps(a3, splat(bj, 3)));
+        _mm_store_ps(result + 4 * j, r);
+    }
+}
+
+// same as mul(), with the columns of a in both halves and two columns of b
+// per step
+TARGET_AVX void mulAvx(const float *a, const float *b, float *result)
+{
+    const __m256 a0 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a));
+    const __m256 a1 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a + 4));
+    const __m256 a2 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a + 8));
+    const __m256 a3 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(a + 12));
+    for (int j = 0; j < 4; j += 2) {
+        const __m256 bj = _mm256_loadu_ps(b + 4 * j);
+        __m256 r = _mm256_mul_ps(a0, _mm256_permute_ps(bj, _MM_SHUFFLE(0, 0, 0, 0)));
+        r = _mm256_add_ps(r, _mm256_mul_ps(a1, _mm256_permute_ps(bj, _MM_SHUFFLE(1, 1, 1, 1))));
+        r = _mm256_add_ps(r, _mm256_mul_ps(a2, _mm256_permute_ps(bj, _MM_SHUFFLE(2, 2, 2, 2))));
+        r = _mm256_add_ps(r, _mm256_mul_ps(a3, _mm256_permute_ps(bj, _MM_SHUFFLE(3, 3, 3, 3))));
+        _mm256_storeu_ps(result + 4 * j, r);
+    }
+}
+
+// (m0 * v.x + m1 * v.y) + (m2 * v.z + m3 * v.w), as glm_mat4_mul_vec4()
+void mulVec(const float *m, const float *v, float *result)
+{
+    const __m128 in[4] = { _mm_load_ps(m), _mm_load_ps(m + 4), _mm_load_ps(m + 8), _mm_load_ps(m + 12) };
+    _mm_store_ps(result, glm_mat4_mul_vec4(in, _mm_load_ps(v)));
+}
+
+// component i is ((m[i][0] * v.x + m[i][1] * v.y) + m[i][2] * v.z) + m[i][3] * v.w,
+// unlike glm_vec4_mul_mat4(), which adds pairwise
+void vecMul(const float *v, const float *m, float *result)
+{
+    __m128 t0 = _mm_load_ps(m);
+    __m128 t1 = _mm_load_ps(m + 4);
+    __m128 t2 = _mm_load_ps(m + 8);
+    __m128 t3 = _mm_load_ps(m + 12);
+    _MM_TRANSPOSE4_PS(t0, t1, t2, t3);
+    const __m128 vv = _mm_load_ps(v);
+    __m128 r = _mm_mul_ps(t0, splat(vv, 0));
+    r = _mm_add_ps(r, _mm_mul_ps(t1, splat(vv, 1)));
+    r = _mm_add_ps(r, _mm_mul_ps(t2, splat(vv, 2)));
+    r = _mm_add_ps(r, _mm_mul_ps(t3, splat(vv, 3)));
+    _mm_store_ps(result, r);
+}
+
+// glm_mat4_inverse() computes the cofactors like glm::inverse() does
+void inverse(const float *m, float *result)
+{
+    const __m128 in[4] = { _mm_load_ps(m), _mm_load_ps(m + 4), _mm_load_ps(m + 8), _mm_load_ps(m + 12) };
+    __m128 out[4];
+    glm_mat4_inverse(in, out);
+    for (int i = 0; i < 4; ++i)
+        _mm_store_ps(result + 4 * i, out[i]);
+}
+
+// The sub factors and cofactors of glm's compute_determinant, four at a
+// time. glm_mat4_determinant() groups the final sum differently.
+float determinant(const float *m)
+{
+    const __m128 c0 = _mm_load_ps(m);
+    const __m128 c1 = _mm_load_ps(m + 4);
+    const __m128 c2 = _mm_load_ps(m + 8);
+    const __m128 c3 = _mm_load_ps(m + 12);
+
+    // SubFactor00..03, then 04..05
+    const __m128 sa = _mm_sub_ps(
+        _mm_mul_ps(_mm_shuffle_ps(c2, c2, _MM_SHUFFLE(0, 1, 1, 2)), _mm_shuffle_ps(c3, c3, _MM_SHUFFLE(3, 2, 3, 3))),
+        _mm_mul_ps(_mm_shuffle_ps(c3, c3, _MM_SHUFFLE(0, 1, 1, 2)), _mm_shuffle_ps(c2, c2, _MM_SHUFFLE(3, 2, 3, 3))));
+    const __m128 sb = _mm_sub_ps(
+        _mm_mul_ps(_mm_shuffle_ps(c2, c2, _MM_SHUFFLE(0, 0, 0, 0)), _mm_shuffle_ps(c3, c3, _MM_SHUFFLE(1, 1, 1, 2))),
+        _mm_mul_ps(_mm_shuffle_ps(c3, c3, _MM_SHUFFLE(0, 0, 0, 0)), _mm_shuffle_ps(c2, c2, _MM_SHUFFLE(1, 1, 1, 2))));
+
+    // DetCof = (a * fa - b * fb + c * fc) * (+1, -1, +1, -1)
+    const __m128 a = _mm_shuffle_ps(c1, c1, _MM_SHUFFLE(0, 0, 0, 1));
+    const __m128 fa = _mm_shuffle_ps(sa, sa, _MM_SHUFFLE(2, 1, 0, 0));
+    const __m128 b = _mm_shuffle_ps(c1, c1, _MM_SHUFFLE(1, 1, 2, 2));
+    const __m128 t = _mm_shuffle_ps(sa, sb, _MM_SHUFFLE(0, 0, 3, 3));
+    const __m128 fb = _mm_shuffle_ps(sa, t, _MM_SHUFFLE(2, 0, 3, 1));
+    const __m128 c = _mm_shuffle_ps(c1, c1, _MM_SHUFFLE(2, 3, 3, 3));
+    const __m128 u = _mm_shuffle_ps(sb, sb, _MM_SHUFFLE(1, 1, 0, 0));
+    const __m128 w = _mm_shuffle_ps(sa, sb, _MM_SHUFFLE(0, 0, 2, 2));
+    const __m128 fc = _mm_shuffle_ps(w, u, _MM_SHUFFLE(3, 2, 2, 0));
+    const __m128 sign = _mm_set_ps(-0.0f, 0.0f, -0.0f, 0.0f);
+    const __m128 detCof = _mm_xor_ps(_mm_add_ps(_mm_sub_ps(_mm_mul_ps(a, fa), _mm_mul_ps(b, fb)), _mm_mul_ps(c, fc)), sign);
+
+    // ((p0 + p1) + p2) + p3
+    const __m128 p = _mm_mul_ps(c0, detCof);
+    __m128 sum = _mm_add_ss(p, splat(p, 1));
+    sum = _mm_add_ss(sum, splat(p, 2));
+    sum = _mm_add_ss(sum, splat(p, 3));
+    return _mm_cvtss_f32(sum);
+}
+
+} // namespace
+
+#else
+
+namespace Mat4Simd {
+
+bool available() { return false; }
+bool hasAvx() { return false; }
+void mul(const float *, const float *, float *) { }
+void mulAvx(const float *, const float *, float *) { }
+void mulVec(const float *, const float *, float *) { }
+void vecMul(const float *, const float *, float *) { }
+void inverse(const float *, float *) { }
+float determinant(const float *) { return 0.0f; }
+
+} // namespace
+
+#endif
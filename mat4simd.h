@@ -0,0 +1,28 @@
+#ifndef MAT4SIMD_H
+#define MAT4SIMD_H
+
+// SSE versions of the Mat4 operations that dominate matrix heavy graphs,
+// used by GraphEval's Mat4 kernels when available(). Each performs exactly
+// the arithmetic of its glm counterpart, in the same order, so results are
+// bit-identical to the scalar kernels and to CppGen output (apart from the
+// payload of NaNs). Matrices and vectors are column-major floats aligned
+// to 16 bytes, like the values in a ValueStore. The result may be one of
+// the arguments.
+namespace Mat4Simd {
+
+// false when not built for x86 (the vendored glm/simd code is SSE only)
+bool available();
+
+// true if the CPU has AVX, for the variants below taking two columns at a time
+bool hasAvx();
+
+void mul(const float *a, const float *b, float *result); // a * b, SSE2
+void mulAvx(const float *a, const float *b, float *result); // a * b, only call when hasAvx()
+void mulVec(const float *m, const float *v, float *result); // m * v
+void vecMul(const float *v, const float *m, float *result); // v * m
+void inverse(const float *m, float *result);
+float determinant(const float *m);
+
+} // namespace
+
+#endif
@@ -0,0 +1,148 @@
+#include "nativecompiler.h"
+
+#ifdef NODESTUFF_NATIVE_EVAL
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
+
+// the entry point of every module
+static const char *const FUNCTION_NAME = "nodestuff_evaluate";
+
+NativeCompiler::NativeCompiler()
+{
+    if (isSupported())
+        thread = std::thread(&NativeCompiler::run, this);
+}
+
+NativeCompiler::~NativeCompiler()
+{
+    if (!thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+    }
+    requestAvailable.notify_one();
+    // waits for a build in progress to finish
+    thread.join();
+}
+
+bool NativeCompiler::isSupported()
+{
+#ifdef NODESTUFF_NATIVE_EVAL
+    return true;
+#else
+    return false;
+#endif
+}
+
+void NativeCompiler::compile(uint64_t tag, CppGen::Module module)
+{
+    if (!thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        requestTag = tag;
+        request = std::move(module);
+        hasRequest = true;
+    }
+    requestAvailable.notify_one();
+}
+
+bool NativeCompiler::take(Result *r)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (!hasResult)
+        return false;
+    *r = std::move(result);
+    result = Result();
+    hasResult = false;
+    return true;
+}
+
+void NativeCompiler::run()
+{
+    for (;;) {
+        uint64_t tag;
+        CppGen::Module module;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            requestAvailable.wait(guard, [this] { return quit || hasRequest; });
+            if (quit)
+                return;
+            tag = requestTag;
+            module = std::move(request);
+            request = CppGen::Module();
+            hasRequest = false;
+        }
+
+        // the lock is not held while compiling
+        Result r = build(tag, module);
+
+        std::lock_guard<std::mutex> guard(lock);
+        result = std::move(r);
+        hasResult = true;
+    }
+}
+
+NativeCompiler::Result NativeCompiler::build(uint64_t tag, CppGen::Module &module)
+{
+    Result r;
+    r.tag = tag;
+#ifdef NODESTUFF_NATIVE_EVAL
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    const fs::path base = fs::temp_directory_path(ec)
+        / ("nodestuff_" + std::to_string(getpid()) + '_' + std::to_string(++fileSerial));
+    const fs::path source = base.string() + ".cpp";
+    const fs::path library = base.string() + ".so";
+    const fs::path log = base.string() + ".log";
+
+    {
+        std::ofstream f(source);
+        f << module.source;
+    }
+    module.source.clear();
+
+    const char *compiler = getenv("NODESTUFF_CXX");
+    if (!compiler)
+        compiler = NODESTUFF_NATIVE_CXX;
+    // No -ffast-math or -march, so that results do not change when
+    // switching from GraphEval's kernels to native. -O1 gets most of the
+    // speed of -O2 in half the build time.
+    const std::string command = std::string("\"") + compiler + "\" -std=c++17 -O1 -fPIC -shared"
+        + " -I\"" NODESTUFF_NATIVE_INCLUDE_DIR "\""
+        + " -o \"" + library.string() + "\" \"" + source.string() + "\" > \"" + log.string() + "\" 2>&1";
+    if (std::system(command.c_str()) == 0) {
+        if (void *handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL)) {
+            r.function = reinterpret_cast<GraphEval::Plan::NativeFunction>(dlsym(handle, FUNCTION_NAME));
+            r.library = std::shared_ptr<void>(handle, [](void *handle) { dlclose(handle); });
+            r.nodes = std::move(module.nodes);
+        } else {
+            r.log = dlerror();
+        }
+    } else {
+        std::ifstream f(log);
+        std::stringstream s;
+        s << f.rdbuf();
+        r.log = s.str();
+    }
+
+    // a loaded library stays mapped without its file
+    fs::remove(source, ec);
+    fs::remove(library, ec);
+    fs::remove(log, ec);
+#else
+    (void) module;
+#endif
+    return r;
+}
+
+std::string NativeCompiler::functionName()
+{
+    return FUNCTION_NAME;
+}
@@ -0,0 +1,64 @@
+#ifndef NATIVECOMPILER_H
+#define NATIVECOMPILER_H
+
+#include "grapheval.h"
+#include "cppgen.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <string>
+
+// Builds CppGen modules into shared libraries with the system C++ compiler
+// and loads them, on a thread of its own so that nobody ever waits for the
+// compiler. Only the latest request is worked on, older ones that have not
+// started are dropped. Results are polled with take().
+//
+// The compiler is $NODESTUFF_CXX, or the one the application was built
+// with. Without NODESTUFF_NATIVE_EVAL (a CMake option, for platforms with
+// dlopen) isSupported() is false and nothing is ever compiled.
+struct NativeCompiler
+{
+    struct Result
+    {
+        uint64_t tag = 0; // as passed to compile()
+        GraphEval::Plan::NativeFunction function = nullptr; // null when the build failed
+        std::shared_ptr<void> library; // unloaded when the last reference goes away
+        std::vector<Id> nodes; // CppGen::Module::nodes
+        std::string log; // compiler output when the build failed
+    };
+
+    NativeCompiler();
+    ~NativeCompiler();
+
+    NativeCompiler(const NativeCompiler &) = delete;
+    NativeCompiler &operator=(const NativeCompiler &) = delete;
+
+    static bool isSupported();
+
+    // to pass to CppGen::generateModule()
+    static std::string functionName();
+
+    // tag identifies what module was generated from, see Result::tag
+    void compile(uint64_t tag, CppGen::Module module);
+
+    // true if a build finished since the last call
+    bool take(Result *result);
+
+private:
+    Result build(uint64_t tag, CppGen::Module &module);
+    void run();
+
+    std::mutex lock;
+    std::condition_variable requestAvailable;
+    uint64_t requestTag = 0;
+    CppGen::Module request;
+    bool hasRequest = false;
+    Result result;
+    bool hasResult = false;
+    bool quit = false;
+    uint64_t fileSerial = 0; // compiler thread only
+    std::thread thread;
+};
+
+#endif
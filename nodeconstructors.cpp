@@ -1,339 +1,204 @@
 #include "nodeconstructors.h"
-#include "grapheval.h"
 
 namespace NodeConstructors {
 
-static inline Node &newNode(Graph *g, const char *typeName, NodeType type, Node::EvalFunc f)
+// ports as laid out in the type's descriptor
+static inline Node &newNode(Graph *g, NodeType type)
 {
     Node &n(g->newNode());
     n.type = type;
-    n.evalFunc = f;
-    char s[128];
-    sprintf(s, "%s [%d]", typeName, n.id);
-    n.text = s;
+    const NodeTypeDescriptor &desc(n.descriptor());
+    n.ports.reserve(desc.portCount);
+    for (size_t i = 0; i < desc.portCount; ++i) {
+        Port &port = g->addPort(n, desc.ports[i].dir);
+        port.order = int(i);
+    }
     return n;
 }
 
-static inline void addConstantPorts(Graph *g, Node &n, const PortDataVar &d)
+static inline Port &staticPort(Node &n)
 {
-    n.inputPortCount = 0;
-    {
-        Port &port = g->addPort(n, PortDirection::Static);
-        port.order = 0;
-        port.text = "Value";
-        port.data.d = d;
-    }
-    {
-        Port &port = g->addPort(n, PortDirection::Output);
-        port.order = 1;
-        port.text = "Result";
-    }
+    return *std::find_if(n.ports.begin(), n.ports.end(), [](const Port &port) { return port.dir == PortDirection::Static; });
 }
 
-Id constructFloatNode(Graph *g)
+static inline Id newConstantNode(Graph *g, NodeType type, const PortDataVar &d)
 {
-    Node &n(newNode(g, "Float", NodeType::Float, GraphEval::evalConstantNode));
-    addConstantPorts(g, n, PortDataFloat { 0.0f });
+    Node &n(newNode(g, type));
+    staticPort(n).data.d = d;
+    // the output type follows the value
+    g->invalidate(n);
     return n.id;
 }
 
+Id constructFloatNode(Graph *g)
+{
+    return newConstantNode(g, NodeType::Float, PortDataFloat { 0.0f });
+}
+
 Id constructVec2Node(Graph *g)
 {
-    Node &n(newNode(g, "Vec2", NodeType::Vec2, GraphEval::evalConstantNode));
-    addConstantPorts(g, n, PortDataVec2 { glm::vec2() });
-    return n.id;
+    return newConstantNode(g, NodeType::Vec2, PortDataVec2 { glm::vec2() });
 }
 
 Id constructVec3Node(Graph *g)
 {
-    Node &n(newNode(g, "Vec3", NodeType::Vec3, GraphEval::evalConstantNode));
-    addConstantPorts(g, n, PortDataVec3 { glm::vec3() });
-    return n.id;
+    return newConstantNode(g, NodeType::Vec3, PortDataVec3 { glm::vec3() });
 }
 
 Id constructVec4Node(Graph *g)
 {
-    Node &n(newNode(g, "Vec4", NodeType::Vec4, GraphEval::evalConstantNode));
-    addConstantPorts(g, n, PortDataVec4 { glm::vec4() });
-    return n.id;
+    return newConstantNode(g, NodeType::Vec4, PortDataVec4 { glm::vec4() });
 }
 
 Id constructMat3Node(Graph *g)
 {
-    Node &n(newNode(g, "Mat3", NodeType::Mat3, GraphEval::evalConstantNode));
-    addConstantPorts(g, n, PortDataMat3 { glm::mat3(1, 0, 0, 0, 1, 0, 0, 0, 1) });
-    return n.id;
+    return newConstantNode(g, NodeType::Mat3, PortDataMat3 { glm::mat3(1, 0, 0, 0, 1, 0, 0, 0, 1) });
 }
 
 Id constructMat4Node(Graph *g)
 {
-    Node &n(newNode(g, "Mat4", NodeType::Mat4, GraphEval::evalConstantNode));
-    addConstantPorts(g, n, PortDataMat4 { glm::mat4(1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1) });
-    return n.id;
+    return newConstantNode(g, NodeType::Mat4, PortDataMat4 { glm::mat4(1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1) });
 }
 
-static inline void addOp2Ports(Graph *g, Node &n)
+Id constructBinaryFileNode(Graph *g)
 {
-    n.inputPortCount = 2;
-    {
-        Port &port = g->addPort(n, PortDirection::Input);
-        port.order = 0;
-        port.text = "Left operand";
-    }
-    {
-        Port &port = g->addPort(n, PortDirection::Input);
-        port.order = 1;
-        port.text = "Right operand";
-    }
-    {
-        Port &port = g->addPort(n, PortDirection::Output);
-        port.order = 2;
-        port.text = "Result";
+    Node &n(newNode(g, NodeType::BinaryFile));
+    // the file name, then the record type of files without a header
+    static const char *const defaults[] = { "", "vec3" };
+    for (Port &port : n.ports) {
+        if (port.dir == PortDirection::Static)
+            port.data.d = PortDataString { defaults[port.order] };
     }
+    g->invalidate(n);
+    return n.id;
 }
 
 Id constructPlusNode(Graph *g)
 {
-    Node &n(newNode(g, "Add", NodeType::Plus, GraphEval::evalPlusNode));
-    addOp2Ports(g, n);
-    return n.id;
+    return newNode(g, NodeType::Plus).id;
 }
 
 Id constructMinusNode(Graph *g)
 {
-    Node &n(newNode(g, "Subtract", NodeType::Minus, GraphEval::evalMinusNode));
-    addOp2Ports(g, n);
-    return n.id;
+    return newNode(g, NodeType::Minus).id;
 }
 
 Id constructMulNode(Graph *g)
 {
-    Node &n(newNode(g, "Multiply", NodeType::Mul, GraphEval::evalMulNode));
-    addOp2Ports(g, n);
-    return n.id;
+    return newNode(g, NodeType::Mul).id;
 }
 
 Id constructDivNode(Graph *g)
 {
-    Node &n(newNode(g, "Divide", NodeType::Div, GraphEval::evalDivNode));
-    addOp2Ports(g, n);
-    return n.id;
+    return newNode(g, NodeType::Div).id;
 }
 
 Id constructDistanceNode(Graph *g)
 {
-    Node &n(newNode(g, "Distance", NodeType::Distance, GraphEval::evalDistanceNode));
-    addOp2Ports(g, n);
-    return n.id;
+    return newNode(g, NodeType::Distance).id;
 }
 
 Id constructDotNode(Graph *g)
 {
-    Node &n(newNode(g, "Dot product", NodeType::Dot, GraphEval::evalDotNode));
-    addOp2Ports(g, n);
-    return n.id;
+    return newNode(g, NodeType::Dot).id;
 }
 
 Id constructCrossNode(Graph *g)
 {
-    Node &n(newNode(g, "Cross product", NodeType::Cross, GraphEval::evalCrossNode));
-    addOp2Ports(g, n);
-    return n.id;
-}
-
-static inline void addOp1Ports(Graph *g, Node &n)
-{
-    n.inputPortCount = 1;
-    {
-        Port &port = g->addPort(n, PortDirection::Input);
-        port.order = 0;
-        port.text = "Input";
-    }
-    {
-        Port &port = g->addPort(n, PortDirection::Output);
-        port.order = 2;
-        port.text = "Result";
-    }
+    return newNode(g, NodeType::Cross).id;
 }
 
 Id constructNegateNode(Graph *g)
 {
-    Node &n(newNode(g, "Negate", NodeType::Negate, GraphEval::evalNegateNode));
-    addOp1Ports(g, n);
-    return n.id;
+    return newNode(g, NodeType::Negate).id;
 }
 
 Id constructVec2CastNode(Graph *g)
 {
-    Node &n(newNode(g, "Cast to Vec2", NodeType::Vec2Cast, GraphEval::evalVec2CastNode));
-    addOp1Ports(g, n);
-    return n.id;
+    return newNode(g, NodeType::Vec2Cast).id;
 }
 
 Id constructVec3CastNode(Graph *g)
 {
-    Node &n(newNode(g, "Cast to Vec3", NodeType::Vec3Cast, GraphEval::evalVec3CastNode));
-    addOp1Ports(g, n);
-    return n.id;
+    return newNode(g, NodeType::Vec3Cast).id;
 }
 
 Id constructVec4CastNode(Graph *g)
 {
-    Node &n(newNode(g, "Cast to Vec4", NodeType::Vec4Cast, GraphEval::evalVec4CastNode));
-    addOp1Ports(g, n);
-    return n.id;
+    return newNode(g, NodeType::Vec4Cast).id;
 }
 
 Id constructMat3CastNode(Graph *g)
 {
-    Node &n(newNode(g, "Cast to Mat3", NodeType::Mat3Cast, GraphEval::evalMat3CastNode));
-    addOp1Ports(g, n);
-    return n.id;
+    return newNode(g, NodeType::Mat3Cast).id;
 }
 
 Id constructMat4CastNode(Graph *g)
 {
-    Node &n(newNode(g, "Cast to Mat4", NodeType::Mat4Cast, GraphEval::evalMat4CastNode));
-    addOp1Ports(g, n);
-    return n.id;
+    return newNode(g, NodeType::Mat4Cast).id;
 }
 
 Id constructLengthNode(Graph *g)
 {
-    Node &n(newNode(g, "Length", NodeType::Length, GraphEval::evalLengthNode));
-    addOp1Ports(g, n);
-    return n.id;
+    return newNode(g, NodeType::Length).id;
 }
 
 Id constructNormalizeNode(Graph *g)
 {
-    Node &n(newNode(g, "Normalize", NodeType::Normalize, GraphEval::evalNormalizeNode));
-    addOp1Ports(g, n);
-    return n.id;
+    return newNode(g, NodeType::Normalize).id;
 }
 
 Id constructTransposeNode(Graph *g)
 {
-    Node &n(newNode(g, "Transpose", NodeType::Transpose, GraphEval::evalTransposeNode));
-    addOp1Ports(g, n);
-    return n.id;
+    return newNode(g, NodeType::Transpose).id;
 }
 
 Id constructInverseNode(Graph *g)
 {
-    Node &n(newNode(g, "Inverse", NodeType::Inverse, GraphEval::evalInverseNode));
-    addOp1Ports(g, n);
-    return n.id;
+    return newNode(g, NodeType::Inverse).id;
 }
 
 Id constructDeterminantNode(Graph *g)
 {
-    Node &n(newNode(g, "Determinant", NodeType::Determinant, GraphEval::evalDeterminantNode));
-    addOp1Ports(g, n);
-    return n.id;
+    return newNode(g, NodeType::Determinant).id;
+}
+
+Id constructSumNode(Graph *g)
+{
+    return newNode(g, NodeType::Sum).id;
+}
+
+Id constructMinimumNode(Graph *g)
+{
+    return newNode(g, NodeType::Minimum).id;
+}
+
+Id constructMaximumNode(Graph *g)
+{
+    return newNode(g, NodeType::Maximum).id;
 }
 
 Id constructVec2CombineNode(Graph *g)
 {
-    Node &n(newNode(g, "Combine into Vec2", NodeType::Vec2Combine, GraphEval::evalVec2CombineNode));
-    n.inputPortCount = 2;
-    {
-        Port &port = g->addPort(n, PortDirection::Input);
-        port.order = 0;
-        port.text = "First component";
-    }
-    {
-        Port &port = g->addPort(n, PortDirection::Input);
-        port.order = 1;
-        port.text = "Second component";
-    }
-    {
-        Port &port = g->addPort(n, PortDirection::Output);
-        port.order = 2;
-        port.text = "Result";
-    }
-    return n.id;
+    return newNode(g, NodeType::Vec2Combine).id;
 }
 
 Id constructVec3CombineNode(Graph *g)
 {
-    Node &n(newNode(g, "Combine into Vec3", NodeType::Vec3Combine, GraphEval::evalVec3CombineNode));
-    n.inputPortCount = 3;
-    {
-        Port &port = g->addPort(n, PortDirection::Input);
-        port.order = 0;
-        port.text = "First component";
-    }
-    {
-        Port &port = g->addPort(n, PortDirection::Input);
-        port.order = 1;
-        port.text = "Second component";
-    }
-    {
-        Port &port = g->addPort(n, PortDirection::Input);
-        port.order = 2;
-        port.text = "Third component";
-    }
-    {
-        Port &port = g->addPort(n, PortDirection::Output);
-        port.order = 3;
-        port.text = "Result";
-    }
-    return n.id;
+    return newNode(g, NodeType::Vec3Combine).id;
 }
 
 Id constructVec4CombineNode(Graph *g)
 {
-    Node &n(newNode(g, "Combine into Vec4", NodeType::Vec4Combine, GraphEval::evalVec4CombineNode));
-    n.inputPortCount = 4;
-    {
-        Port &port = g->addPort(n, PortDirection::Input);
-        port.order = 0;
-        port.text = "First component";
-    }
-    {
-        Port &port = g->addPort(n, PortDirection::Input);
-        port.order = 1;
-        port.text = "Second component";
-    }
-    {
-        Port &port = g->addPort(n, PortDirection::Input);
-        port.order = 2;
-        port.text = "Third component";
-    }
-    {
-        Port &port = g->addPort(n, PortDirection::Input);
-        port.order = 3;
-        port.text = "Fourth component";
-    }
-    {
-        Port &port = g->addPort(n, PortDirection::Output);
-        port.order = 4;
-        port.text = "Result";
-    }
-    return n.id;
+    return newNode(g, NodeType::Vec4Combine).id;
 }
 
 Id constructSwizzleNode(Graph *g)
 {
-    Node &n(newNode(g, "Swizzle", NodeType::Swizzle, GraphEval::evalSwizzleNode));
-    n.inputPortCount = 1;
-    {
-        Port &port = g->addPort(n, PortDirection::Input);
-        port.order = 0;
-        port.text = "Input vector";
-    }
-    {
-        Port &port = g->addPort(n, PortDirection::Static);
-        port.order = 1;
-        port.text = "Swizzle";
-        port.data.d = PortDataString { "xyzw" };
-    }
-    {
-        Port &port = g->addPort(n, PortDirection::Output);
-        port.order = 2;
-        port.text = "Result";
-    }
+    Node &n(newNode(g, NodeType::Swizzle));
+    staticPort(n).data.d = PortDataString { "xyzw" };
+    // parses the swizzle
+    g->invalidate(n);
     return n.id;
 }
 
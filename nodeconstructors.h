@@ -11,6 +11,7 @@ Id constructVec3Node(Graph *g);
 Id constructVec4Node(Graph *g);
 Id constructMat3Node(Graph *g);
 Id constructMat4Node(Graph *g);
+Id constructBinaryFileNode(Graph *g);
 
 Id constructVec2CastNode(Graph *g);
 Id constructVec3CastNode(Graph *g);
@@ -38,6 +39,10 @@ Id constructTransposeNode(Graph *g);
 Id constructInverseNode(Graph *g);
 Id constructDeterminantNode(Graph *g);
 
+Id constructSumNode(Graph *g);
+Id constructMinimumNode(Graph *g);
+Id constructMaximumNode(Graph *g);
+
 } // namespace
 
 struct NodeConstructor
@@ -59,6 +64,7 @@ static NodeConstructor nodeConstructors_const[] = {
     { "Vec4", NodeConstructors::constructVec4Node },
     { "Mat3", NodeConstructors::constructMat3Node },
     { "Mat4", NodeConstructors::constructMat4Node },
+    { "Binary file", NodeConstructors::constructBinaryFileNode },
     { nullptr, nullptr }
 };
 
@@ -100,12 +106,20 @@ static NodeConstructor nodeConstructors_matrix[] = {
     { nullptr, nullptr }
 };
 
+static NodeConstructor nodeConstructors_array[] = {
+    { "Sum", NodeConstructors::constructSumNode },
+    { "Minimum", NodeConstructors::constructMinimumNode },
+    { "Maximum", NodeConstructors::constructMaximumNode },
+    { nullptr, nullptr }
+};
+
 static NodeConstructorSet nodeConstructorSets[] = {
     { "Constant", nodeConstructors_const },
     { "Component", nodeConstructors_comp },
     { "Arithmetic", nodeConstructors_arith },
     { "Vector", nodeConstructors_vector },
     { "Matrix", nodeConstructors_matrix },
+    { "Array", nodeConstructors_array },
     { nullptr, nullptr }
 };
 
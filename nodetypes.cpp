@@ -0,0 +1,69 @@
+#include "nodetypes.h"
+
+static constexpr NodePortDescriptor valueIn = { PortDirection::Static, "Value" };
+static constexpr NodePortDescriptor result = { PortDirection::Output, "Result" };
+static constexpr NodePortDescriptor input = { PortDirection::Input, "Input" };
+static constexpr NodePortDescriptor leftIn = { PortDirection::Input, "Left operand" };
+static constexpr NodePortDescriptor rightIn = { PortDirection::Input, "Right operand" };
+static constexpr NodePortDescriptor firstIn = { PortDirection::Input, "First component" };
+static constexpr NodePortDescriptor secondIn = { PortDirection::Input, "Second component" };
+static constexpr NodePortDescriptor thirdIn = { PortDirection::Input, "Third component" };
+static constexpr NodePortDescriptor fourthIn = { PortDirection::Input, "Fourth component" };
+
+#define CONSTANT_NODE(type, name) { NodeType::type, name, 0, 2, { valueIn, result } }
+#define OP1_NODE(type, name) { NodeType::type, name, 1, 2, { input, result } }
+#define OP2_NODE(type, name) { NodeType::type, name, 2, 3, { leftIn, rightIn, result } }
+
+constexpr NodeTypeDescriptor nodeTypeDescriptors[size_t(NodeType::NodeTypeCount)] = {
+    { NodeType::Invalid, "Invalid", 0, 0, {} },
+
+    CONSTANT_NODE(Float, "Float"),
+    CONSTANT_NODE(Vec2, "Vec2"),
+    CONSTANT_NODE(Vec3, "Vec3"),
+    CONSTANT_NODE(Vec4, "Vec4"),
+    CONSTANT_NODE(Mat3, "Mat3"),
+    CONSTANT_NODE(Mat4, "Mat4"),
+
+    OP1_NODE(Vec2Cast, "Cast to Vec2"),
+    OP1_NODE(Vec3Cast, "Cast to Vec3"),
+    OP1_NODE(Vec4Cast, "Cast to Vec4"),
+    OP1_NODE(Mat3Cast, "Cast to Mat3"),
+    OP1_NODE(Mat4Cast, "Cast to Mat4"),
+    { NodeType::Vec2Combine, "Combine into Vec2", 2, 3, { firstIn, secondIn, result } },
+    { NodeType::Vec3Combine, "Combine into Vec3", 3, 4, { firstIn, secondIn, thirdIn, result } },
+    { NodeType::Vec4Combine, "Combine into Vec4", 4, 5, { firstIn, secondIn, thirdIn, fourthIn, result } },
+    { NodeType::Swizzle, "Swizzle", 1, 3, { { PortDirection::Input, "Input vector" }, { PortDirection::Static, "Swizzle" }, result } },
+
+    OP2_NODE(Plus, "Add"),
+    OP2_NODE(Minus, "Subtract"),
+    OP2_NODE(Mul, "Multiply"),
+    OP2_NODE(Div, "Divide"),
+    OP1_NODE(Negate, "Negate"),
+
+    OP1_NODE(Length, "Length"),
+    OP2_NODE(Distance, "Distance"),
+    OP2_NODE(Dot, "Dot product"),
+    OP2_NODE(Cross, "Cross product"),
+    OP1_NODE(Normalize, "Normalize"),
+
+    OP1_NODE(Transpose, "Transpose"),
+    OP1_NODE(Inverse, "Inverse"),
+    OP1_NODE(Determinant, "Determinant"),
+
+    OP1_NODE(Sum, "Sum"),
+    OP1_NODE(Minimum, "Minimum"),
+    OP1_NODE(Maximum, "Maximum"),
+
+    { NodeType::BinaryFile, "Binary file", 0, 3, { { PortDirection::Static, "File" }, { PortDirection::Static, "Raw records" }, result } }
+};
+
+static constexpr bool descriptorsInTypeOrder()
+{
+    for (size_t i = 0; i < size_t(NodeType::NodeTypeCount); ++i) {
+        if (size_t(nodeTypeDescriptors[i].type) != i)
+            return false;
+    }
+    return true;
+}
+
+static_assert(descriptorsInTypeOrder(), "nodeTypeDescriptors must follow the order of NodeType");
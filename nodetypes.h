@@ -1,6 +1,8 @@
 #ifndef GRAPHSEM_H
 #define GRAPHSEM_H
 
+#include <cstddef>
+
 enum class NodeType
 {
     Invalid = 0,
@@ -36,7 +38,54 @@ enum class NodeType
 
     Transpose,
     Inverse,
-    Determinant
+    Determinant,
+
+    Sum,
+    Minimum,
+    Maximum,
+
+    BinaryFile,
+
+    NodeTypeCount
 };
 
+enum class PortDirection {
+    Input,
+    Output,
+    Static
+};
+
+static const size_t MAX_NODE_PORTS = 5;
+
+struct NodePortDescriptor
+{
+    PortDirection dir;
+    const char *text;
+};
+
+// What all nodes of a type have in common, so that nodes only store their
+// type and per-instance values. The ports of a new node follow the layout,
+// and Port::order is the index into it.
+struct NodeTypeDescriptor
+{
+    NodeType type;
+    const char *name;
+    size_t inputPortCount;
+    size_t portCount;
+    NodePortDescriptor ports[MAX_NODE_PORTS];
+
+    const char *portText(int order) const
+    {
+        return size_t(order) < portCount ? ports[order].text : "";
+    }
+};
+
+// indexed by NodeType
+extern const NodeTypeDescriptor nodeTypeDescriptors[size_t(NodeType::NodeTypeCount)];
+
+inline const NodeTypeDescriptor &nodeTypeDescriptor(NodeType type)
+{
+    return nodeTypeDescriptors[size_t(type)];
+}
+
 #endif
@@ -3,7 +3,8 @@
 
 #include <string>
 #include <variant>
-#include "glm/gtc/type_ptr.hpp"
+#include <cstdint>
+#include "valuearray.h"
 
 struct PortDataEmpty { };
 struct PortDataFloat { float v; };
@@ -13,6 +14,11 @@ struct PortDataVec4 { glm::vec4 v; };
 struct PortDataMat3 { glm::mat3 v; bool editAsRowMajor; };
 struct PortDataMat4 { glm::mat4 v; bool editAsRowMajor; };
 struct PortDataString { std::string v; };
+struct PortDataFloatArray { FloatArray v; };
+struct PortDataVec2Array { Vec2Array v; };
+struct PortDataVec3Array { Vec3Array v; };
+struct PortDataVec4Array { Vec4Array v; };
+struct PortDataMat4Array { Mat4Array v; };
 
 using PortDataVar = std::variant<
     PortDataEmpty,
@@ -22,16 +28,102 @@ using PortDataVar = std::variant<
     PortDataVec4,
     PortDataMat3,
     PortDataMat4,
-    PortDataString
+    PortDataString,
+    PortDataFloatArray,
+    PortDataVec2Array,
+    PortDataVec3Array,
+    PortDataVec4Array,
+    PortDataMat4Array
 >;
 
+// matches the order of the alternatives in PortDataVar
+enum class PortDataType {
+    Empty,
+    Float,
+    Vec2,
+    Vec3,
+    Vec4,
+    Mat3,
+    Mat4,
+    String,
+    FloatArray,
+    Vec2Array,
+    Vec3Array,
+    Vec4Array,
+    Mat4Array
+};
+
+inline PortDataType portDataType(const PortDataVar &d)
+{
+    return PortDataType(d.index());
+}
+
+constexpr bool isArrayType(PortDataType type)
+{
+    return type >= PortDataType::FloatArray;
+}
+
+// the type of the elements of an array type, other types are returned as is
+constexpr PortDataType elementType(PortDataType type)
+{
+    switch (type) {
+    case PortDataType::FloatArray:
+        return PortDataType::Float;
+    case PortDataType::Vec2Array:
+        return PortDataType::Vec2;
+    case PortDataType::Vec3Array:
+        return PortDataType::Vec3;
+    case PortDataType::Vec4Array:
+        return PortDataType::Vec4;
+    case PortDataType::Mat4Array:
+        return PortDataType::Mat4;
+    default:
+        return type;
+    }
+}
+
+// the array type with elements of type, Empty when there is none
+constexpr PortDataType arrayType(PortDataType type)
+{
+    switch (type) {
+    case PortDataType::Float:
+        return PortDataType::FloatArray;
+    case PortDataType::Vec2:
+        return PortDataType::Vec2Array;
+    case PortDataType::Vec3:
+        return PortDataType::Vec3Array;
+    case PortDataType::Vec4:
+        return PortDataType::Vec4Array;
+    case PortDataType::Mat4:
+        return PortDataType::Mat4Array;
+    default:
+        return PortDataType::Empty;
+    }
+}
+
+enum class PortDataError : uint8_t {
+    None,
+    NotEnoughArgs,
+    InvalidArgs
+};
+
 struct PortData
 {
     PortDataVar d = PortDataEmpty { };
-    std::string desc;
+    PortDataError error = PortDataError::None;
+
+    // interned message for error, null when there is none
+    const char *desc() const
+    {
+        static const char *messages[] = { nullptr, "Not enough arguments", "Invalid arguments" };
+        return messages[size_t(error)];
+    }
 
-    static PortData notEnoughArgsResult() { return PortData { PortDataEmpty { }, "Not enough arguments" }; }
-    static PortData invalidArgsResult() { return PortData { PortDataEmpty { }, "Invalid arguments" }; }
+    void setError(PortDataError e)
+    {
+        d = PortDataEmpty { };
+        error = e;
+    }
 };
 
 #endif
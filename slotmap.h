@@ -0,0 +1,163 @@
+#ifndef SLOTMAP_H
+#define SLOTMAP_H
+
+#include <vector>
+#include <memory_resource>
+#include <cstdint>
+#include <stdexcept>
+
+// Values stored contiguously, addressed by generational handles. A handle
+// is a positive int holding a slot index and the generation of the slot
+// when the value was inserted, so a handle to an erased value is detected
+// even after its slot got reused. Erasing moves the last value into the
+// hole, so iteration order is not stable, and inserting or erasing
+// invalidates references to values. All storage comes from the memory
+// resource given at construction, which values that take a
+// std::pmr::polymorphic_allocator get passed on as well. Copy assignment
+// keeps the resource of the destination.
+template<typename T>
+struct SlotMap
+{
+    using Handle = int;
+
+    // 1M live values, and 2048 reuses of a slot before a stale handle
+    // could alias a live one
+    static const int INDEX_BITS = 20;
+    static const uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+    static const uint32_t GENERATION_MASK = (1u << (31 - INDEX_BITS)) - 1;
+
+    // never a valid handle
+    static const Handle NULL_HANDLE = 0;
+
+    explicit SlotMap(std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+        : values(memory), handles(memory), slots(memory)
+    {
+    }
+
+    Handle insert()
+    {
+        uint32_t index;
+        if (freeHead != NO_SLOT) {
+            // first in, first out, which spreads reuse over all free slots
+            index = freeHead;
+            freeHead = slots[index].nextFree;
+            if (freeHead == NO_SLOT)
+                freeTail = NO_SLOT;
+        } else {
+            // index + 1 has to fit, 0 is the null handle
+            if (slots.size() >= INDEX_MASK)
+                throw std::length_error("SlotMap full");
+            index = uint32_t(slots.size());
+            slots.push_back(Slot());
+        }
+
+        Slot &slot(slots[index]);
+        slot.denseIndex = uint32_t(values.size());
+        const Handle handle = Handle((slot.generation << INDEX_BITS) | (index + 1));
+        values.emplace_back();
+        handles.push_back(handle);
+        return handle;
+    }
+
+    void erase(Handle handle)
+    {
+        const uint32_t index = slotIndex(handle);
+        Slot &slot(slots[index]);
+        const uint32_t denseIndex = slot.denseIndex;
+
+        if (denseIndex != values.size() - 1) {
+            values[denseIndex] = std::move(values.back());
+            handles[denseIndex] = handles.back();
+            slots[slotIndex(handles[denseIndex])].denseIndex = denseIndex;
+        }
+        values.pop_back();
+        handles.pop_back();
+
+        slot.generation = (slot.generation + 1) & GENERATION_MASK;
+        slot.denseIndex = NO_SLOT;
+        slot.nextFree = NO_SLOT;
+        if (freeTail != NO_SLOT)
+            slots[freeTail].nextFree = index;
+        else
+            freeHead = index;
+        freeTail = index;
+    }
+
+    bool contains(Handle handle) const
+    {
+        const uint32_t index = uint32_t(handle & INDEX_MASK) - 1;
+        return handle > 0 && index < slots.size()
+            && slots[index].denseIndex != NO_SLOT
+            && handles[slots[index].denseIndex] == handle;
+    }
+
+    // nullptr for stale or null handles
+    T *find(Handle handle) { return contains(handle) ? &values[slots[slotIndex(handle)].denseIndex] : nullptr; }
+    const T *find(Handle handle) const { return contains(handle) ? &values[slots[slotIndex(handle)].denseIndex] : nullptr; }
+
+    // throws std::out_of_range for stale or null handles
+    T &at(Handle handle)
+    {
+        if (!contains(handle))
+            throw std::out_of_range("SlotMap: stale handle");
+        return values[slots[slotIndex(handle)].denseIndex];
+    }
+
+    const T &at(Handle handle) const
+    {
+        if (!contains(handle))
+            throw std::out_of_range("SlotMap: stale handle");
+        return values[slots[slotIndex(handle)].denseIndex];
+    }
+
+    size_t size() const { return values.size(); }
+    bool empty() const { return values.empty(); }
+
+    // Erases everything and frees the storage. Handles from before are
+    // reused, so they must not be held on to.
+    void clear()
+    {
+        std::pmr::memory_resource *memory = values.get_allocator().resource();
+        values = std::pmr::vector<T>(memory);
+        handles = std::pmr::vector<Handle>(memory);
+        slots = std::pmr::vector<Slot>(memory);
+        freeHead = NO_SLOT;
+        freeTail = NO_SLOT;
+    }
+
+    void reserve(size_t count)
+    {
+        values.reserve(count);
+        handles.reserve(count);
+        slots.reserve(count);
+    }
+
+    // iterates over the values, densely packed
+    typename std::pmr::vector<T>::iterator begin() { return values.begin(); }
+    typename std::pmr::vector<T>::iterator end() { return values.end(); }
+    typename std::pmr::vector<T>::const_iterator begin() const { return values.cbegin(); }
+    typename std::pmr::vector<T>::const_iterator end() const { return values.cend(); }
+
+    // handle of the value at a position in the iteration order
+    Handle handleAt(size_t denseIndex) const { return handles[denseIndex]; }
+
+private:
+    static const uint32_t NO_SLOT = UINT32_MAX;
+
+    struct Slot
+    {
+        uint32_t denseIndex = NO_SLOT;
+        uint32_t generation = 0;
+        uint32_t nextFree = NO_SLOT;
+    };
+
+    static uint32_t slotIndex(Handle handle) { return uint32_t(handle & INDEX_MASK) - 1; }
+
+    std::pmr::vector<T> values;
+    std::pmr::vector<Handle> handles; // parallel to values
+    std::pmr::vector<Slot> slots;
+    uint32_t freeHead = NO_SLOT;
+    uint32_t freeTail = NO_SLOT;
+};
+
+#endif
@@ -0,0 +1,413 @@
+#include "sweep.h"
+#include "graph.h"
+#include "grapheval.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <chrono>
+#include <charconv>
+#include <cstring>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace Sweep {
+
+// number of floats in a value
+static inline int floatCount(PortDataType type)
+{
+    static const int counts[] = { 0, 1, 2, 3, 4, 9, 16, 0, 0, 0, 0, 0, 0 }; // arrays are not swept
+    return counts[size_t(type)];
+}
+
+static inline PortDataType outputType(const Node &n)
+{
+    for (const Port &port : n.ports) {
+        if (port.dir == PortDirection::Output)
+            return port.type;
+    }
+    return PortDataType::Empty;
+}
+
+static inline bool isConstantNode(const Node &n)
+{
+    return n.type >= NodeType::Float && n.type <= NodeType::Mat4;
+}
+
+static std::string componentName(Id id, PortDataType type, int component)
+{
+    std::string name = 'n' + std::to_string(id);
+    switch (type) {
+    case PortDataType::Vec2:
+    case PortDataType::Vec3:
+    case PortDataType::Vec4:
+        name += '.';
+        name += "xyzw"[component];
+        break;
+    case PortDataType::Mat3:
+        name += '[' + std::to_string(component / 3) + "][" + std::to_string(component % 3) + ']';
+        break;
+    case PortDataType::Mat4:
+        name += '[' + std::to_string(component / 4) + "][" + std::to_string(component % 4) + ']';
+        break;
+    default:
+        break;
+    }
+    return name;
+}
+
+size_t sampleCount(const Spec &spec)
+{
+    size_t count = std::max<size_t>(1, spec.samplesPerPoint);
+    bool column = false;
+    for (const Parameter &p : spec.parameters) {
+        if (p.kind == Parameter::Grid)
+            count *= std::max<size_t>(1, p.steps);
+        column = column || p.kind == Parameter::Column;
+    }
+    return column ? count * spec.table.size() : count;
+}
+
+std::vector<std::string> columnNames(const Graph &g, const Spec &spec, const Options &options)
+{
+    auto columnId = [&options](Id id) {
+        auto renamed = options.columnIds.find(id);
+        return renamed != options.columnIds.end() ? renamed->second : id;
+    };
+    std::vector<std::string> names;
+    for (const Parameter &p : spec.parameters)
+        names.push_back(componentName(columnId(p.node), outputType(g.node(p.node)), p.component));
+    for (Id id : spec.outputs) {
+        const PortDataType type = outputType(g.node(id));
+        for (int c = 0; c < floatCount(type); ++c)
+            names.push_back(componentName(columnId(id), type, c));
+    }
+    return names;
+}
+
+static inline uint64_t mix(uint64_t x)
+{
+    // splitmix64
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+// Maps a sample index to parameter values. Everything is a function of
+// the index, so batches can be generated in any order on any thread.
+struct Sampler
+{
+    struct Axis
+    {
+        size_t stride; // samples per step
+        size_t steps;
+    };
+
+    const Spec *spec;
+    std::vector<Axis> axes; // parallel to spec->parameters, for Grid
+    size_t rowStride = 1;
+
+    explicit Sampler(const Spec &s) : spec(&s), axes(s.parameters.size())
+    {
+        size_t stride = std::max<size_t>(1, s.samplesPerPoint);
+        for (size_t i = s.parameters.size(); i-- > 0; ) {
+            const Parameter &p(s.parameters[i]);
+            if (p.kind == Parameter::Grid) {
+                axes[i] = { stride, std::max<size_t>(1, p.steps) };
+                stride *= axes[i].steps;
+            }
+        }
+        rowStride = stride;
+    }
+
+    float value(size_t p, size_t sample) const
+    {
+        const Parameter &param(spec->parameters[p]);
+        switch (param.kind) {
+        case Parameter::Grid: {
+            const size_t step = sample / axes[p].stride % axes[p].steps;
+            if (step + 1 == axes[p].steps)
+                return step ? param.to : param.from;
+            return param.from + (param.to - param.from) * (float(step) / float(axes[p].steps - 1));
+        }
+        case Parameter::Random: {
+            const uint64_t bits = mix(spec->seed ^ mix(uint64_t(sample) * spec->parameters.size() + p));
+            const float v = param.from + (param.to - param.from) * (float(bits >> 40) * (1.0f / 16777216.0f));
+            // rounding may land on to itself
+            return v < param.to || param.to <= param.from ? v : std::nextafter(param.to, param.from);
+        }
+        case Parameter::Column:
+            return spec->table[sample / rowStride][param.column];
+        }
+        return 0.0f;
+    }
+};
+
+// Samples [first, first + count), evaluated in batches spread over the
+// pool; for binary output the values are stored column by column, for CSV
+// each batch formats its rows
+struct Block
+{
+    size_t first = 0;
+    size_t count = 0;
+    std::vector<float> columns;
+    std::vector<std::string> rows; // per batch
+};
+
+struct Job
+{
+    const GraphEval::Plan *plan;
+    const GraphEval::Batch *batch;
+    const Sampler *sampler;
+    const std::vector<size_t> *parameterInputs; // index into batch->inputs per parameter
+    bool csv;
+    Block *block;
+};
+
+static void runBatches(void *context, size_t begin, size_t end)
+{
+    Job &job(*static_cast<Job *>(context));
+    const GraphEval::Batch &batch(*job.batch);
+    const std::vector<Parameter> &parameters(job.sampler->spec->parameters);
+    const size_t laneCount = batch.laneCount;
+    Block &block(*job.block);
+
+    static thread_local std::vector<char, AlignedAllocator<char>> laneMemory;
+    static thread_local std::vector<float> parameterValues;
+    if (laneMemory.size() < batch.laneMemorySize)
+        laneMemory.resize(batch.laneMemorySize);
+    parameterValues.resize(parameters.size() * laneCount);
+    char *lanes = laneMemory.data();
+
+    for (size_t b = begin; b < end; ++b) {
+        const size_t row = b * laneCount; // within the block
+        const size_t first = block.first + row;
+        const size_t count = std::min(laneCount, block.count - row);
+
+        for (size_t p = 0; p < parameters.size(); ++p) {
+            for (size_t lane = 0; lane < count; ++lane)
+                parameterValues[p * laneCount + lane] = job.sampler->value(p, first + lane);
+        }
+
+        // the other components of a varied constant keep their value
+        for (const GraphEval::Batch::Input &input : batch.inputs) {
+            if (!input.current)
+                continue;
+            const size_t size = GraphEval::valueSize(input.type);
+            for (size_t lane = 0; lane < count; ++lane)
+                memcpy(lanes + input.offset + lane * size, input.current, size);
+        }
+        for (size_t p = 0; p < parameters.size(); ++p) {
+            const GraphEval::Batch::Input &input(batch.inputs[(*job.parameterInputs)[p]]);
+            if (!input.current)
+                continue;
+            const size_t size = GraphEval::valueSize(input.type);
+            float *v = reinterpret_cast<float *>(lanes + input.offset) + parameters[p].component;
+            for (size_t lane = 0; lane < count; ++lane)
+                v[lane * size / sizeof(float)] = parameterValues[p * laneCount + lane];
+        }
+
+        GraphEval::runBatch(*job.plan, batch, lanes, count);
+
+        // (lane, component) -> float of output
+        auto outputValue = [lanes](const GraphEval::Batch::Value &v, size_t lane, int component) {
+            const float *f = static_cast<const float *>(v.fixed);
+            if (!f)
+                f = reinterpret_cast<const float *>(lanes + v.offset + lane * GraphEval::valueSize(v.type));
+            return f[component];
+        };
+
+        if (job.csv) {
+            std::string &text(block.rows[b]);
+            text.clear();
+            char s[32];
+            for (size_t lane = 0; lane < count; ++lane) {
+                size_t column = 0;
+                auto append = [&text, &s, &column](float f) {
+                    if (column++)
+                        text += ',';
+                    text.append(s, std::to_chars(s, s + sizeof(s), f).ptr);
+                };
+                for (size_t p = 0; p < parameters.size(); ++p)
+                    append(parameterValues[p * laneCount + lane]);
+                for (const GraphEval::Batch::Value &v : batch.outputs) {
+                    for (int c = 0; c < floatCount(v.type); ++c)
+                        append(outputValue(v, lane, c));
+                }
+                text += '\n';
+            }
+        } else {
+            float *column = block.columns.data() + row;
+            for (size_t p = 0; p < parameters.size(); ++p, column += block.count)
+                memcpy(column, parameterValues.data() + p * laneCount, count * sizeof(float));
+            for (const GraphEval::Batch::Value &v : batch.outputs) {
+                for (int c = 0; c < floatCount(v.type); ++c, column += block.count) {
+                    for (size_t lane = 0; lane < count; ++lane)
+                        column[lane] = outputValue(v, lane, c);
+                }
+            }
+        }
+    }
+}
+
+static void writeUint32(std::ostream &out, uint32_t v)
+{
+    out.write(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+static void writeBlock(std::ostream &out, const Block &block, size_t columnCount, bool csv)
+{
+    if (csv) {
+        for (const std::string &rows : block.rows)
+            out.write(rows.data(), std::streamsize(rows.size()));
+    } else {
+        writeUint32(out, uint32_t(block.count));
+        out.write(reinterpret_cast<const char *>(block.columns.data()),
+                  std::streamsize(columnCount * block.count * sizeof(float)));
+    }
+}
+
+Result run(Graph &g, const Spec &spec, const Options &options, std::ostream &out)
+{
+    Result result;
+    const auto start = std::chrono::steady_clock::now();
+
+    // the varied constants, each once
+    std::vector<Id> varied;
+    std::vector<size_t> parameterInputs;
+    for (const Parameter &p : spec.parameters) {
+        const Node *node = g.nodes.find(p.node);
+        if (!node || !isConstantNode(*node) || p.component < 0 || p.component >= floatCount(outputType(*node))) {
+            result.error = "parameter is not a constant or has no such component";
+            result.failedNode = p.node;
+            return result;
+        }
+        if (p.kind == Parameter::Column) {
+            for (const std::vector<float> &row : spec.table) {
+                if (p.column >= row.size()) {
+                    result.error = "sample table row without column " + std::to_string(p.column);
+                    return result;
+                }
+            }
+            if (spec.table.empty()) {
+                result.error = "no sample table";
+                return result;
+            }
+        }
+        auto input = std::find(varied.begin(), varied.end(), p.node);
+        parameterInputs.push_back(size_t(input - varied.begin()));
+        if (input == varied.end())
+            varied.push_back(p.node);
+    }
+    for (Id id : spec.outputs) {
+        if (!g.nodes.contains(id)) {
+            result.error = "no such output node";
+            result.failedNode = id;
+            return result;
+        }
+    }
+
+    GraphEval::Plan plan;
+    GraphEval::compile(g, plan, spec.outputs, options.fuseChains ? GraphEval::ChainMode::Fused : GraphEval::ChainMode::Exact);
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Full);
+    const size_t laneCount = std::max<size_t>(1, options.laneCount);
+    GraphEval::Batch batch;
+    if (!GraphEval::compileBatch(plan, varied, spec.outputs, laneCount, batch)) {
+        result.error = "cannot evaluate the outputs";
+        result.failedNode = batch.failedNode;
+        return result;
+    }
+
+    const std::vector<std::string> names = columnNames(g, spec, options);
+    const size_t columnCount = names.size();
+    const bool csv = options.format == Format::Csv;
+    if (csv) {
+        for (size_t i = 0; i < columnCount; ++i)
+            out << (i ? "," : "") << names[i];
+        out << '\n';
+    } else {
+        out.write("NSWEEP01", 8);
+        writeUint32(out, uint32_t(columnCount));
+        for (const std::string &name : names) {
+            writeUint32(out, uint32_t(name.size()));
+            out.write(name.data(), std::streamsize(name.size()));
+        }
+    }
+
+    const Sampler sampler(spec);
+    const size_t total = sampleCount(spec);
+    // whole batches per block
+    const size_t blockSize = std::max<size_t>(1, options.blockSize / laneCount) * laneCount;
+    ThreadPool pool(options.threadCount ? int(options.threadCount) - 1 : -1);
+
+    // one block is evaluated while the other is written
+    Block blocks[2];
+    std::thread writer;
+    for (size_t first = 0, n = 0; first < total; first += blockSize, ++n) {
+        Block &block(blocks[n % 2]);
+        block.first = first;
+        block.count = std::min(blockSize, total - first);
+        const size_t batchCount = (block.count + laneCount - 1) / laneCount;
+        if (csv)
+            block.rows.resize(batchCount);
+        else
+            block.columns.resize(columnCount * block.count);
+
+        Job job { &plan, &batch, &sampler, &parameterInputs, csv, &block };
+        pool.parallelFor(batchCount, 1, runBatches, &job);
+
+        if (writer.joinable())
+            writer.join();
+        writer = std::thread([&out, &block, columnCount, csv] { writeBlock(out, block, columnCount, csv); });
+    }
+    if (writer.joinable())
+        writer.join();
+    if (!csv)
+        writeUint32(out, 0);
+    out.flush();
+
+    result.ok = bool(out);
+    if (!result.ok)
+        result.error = "write error";
+    result.sampleCount = total;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+bool loadTable(const std::string &fileName, std::vector<std::vector<float>> *table, std::string *error)
+{
+    std::ifstream f(fileName);
+    if (!f) {
+        if (error)
+            *error = "cannot open " + fileName;
+        return false;
+    }
+    table->clear();
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(f, line)) {
+        ++lineNumber;
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::istringstream ls(line);
+        std::vector<float> row;
+        std::string field;
+        while (ls >> field) {
+            char *end = nullptr;
+            const float v = strtof(field.c_str(), &end);
+            if (*end) {
+                if (lineNumber == 1 && row.empty())
+                    break; // header
+                if (error)
+                    *error = fileName + ':' + std::to_string(lineNumber) + ": not a number: " + field;
+                return false;
+            }
+            row.push_back(v);
+        }
+        if (!row.empty())
+            table->push_back(std::move(row));
+    }
+    return true;
+}
+
+} // namespace
@@ -0,0 +1,103 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <ostream>
+#include <cstdint>
+
+struct Graph;
+using Id = int;
+
+// Parameter sweeps: evaluating a graph for many samples of some of its
+// constants and collecting the values of some nodes for each sample. The
+// samples are spread over all cores in batches, see GraphEval::Batch, and
+// the results are streamed out as they are computed.
+namespace Sweep {
+
+// One component of a constant node and the values it takes.
+struct Parameter
+{
+    enum Kind {
+        Grid,   // steps evenly spaced values from from to to, both included
+        Random, // uniformly distributed in [from, to)
+        Column  // the values of a column of Spec::table
+    };
+
+    Id node = 0;
+    int component = 0; // float index within the value, column-major for matrices
+    Kind kind = Grid;
+    float from = 0.0f;
+    float to = 1.0f;
+    size_t steps = 2;
+    size_t column = 0;
+};
+
+// The samples are every combination of a row of table (if there are
+// Column parameters) and a point of the grid formed by the Grid
+// parameters, the last one changing fastest, each repeated
+// samplesPerPoint times with new values for the Random parameters.
+struct Spec
+{
+    std::vector<Parameter> parameters;
+    std::vector<Id> outputs;
+    std::vector<std::vector<float>> table;
+    size_t samplesPerPoint = 1;
+    uint64_t seed = 0; // for Random parameters; results do not depend on the thread count
+};
+
+// The output is one row per sample: the values of the parameters, then
+// all components of the outputs. The binary format is columnar, in
+// blocks of rows, with everything in the byte order of the machine:
+//
+//     "NSWEEP01"
+//     uint32 column count, then per column: uint32 name length, name
+//     per block: uint32 row count, then per column: row count float32
+//     uint32 0
+enum class Format {
+    Csv,
+    Binary
+};
+
+struct Options
+{
+    Format format = Format::Csv;
+    size_t threadCount = 0; // 0 = all hardware threads
+    size_t laneCount = 256; // samples per batch
+    size_t blockSize = 65536; // samples per block, evaluated while the previous one is written
+    // matrix chains multiplied in the cheapest order, the same results up
+    // to float rounding; see GraphEval::ChainMode
+    bool fuseChains = false;
+    // ids to name the columns by instead of the node ids, like the ids in
+    // the graph file the graph was read from
+    std::unordered_map<Id, Id> columnIds;
+};
+
+struct Result
+{
+    bool ok = false;
+    std::string error;
+    Id failedNode = 0;
+    size_t sampleCount = 0;
+    double seconds = 0.0;
+};
+
+size_t sampleCount(const Spec &spec);
+
+// "n<id>" for Float values, "n<id>.x" for vectors, "n<id>[col][row]" for matrices
+std::vector<std::string> columnNames(const Graph &g, const Spec &spec, const Options &options = Options());
+
+// Runs the sweep on g, which is compiled for the outputs and evaluated
+// once for what does not depend on the parameters. The constants of g are
+// not modified. Not to be called while something else evaluates g.
+Result run(Graph &g, const Spec &spec, const Options &options, std::ostream &out);
+
+// Reads a table of samples for Column parameters: comma or whitespace
+// separated numbers, one row per line. A first line that does not start
+// with a number is taken as a header and skipped.
+bool loadTable(const std::string &fileName, std::vector<std::vector<float>> *table, std::string *error);
+
+} // namespace
+
+#endif
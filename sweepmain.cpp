@@ -0,0 +1,201 @@
+// nodesweep: runs a parameter sweep (see sweep.h) on a graph saved by the
+// editor and writes the results to a CSV or binary file.
+
+#include "sweep.h"
+#include "graph.h"
+#include "graphfile.h"
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+
+static const char *const USAGE =
+    "usage: nodesweep <graph file> [options]\n"
+    "\n"
+    "Node ids are those in the graph file, components are x, y, z, w or a\n"
+    "float index (column-major for matrices).\n"
+    "\n"
+    "  --output <id>                        collect the value of a node, repeatable\n"
+    "  --grid <id>[.<comp>]=<from>:<to>:<steps>\n"
+    "                                       evenly spaced values, from and to included\n"
+    "  --random <id>[.<comp>]=<from>:<to>   uniformly distributed values\n"
+    "  --column <id>[.<comp>]=<index>       the values in a column of the table\n"
+    "  --table <file>                       samples for --column, one row per line\n"
+    "  --per-point <n>                      random samples per grid point and table row\n"
+    "  --seed <n>                           for --random\n"
+    "  -o <file>                            output file, standard output by default\n"
+    "  --format csv|binary                  binary by default for files ending in .bin\n"
+    "  --threads <n>                        all cores by default\n"
+    "  --lanes <n>                          samples per batch\n"
+    "  --chains exact|fused                 fused: faster matrix chains, not bit for bit\n"
+    "                                       what the editor shows; exact by default\n";
+
+static bool parseComponent(const char *s, int *component)
+{
+    if (!*s) {
+        *component = 0;
+        return true;
+    }
+    if (!s[1] && strchr("xyzw", s[0])) {
+        *component = int(strchr("xyzw", s[0]) - "xyzw");
+        return true;
+    }
+    char *end = nullptr;
+    *component = int(strtol(s, &end, 10));
+    return !*end;
+}
+
+// <id>[.<comp>]=<values>, returns values
+static const char *parseTarget(const char *s, Id *id, int *component)
+{
+    const char *eq = strchr(s, '=');
+    if (!eq)
+        return nullptr;
+    std::string target(s, eq);
+    const size_t dot = target.find('.');
+    char *end = nullptr;
+    *id = Id(strtol(target.c_str(), &end, 10));
+    if (dot == std::string::npos ? *end != 0 : size_t(end - target.c_str()) != dot)
+        return nullptr;
+    if (!parseComponent(dot == std::string::npos ? "" : target.c_str() + dot + 1, component))
+        return nullptr;
+    return eq + 1;
+}
+
+static bool parseParameter(const char *option, const char *arg, Sweep::Parameter *p)
+{
+    const char *values = parseTarget(arg, &p->node, &p->component);
+    if (!values)
+        return false;
+    if (!strcmp(option, "--grid")) {
+        p->kind = Sweep::Parameter::Grid;
+        return sscanf(values, "%f:%f:%zu", &p->from, &p->to, &p->steps) == 3 && p->steps > 0;
+    }
+    if (!strcmp(option, "--random")) {
+        p->kind = Sweep::Parameter::Random;
+        return sscanf(values, "%f:%f", &p->from, &p->to) == 2;
+    }
+    p->kind = Sweep::Parameter::Column;
+    return sscanf(values, "%zu", &p->column) == 1;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || !strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")) {
+        fputs(USAGE, argc < 2 ? stderr : stdout);
+        return argc < 2 ? 2 : 0;
+    }
+
+    Sweep::Spec spec;
+    Sweep::Options options;
+    std::vector<Id> outputs; // file ids
+    std::string tableFileName;
+    std::string outFileName;
+    const char *format = nullptr;
+
+    for (int i = 2; i < argc; ++i) {
+        const char *option = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "%s needs an argument\n%s", option, USAGE);
+            return 2;
+        }
+        const char *arg = argv[++i];
+        bool ok = true;
+        if (!strcmp(option, "--output")) {
+            outputs.push_back(Id(atoi(arg)));
+        } else if (!strcmp(option, "--grid") || !strcmp(option, "--random") || !strcmp(option, "--column")) {
+            Sweep::Parameter p;
+            ok = parseParameter(option, arg, &p);
+            spec.parameters.push_back(p);
+        } else if (!strcmp(option, "--table")) {
+            tableFileName = arg;
+        } else if (!strcmp(option, "--per-point")) {
+            ok = sscanf(arg, "%zu", &spec.samplesPerPoint) == 1;
+        } else if (!strcmp(option, "--seed")) {
+            ok = sscanf(arg, "%llu", reinterpret_cast<unsigned long long *>(&spec.seed)) == 1;
+        } else if (!strcmp(option, "-o")) {
+            outFileName = arg;
+        } else if (!strcmp(option, "--format")) {
+            format = arg;
+            ok = !strcmp(arg, "csv") || !strcmp(arg, "binary");
+        } else if (!strcmp(option, "--threads")) {
+            ok = sscanf(arg, "%zu", &options.threadCount) == 1;
+        } else if (!strcmp(option, "--lanes")) {
+            ok = sscanf(arg, "%zu", &options.laneCount) == 1 && options.laneCount > 0;
+        } else if (!strcmp(option, "--chains")) {
+            ok = !strcmp(arg, "exact") || !strcmp(arg, "fused");
+            options.fuseChains = !strcmp(arg, "fused");
+        } else {
+            fprintf(stderr, "unknown option %s\n%s", option, USAGE);
+            return 2;
+        }
+        if (!ok) {
+            fprintf(stderr, "invalid argument for %s: %s\n", option, arg);
+            return 2;
+        }
+    }
+
+    Graph g;
+    std::unordered_map<Id, Id> ids;
+    std::string error;
+    if (!GraphFile::load(g, argv[1], &ids, &error)) {
+        fprintf(stderr, "%s: %s\n", argv[1], error.c_str());
+        return 1;
+    }
+    if (!tableFileName.empty() && !Sweep::loadTable(tableFileName, &spec.table, &error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    // from file ids to the ids of g, and back for the column names
+    auto graphId = [&ids](Id fileId) {
+        auto id = ids.find(fileId);
+        return id != ids.end() ? id->second : 0;
+    };
+    for (Sweep::Parameter &p : spec.parameters) {
+        const Id fileId = p.node;
+        if (!(p.node = graphId(fileId))) {
+            fprintf(stderr, "no node %d in %s\n", fileId, argv[1]);
+            return 1;
+        }
+    }
+    for (Id id : outputs) {
+        if (!graphId(id)) {
+            fprintf(stderr, "no node %d in %s\n", id, argv[1]);
+            return 1;
+        }
+        spec.outputs.push_back(graphId(id));
+    }
+    for (const auto &id : ids)
+        options.columnIds[id.second] = id.first;
+
+    const bool toFile = !outFileName.empty();
+    if (format)
+        options.format = !strcmp(format, "csv") ? Sweep::Format::Csv : Sweep::Format::Binary;
+    else if (toFile && outFileName.size() > 4 && !outFileName.compare(outFileName.size() - 4, 4, ".bin"))
+        options.format = Sweep::Format::Binary;
+
+    std::ofstream file;
+    if (toFile) {
+        file.open(outFileName, std::ios::binary);
+        if (!file) {
+            fprintf(stderr, "cannot open %s\n", outFileName.c_str());
+            return 1;
+        }
+    }
+
+    const Sweep::Result result = Sweep::run(g, spec, options, toFile ? file : std::cout);
+    if (!result.ok) {
+        auto fileId = options.columnIds.find(result.failedNode);
+        if (fileId != options.columnIds.end())
+            fprintf(stderr, "node %d: %s\n", fileId->second, result.error.c_str());
+        else
+            fprintf(stderr, "%s\n", result.error.c_str());
+        return 1;
+    }
+
+    // the headline number
+    fprintf(stderr, "%zu samples in %.3f s, %.0f samples/s\n", result.sampleCount, result.seconds,
+            result.seconds > 0.0 ? double(result.sampleCount) / result.seconds : 0.0);
+    return 0;
+}
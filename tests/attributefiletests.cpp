@@ -0,0 +1,213 @@
+// AttributeFile and the BinaryFile node: files of every layout read as
+// the arrays they hold, in memory and streamed, and bad files refused.
+
+#include "testing.h"
+#include "testgraphs.h"
+#include "attributefile.h"
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+using namespace TestGraphs;
+using namespace NodeConstructors;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Header
+{
+    char magic[8] = { 'N', 'O', 'D', 'E', 'A', 'T', 'T', 'R' };
+    uint32_t components = 3;
+    uint32_t layout = 0;
+    uint64_t count = 0;
+    uint64_t stride = 0;
+    uint64_t offset = sizeof(Header);
+};
+
+// a directory of its own, removed with everything in it
+struct TempDir
+{
+    fs::path path;
+
+    TempDir()
+    {
+        path = fs::temp_directory_path() / ("nodetests_attributefile_" + std::to_string(std::random_device()()));
+        fs::create_directories(path);
+    }
+    ~TempDir()
+    {
+        std::error_code ec;
+        fs::remove_all(path, ec);
+    }
+
+    std::string write(const char *name, const void *bytes, size_t size) const
+    {
+        const fs::path file = path / name;
+        std::ofstream(file, std::ios::binary).write(static_cast<const char *>(bytes), std::streamsize(size));
+        return file.string();
+    }
+};
+
+} // namespace
+
+// the records of a, one after the other
+static std::vector<float> interleaved(const std::vector<glm::vec3> &a)
+{
+    std::vector<float> floats;
+    for (const glm::vec3 &v : a)
+        floats.insert(floats.end(), { v.x, v.y, v.z });
+    return floats;
+}
+
+// header, then bytes as they are
+static std::vector<char> withHeader(const Header &h, const void *bytes, size_t size)
+{
+    std::vector<char> file(h.offset + size);
+    memcpy(file.data(), &h, sizeof(h));
+    memcpy(file.data() + h.offset, bytes, size);
+    return file;
+}
+
+static Id binaryFile(Graph &g, const std::string &fileName, const char *recordType = "vec3")
+{
+    const Id n = constructBinaryFileNode(&g);
+    staticPort(g, n, 0).data.d = PortDataString { fileName };
+    staticPort(g, n, 1).data.d = PortDataString { recordType };
+    g.staticPortChanged(g.node(n));
+    return n;
+}
+
+TEST(attribute_files_bounded_by_their_size)
+{
+    TempDir dir;
+    std::string error;
+    CHECK(!AttributeFile::open((dir.path / "missing").string(), "vec3", &error));
+    CHECK(error.find("cannot open") != std::string::npos);
+
+    // raw records: a trailing partial record is not one
+    const float raw[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    const std::string rawName = dir.write("raw", raw, sizeof(raw));
+    auto file = AttributeFile::open(rawName, "vec3");
+    CHECK(file && file->type == PortDataType::Vec3Array && file->count == 2 && !file->viewable());
+    file = AttributeFile::open(rawName, "vec4");
+    CHECK(file && file->type == PortDataType::Vec4Array && file->count == 2);
+    file = AttributeFile::open(rawName, "mat4");
+    CHECK(file && file->count == 0);
+    CHECK(!AttributeFile::open(rawName, "vec5", &error));
+    CHECK(error.find("unknown record type") != std::string::npos);
+
+    Header h;
+    h.count = 3;
+    std::vector<char> bytes = withHeader(h, raw, sizeof(raw));
+    CHECK(!AttributeFile::open(dir.write("short", bytes.data(), bytes.size()), "", &error));
+    CHECK(error.find("not enough records") != std::string::npos);
+    h.count = 2;
+    bytes = withHeader(h, raw, sizeof(raw));
+    file = AttributeFile::open(dir.write("exact", bytes.data(), bytes.size()), "float");
+    CHECK(file && file->type == PortDataType::Vec3Array && file->count == 2);
+    h.count = uint64_t(1) << 62; // floats would overflow
+    bytes = withHeader(h, raw, sizeof(raw));
+    CHECK(!AttributeFile::open(dir.write("huge", bytes.data(), bytes.size()), "", &error));
+    CHECK(error.find("not enough records") != std::string::npos);
+    h.count = 2;
+    h.components = 5;
+    bytes = withHeader(h, raw, sizeof(raw));
+    CHECK(!AttributeFile::open(dir.write("components", bytes.data(), bytes.size()), "", &error));
+    CHECK(error.find("invalid header") != std::string::npos);
+    h.components = 3;
+    h.layout = 1;
+    h.stride = 1; // runs overlap
+    bytes = withHeader(h, raw, sizeof(raw));
+    CHECK(!AttributeFile::open(dir.write("stride", bytes.data(), bytes.size()), "", &error));
+    CHECK(error.find("invalid header") != std::string::npos);
+
+    // read() stops at the last record
+    file = AttributeFile::open(rawName, "vec3");
+    Vec3Array a;
+    file->read(1, 10, &a);
+    CHECK(a.count == 1 && a.at(0) == glm::vec3(4, 5, 6));
+    file->read(5, 10, &a);
+    CHECK(a.count == 0);
+}
+
+TEST(binary_files_evaluated_like_arrays)
+{
+    const size_t count = 5000;
+    std::mt19937 rng(25);
+    std::uniform_real_distribution<float> d(-4.0f, 4.0f);
+    std::vector<glm::vec3> records(count);
+    Vec3Array inMemory;
+    inMemory.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        records[i] = glm::vec3(d(rng), d(rng), d(rng));
+        inMemory.set(i, records[i]);
+    }
+
+    // raw and headered records one after the other are copied, planar
+    // runs padded like a ValueArray's are used in place
+    TempDir dir;
+    const std::vector<float> floats = interleaved(records);
+    const std::string raw = dir.write("raw", floats.data(), floats.size() * sizeof(float));
+    Header h;
+    h.count = count;
+    std::vector<char> bytes = withHeader(h, floats.data(), floats.size() * sizeof(float));
+    const std::string headered = dir.write("records", bytes.data(), bytes.size());
+    h.layout = 1;
+    h.stride = (count + FloatArray::PADDING - 1) / FloatArray::PADDING * FloatArray::PADDING;
+    h.offset = 64;
+    std::vector<float> planar(3 * h.stride);
+    for (int c = 0; c < 3; ++c)
+        std::copy_n(inMemory.component(c), count, planar.data() + c * h.stride);
+    bytes = withHeader(h, planar.data(), planar.size() * sizeof(float));
+    const std::string planarName = dir.write("planar", bytes.data(), bytes.size());
+    CHECK(AttributeFile::open(planarName, "")->viewable());
+
+    Graph g;
+    const Id arrayNode = constructVec3Node(&g);
+    setValue(g, arrayNode, PortDataVec3Array { inMemory });
+    const Id c = constant(g, glm::vec3(0.5f, -1.0f, 2.0f));
+    const Id scale = constant(g, 0.25f);
+    // the same operations over the array and each file
+    std::vector<std::vector<Id>> outputs;
+    for (Id source : { arrayNode, binaryFile(g, raw), binaryFile(g, headered), binaryFile(g, planarName) }) {
+        const Id normalized = op(g, constructNormalizeNode, op(g, constructCrossNode, source, c));
+        const Id sum = op(g, constructSumNode, normalized);
+        const Id max = op(g, constructMaximumNode, op(g, constructDotNode, source, c));
+        const Id spread = op(g, constructSumNode, op(g, constructDistanceNode, source, op(g, constructMulNode, sum, scale)));
+        outputs.push_back({ source, normalized, sum, max, spread });
+    }
+    const Id missing = binaryFile(g, (dir.path / "missing").string());
+    const Id missingSum = op(g, constructSumNode, missing);
+
+    std::vector<Id> all { missing, missingSum };
+    for (const std::vector<Id> &o : outputs)
+        all.insert(all.end(), o.begin(), o.end());
+    GraphEval::Plan plan;
+    GraphEval::compile(g, plan, all);
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Full);
+    CHECK(result(g, plan, missing).error != PortDataError::None);
+    CHECK(result(g, plan, missingSum).error != PortDataError::None);
+    std::vector<PortData> expected;
+    for (Id id : outputs[0])
+        expected.push_back(result(g, plan, id));
+    for (size_t f = 1; f < outputs.size(); ++f) {
+        for (size_t i = 0; i < outputs[f].size(); ++i)
+            CHECK(same(result(g, plan, outputs[f][i]), expected[i]));
+    }
+    const PortData planarResult = result(g, plan, outputs[3][0]);
+    const Vec3Array &view(std::get<PortDataVec3Array>(planarResult.d).v);
+    CHECK(view.external && view.owner);
+
+    // streamed, in chunks read from the file or of the view
+    for (size_t f = 1; f < outputs.size(); ++f) {
+        const std::vector<Id> sums { outputs[f][2], outputs[f][3], outputs[f][4] };
+        GraphEval::compile(g, plan, sums);
+        GraphEval::Stream stream;
+        CHECK(GraphEval::compileStream(plan, sums, 1000, stream));
+        CHECK(stream.passCount == 2);
+        GraphEval::runStream(plan, stream, nullptr, nullptr);
+        for (size_t i = 0; i < sums.size(); ++i)
+            CHECK(same(result(g, plan, sums[i]), expected[i + 2]));
+    }
+}
@@ -0,0 +1,109 @@
+// Code generation: what the generated code is made of, and when the
+// system compiler is available (NODESTUFF_NATIVE_EVAL) what it computes.
+
+#include "testing.h"
+#include "testgraphs.h"
+#include "glslgen.h"
+#include "cppgen.h"
+
+#ifdef NODESTUFF_NATIVE_EVAL
+#include <filesystem>
+#include <fstream>
+#include <cstdlib>
+#include <unistd.h>
+#endif
+
+using namespace TestGraphs;
+using namespace NodeConstructors;
+
+static bool contains(const std::string &s, const std::string &part)
+{
+    return s.find(part) != std::string::npos;
+}
+
+TEST(glsl_uniforms_and_sinks)
+{
+    Graph g;
+    const Id a = constant(g, glm::vec3(1.0f, 2.0f, 3.0f));
+    const Id f = constant(g, 0.5f);
+    g.setLive(g.node(f), true);
+    const Id mul = op(g, constructMulNode, a, f);
+    const Id n = op(g, constructNormalizeNode, mul);
+    const Id d = op(g, constructDotNode, n, a);
+    const Id unused = op(g, constructLengthNode, a);
+
+    // live constants are uniforms, the others literals
+    GlslGen::Shader s = GlslGen::generate(g, { n, d });
+    const std::string v = "v", u = "u";
+    CHECK(s.failedNode == 0 && s.uniformNodes == std::vector<Id> { f });
+    CHECK(contains(s.source, "uniform GraphUniforms"));
+    CHECK(contains(s.source, "float " + u + std::to_string(f) + ";"));
+    CHECK(contains(s.source, "vec3 " + v + std::to_string(a) + " = vec3(1.0, 2.0, 3.0);"));
+    CHECK(contains(s.source, "void evaluateGraph(out vec3 result0, out float result1)"));
+    CHECK(contains(s.source, "normalize(" + v + std::to_string(mul) + ")"));
+    CHECK(contains(s.source, "result0 = " + v + std::to_string(n) + ";"));
+    CHECK(!contains(s.source, v + std::to_string(unused)) && !contains(s.source, "#version"));
+
+    GlslGen::Options options;
+    options.allConstantsAsUniforms = true;
+    options.standalone = true;
+    s = GlslGen::generate(g, { d }, options);
+    CHECK((s.uniformNodes == std::vector<Id> { a, f }));
+    CHECK(contains(s.source, "#version 440") && contains(s.source, "void main()"));
+
+    // nothing for a graph that does not evaluate
+    const Id plus = op(g, constructPlusNode, a);
+    s = GlslGen::generate(g, { op(g, constructNegateNode, plus) });
+    CHECK(s.failedNode == plus && s.source.empty());
+}
+
+#ifdef NODESTUFF_NATIVE_EVAL
+// Builds and runs the program of CppGen::generateCheck(), true when its
+// outputs match GraphEval's bit for bit.
+static bool runGeneratedCheck(const Graph &g, const std::vector<Id> &sinks)
+{
+    namespace fs = std::filesystem;
+    const fs::path dir = fs::temp_directory_path() / ("nodetests_" + std::to_string(getpid()));
+    fs::create_directories(dir);
+    std::ofstream(dir / "graph.h") << CppGen::generate(g, sinks).source;
+    std::ofstream(dir / "check.cpp") << CppGen::generateCheck(g, sinks, "graph.h");
+    const std::string command = std::string("\"") + NODESTUFF_NATIVE_CXX + "\" -std=c++17 -O1"
+        + " -I\"" NODESTUFF_NATIVE_INCLUDE_DIR "\" -o \"" + (dir / "check").string() + "\" \"" + (dir / "check.cpp").string()
+        + "\" > \"" + (dir / "log").string() + "\" 2>&1 && \"" + (dir / "check").string() + "\" >> \"" + (dir / "log").string() + "\" 2>&1";
+    const bool ok = std::system(command.c_str()) == 0;
+    std::error_code ec;
+    fs::remove_all(dir, ec);
+    return ok;
+}
+#endif
+
+TEST(cpp_header_matches_interpreter)
+{
+    Graph g;
+    RandomGraph r(g, 200, 19);
+    g.setLive(g.node(r.vec3s[0]), true);
+    g.setLive(g.node(r.floats[2]), true);
+    const std::vector<Id> sinks { r.vec3s.back(), r.floats.back(), r.vec3s[r.vec3s.size() / 2] };
+
+    CppGen::Header h = CppGen::generate(g, sinks);
+    CHECK(h.failedNode == 0);
+    CHECK((h.inputNodes == std::vector<Id> { r.vec3s[0], r.floats[2] }));
+    CHECK(contains(h.source, "inline Outputs evaluate(const Inputs &in)"));
+    CHECK(contains(h.source, "float n" + std::to_string(r.floats[2]) + " = 1.5f;"));
+    for (Id sink : sinks)
+        CHECK(contains(h.source, "out.n" + std::to_string(sink) + " = v" + std::to_string(sink) + ";"));
+
+    // the module for native mode covers every node but leaves out what
+    // it cannot translate
+    const Id plus = op(g, constructPlusNode, r.vec3s[1]);
+    const Id neg = op(g, constructNegateNode, plus);
+    CppGen::Module m = CppGen::generateModule(g, "f");
+    CHECK(m.nodes.size() == g.nodes.size() - 2);
+    CHECK(std::find(m.nodes.begin(), m.nodes.end(), neg) == m.nodes.end());
+    CHECK(contains(m.source, "extern \"C\" void f(void *const *v)"));
+    CHECK(CppGen::generate(g, { neg }).failedNode == plus);
+
+#ifdef NODESTUFF_NATIVE_EVAL
+    CHECK(runGeneratedCheck(g, sinks));
+#endif
+}
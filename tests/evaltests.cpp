@@ -0,0 +1,559 @@
+// GraphEval: plans, incremental and parallel runs, folding and fusion,
+// checked against the reference interpreter in testgraphs.h.
+
+#include "testing.h"
+#include "testgraphs.h"
+#include "alloccounter.h"
+#include "mat4simd.h"
+#include <random>
+#include <unordered_set>
+
+using namespace TestGraphs;
+using namespace NodeConstructors;
+
+TEST(plan_matches_reference)
+{
+    Graph g;
+    RandomGraph r(g, 300, 1);
+    GraphEval::Plan plan;
+    GraphEval::compile(g, plan);
+    CHECK(plan.isValidFor(g));
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Full);
+    CHECK(matchesReference(g, plan));
+
+    // Static port edits keep the plan, connections do not
+    setValue(g, r.floats[0], PortDataFloat { 3.5f });
+    CHECK(plan.isValidFor(g));
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Full);
+    CHECK(matchesReference(g, plan));
+    op(g, constructNegateNode, r.vec3s.back());
+    CHECK(!plan.isValidFor(g));
+}
+
+TEST(plan_reports_missing_operands)
+{
+    Graph g;
+    const Id a = constant(g, glm::vec3(1.0f));
+    const Id plus = op(g, constructPlusNode, a);
+    const Id neg = op(g, constructNegateNode, plus);
+    GraphEval::Plan plan;
+    GraphEval::compile(g, plan);
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Full);
+    CHECK(result(g, plan, plus).error == PortDataError::NotEnoughArgs);
+    CHECK(result(g, plan, neg).error != PortDataError::None);
+}
+
+TEST(shared_nodes_evaluated_once)
+{
+    // every Plus reads its source twice, walking the inputs would take
+    // 2^depth evaluations
+    Graph g;
+    Id x = constant(g, glm::vec3(1.0f, 2.0f, 3.0f));
+    g.setLive(g.node(x), true);
+    for (int i = 0; i < 16; ++i)
+        x = op(g, constructPlusNode, x, x);
+    GraphEval::Plan plan;
+    GraphEval::compile(g, plan);
+    GraphEval::Stats stats;
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Full, &stats);
+    CHECK(stats.evaluationCount == g.nodes.size());
+    CHECK(matchesReference(g, plan, 0.0f));
+    CHECK(same(result(g, plan, x), PortData { PortDataVec3 { glm::vec3(1.0f, 2.0f, 3.0f) * 65536.0f } }));
+}
+
+// the nodes downstream of id, id included
+static size_t downstreamCount(const Graph &g, Id id)
+{
+    std::vector<Id> stack { id };
+    std::unordered_set<Id> seen { id };
+    while (!stack.empty()) {
+        const Id n = stack.back();
+        stack.pop_back();
+        for (Id consumer : g.node(n).consumerNodes) {
+            if (seen.insert(consumer).second)
+                stack.push_back(consumer);
+        }
+    }
+    return seen.size();
+}
+
+TEST(incremental_evaluates_downstream_of_edits)
+{
+    Graph g;
+    RandomGraph r(g, 300, 2);
+    for (size_t i = 0; i < 4; ++i) {
+        g.setLive(g.node(r.vec3s[i]), true);
+        g.setLive(g.node(r.floats[i]), true);
+    }
+    GraphEval::Plan plan;
+    GraphEval::compile(g, plan);
+    GraphEval::Stats stats;
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Full, &stats);
+
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Incremental, &stats);
+    CHECK(stats.evaluationCount == 0);
+
+    setValue(g, r.vec3s[1], PortDataVec3 { glm::vec3(-2.0f, 0.5f, 4.0f) });
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Incremental, &stats);
+    CHECK(stats.evaluationCount == downstreamCount(g, r.vec3s[1]));
+
+    // the same as evaluating everything
+    GraphEval::Plan full;
+    GraphEval::compile(g, full);
+    GraphEval::run(g, full, GraphEval::UpdateMode::Full);
+    for (const Node &n : g.nodes) {
+        const Id port = outputPort(g, n.id);
+        CHECK(same(GraphEval::result(plan, port), GraphEval::result(full, port)));
+    }
+    CHECK(matchesReference(g, plan));
+}
+
+TEST(types_inferred_at_link_time)
+{
+    Graph g;
+    const Id a = constant(g, glm::vec3(1.0f, -2.0f, 0.5f));
+    const Id f = constant(g, 2.0f);
+    const Id dot = op(g, constructDotNode, a, a);
+    CHECK(g.port(outputPort(g, dot)).type == PortDataType::Float);
+
+    // operands without a kernel are refused
+    const Id cross = constructCrossNode(&g);
+    CHECK(connect(g, a, cross, 0));
+    CHECK(!connect(g, f, cross, 1));
+    CHECK(connect(g, a, cross, 1));
+    CHECK(g.port(outputPort(g, cross)).type == PortDataType::Vec3);
+
+    // a changed output type propagates downstream and rebinds kernels
+    const Id swizzle = op(g, constructSwizzleNode, a);
+    const Id neg = op(g, constructNegateNode, swizzle);
+    const Id cross2 = constructCrossNode(&g);
+    CHECK(connect(g, cross, cross2, 0));
+    CHECK(!connect(g, swizzle, cross2, 1)); // vec4
+    setValue(g, swizzle, PortDataString { "zyx" });
+    CHECK(g.port(outputPort(g, neg)).type == PortDataType::Vec3);
+    CHECK(connect(g, swizzle, cross2, 1));
+    CHECK(g.node(cross2).kernel);
+    setValue(g, swizzle, PortDataString { "yx" });
+    CHECK(g.port(outputPort(g, neg)).type == PortDataType::Vec2);
+    CHECK(!g.node(cross2).kernel);
+
+    GraphEval::Plan plan;
+    GraphEval::compile(g, plan);
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Full);
+    CHECK(result(g, plan, cross2).error == PortDataError::InvalidArgs);
+    CHECK(matchesReference(g, plan, 0.0f));
+}
+
+TEST(steady_state_runs_do_not_allocate)
+{
+    CHECK(AllocCounter::isEnabled());
+    Graph g;
+    RandomGraph r(g, 300, 3);
+    g.setLive(g.node(r.vec3s[0]), true);
+    GraphEval::Plan plan;
+    GraphEval::compile(g, plan);
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Full);
+
+    for (int i = 0; i < 4; ++i) {
+        setValue(g, r.vec3s[0], PortDataVec3 { glm::vec3(float(i), 1.0f, 2.0f) });
+        setValue(g, r.floats[1], PortDataFloat { float(i) });
+        const uint64_t before = AllocCounter::count();
+        GraphEval::run(g, plan, i % 2 ? GraphEval::UpdateMode::Full : GraphEval::UpdateMode::Incremental);
+        CHECK(AllocCounter::count() == before);
+    }
+    CHECK(matchesReference(g, plan));
+}
+
+TEST(wide_levels_run_in_parallel)
+{
+    // levels well above PARALLEL_MIN_LEVEL_SIZE, going to the thread pool
+    Graph g;
+    const Id a = constant(g, glm::vec3(0.5f, 1.0f, -1.0f));
+    g.setLive(g.node(a), true);
+    std::vector<Id> firstLevel;
+    for (size_t i = 0; i < 3 * GraphEval::PARALLEL_MIN_LEVEL_SIZE; ++i)
+        firstLevel.push_back(op(g, constructMulNode, a, constant(g, float(i))));
+    for (size_t i = 0; i < firstLevel.size(); ++i)
+        op(g, constructCrossNode, firstLevel[i], firstLevel[(i * 7) % firstLevel.size()]);
+
+    GraphEval::Plan plan;
+    GraphEval::compile(g, plan);
+    CHECK(plan.levels.size() >= 3);
+    GraphEval::Stats stats;
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Full, &stats);
+    CHECK(stats.evaluationCount == g.nodes.size());
+    CHECK(matchesReference(g, plan, 0.0f));
+
+    setValue(g, a, PortDataVec3 { glm::vec3(2.0f, -3.0f, 0.25f) });
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Incremental, &stats);
+    CHECK(stats.evaluationCount == 1 + 2 * firstLevel.size());
+    CHECK(matchesReference(g, plan, 0.0f));
+}
+
+TEST(editor_graphs_run_in_parallel)
+{
+    // built like the editor builds graphs, without any live nodes: only
+    // the constants and what reads nothing else are folded, the rest goes
+    // level by level to the thread pool
+    Graph g;
+    const Id a = constant(g, glm::vec3(0.5f, 1.0f, -1.0f));
+    std::vector<Id> scaled;
+    for (size_t i = 0; i < 2 * GraphEval::PARALLEL_MIN_LEVEL_SIZE; ++i)
+        scaled.push_back(op(g, constructMulNode, a, constant(g, float(i))));
+    std::vector<Id> crossed;
+    for (size_t i = 0; i < scaled.size(); ++i)
+        crossed.push_back(op(g, constructCrossNode, scaled[i], scaled[(i * 7) % scaled.size()]));
+    for (size_t i = 0; i < crossed.size(); ++i)
+        op(g, constructPlusNode, crossed[i], crossed[(i * 3) % crossed.size()]);
+
+    GraphEval::Plan plan;
+    GraphEval::compile(g, plan);
+    CHECK(plan.foldedInstructions.size() == 1 + 2 * scaled.size());
+    CHECK(plan.levels.size() == 3);
+    for (size_t level = 0; level + 1 < plan.levels.size(); ++level)
+        CHECK(plan.levels[level + 1] - plan.levels[level] == scaled.size());
+    GraphEval::Stats stats;
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Full, &stats);
+    CHECK(stats.evaluationCount == g.nodes.size());
+    CHECK(stats.foldedNodeCount == plan.foldedInstructions.size());
+    CHECK(matchesReference(g, plan, 0.0f));
+
+    setValue(g, a, PortDataVec3 { glm::vec3(2.0f, -3.0f, 0.25f) });
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Incremental, &stats);
+    CHECK(stats.evaluationCount == 1 + 3 * scaled.size());
+    CHECK(matchesReference(g, plan, 0.0f));
+}
+
+TEST(constants_folded_and_dead_nodes_dropped)
+{
+    Graph g;
+    const Id a = constant(g, glm::vec3(1.0f, 2.0f, 3.0f));
+    const Id b = constant(g, glm::vec3(0.0f, 1.0f, 0.0f));
+    const Id live = constant(g, 0.5f);
+    g.setLive(g.node(live), true);
+    const Id cross = op(g, constructCrossNode, a, b); // folded
+    const Id normalized = op(g, constructNormalizeNode, cross); // not only constants upstream
+    const Id scaled = op(g, constructMulNode, normalized, live);
+    const Id sink = op(g, constructPlusNode, scaled, a);
+    const Id unused = op(g, constructLengthNode, cross); // dead for sink
+
+    GraphEval::Plan plan;
+    GraphEval::compile(g, plan, { sink });
+    CHECK(plan.foldedInstructions.size() == 3);
+    CHECK(plan.instructions.size() == 4);
+    CHECK(plan.deadNodeCount == 1);
+    CHECK(!plan.outputValues.count(outputPort(g, unused)));
+    GraphEval::Stats stats;
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Full, &stats);
+    CHECK(stats.evaluationCount == 7);
+    CHECK(matchesReference(g, plan, 0.0f));
+
+    // folded nodes are only evaluated again when their constants change
+    setValue(g, live, PortDataFloat { 2.0f });
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Full, &stats);
+    CHECK(stats.evaluationCount == 4);
+    CHECK(matchesReference(g, plan, 0.0f));
+    setValue(g, b, PortDataVec3 { glm::vec3(0.0f, 0.0f, -1.0f) });
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Incremental, &stats);
+    CHECK(stats.evaluationCount == 5);
+    CHECK(matchesReference(g, plan, 0.0f));
+}
+
+static glm::mat4 randomMatrix(std::mt19937 &rng)
+{
+    std::uniform_real_distribution<float> d(-2.0f, 2.0f);
+    glm::mat4 m;
+    for (int c = 0; c < 4; ++c) {
+        for (int r = 0; r < 4; ++r)
+            m[c][r] = d(rng) + (c == r ? 3.0f : 0.0f);
+    }
+    return m;
+}
+
+TEST(matrix_chains_exact_unless_fused)
+{
+    Graph g;
+    std::mt19937 rng(10);
+    Id m[3];
+    for (Id &id : m) {
+        id = constant(g, randomMatrix(rng));
+        g.setLive(g.node(id), true);
+    }
+    const Id v = constant(g, glm::vec4(1.0f, -2.0f, 0.5f, 1.0f));
+    g.setLive(g.node(v), true);
+    const Id t = op(g, constructTransposeNode, m[1]);
+    const Id inv = op(g, constructInverseNode, m[2]);
+    const Id product = op(g, constructMulNode, op(g, constructMulNode, m[0], t), inv);
+    const Id scale = constant(g, -0.5f);
+    g.setLive(g.node(scale), true);
+    const Id sink = op(g, constructMulNode, op(g, constructMulNode, product, scale), v);
+
+    // x * inverse(x) of a singular x is not the identity
+    const Id singular = constant(g, glm::mat4(0.0f));
+    g.setLive(g.node(singular), true);
+    const Id cancelled = op(g, constructMulNode, singular, op(g, constructInverseNode, singular));
+
+    GraphEval::Plan all, exact, fused;
+    GraphEval::compile(g, all);
+    GraphEval::run(g, all, GraphEval::UpdateMode::Full);
+    GraphEval::compile(g, exact, { sink, cancelled }, GraphEval::ChainMode::Exact);
+    GraphEval::run(g, exact, GraphEval::UpdateMode::Full);
+    GraphEval::compile(g, fused, { sink, cancelled }, GraphEval::ChainMode::Fused);
+    GraphEval::run(g, fused, GraphEval::UpdateMode::Full);
+
+    CHECK(exact.fusedNodeCount == 0);
+    CHECK(fused.fusedNodeCount > 0);
+    CHECK(matchesReference(g, exact, 1e-5f));
+    for (Id id : { sink, cancelled })
+        CHECK(same(result(g, exact, id), result(g, all, id)));
+    CHECK(same(result(g, fused, sink), result(g, all, sink), 1e-4f));
+
+    // fusing must not make the NaNs of the singular product go away
+    const glm::mat4 c = std::get<PortDataMat4>(result(g, fused, cancelled).d).v;
+    const glm::mat4 expected = std::get<PortDataMat4>(result(g, all, cancelled).d).v;
+    for (int i = 0; i < 16; ++i)
+        CHECK(std::isnan(c[i / 4][i % 4]) == std::isnan(expected[i / 4][i % 4]));
+    CHECK(std::isnan(expected[0][0]));
+}
+
+TEST(values_of_every_type_stored)
+{
+    Graph g;
+    const Id f = constant(g, 1.5f);
+    const Id v2 = constructVec2Node(&g);
+    setValue(g, v2, PortDataVec2 { glm::vec2(3.0f, -1.0f) });
+    const Id v3 = constant(g, glm::vec3(1.0f, 0.0f, 2.0f));
+    const Id v4 = constant(g, glm::vec4(0.5f, 1.0f, 1.5f, 2.0f));
+    const Id m3 = constructMat3Node(&g);
+    setValue(g, m3, PortDataMat3 { glm::mat3(2.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 3.0f), false });
+    const Id m4 = constant(g, glm::mat4(1.0f, 2.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 2.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f));
+    for (Id id : { f, v2, v3, v4, m3, m4 })
+        g.setLive(g.node(id), true);
+    op(g, constructMulNode, v2, f);
+    op(g, constructLengthNode, v2);
+    op(g, constructDivNode, v4, op(g, constructSwizzleNode, v3));
+    op(g, constructMulNode, m3, v3);
+    op(g, constructInverseNode, m3);
+    op(g, constructDeterminantNode, m3);
+    op(g, constructMulNode, m4, m4);
+    op(g, constructTransposeNode, m4);
+    op(g, constructMulNode, v4, m4);
+    op(g, constructMinusNode, f, f);
+
+    GraphEval::Plan plan;
+    GraphEval::compile(g, plan);
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Full);
+    // one slot per value in the array of its type
+    const ValueStore &s(plan.values);
+    CHECK(s.values.size() == g.nodes.size());
+    CHECK(s.floats.size() + s.vec2s.size() + s.vec3s.size() + s.vec4s.size() + s.mat3s.size() + s.mat4s.size() == s.values.size());
+    CHECK(s.floats.size() == 4 && s.vec2s.size() == 2 && s.mat3s.size() == 2);
+    CHECK(matchesReference(g, plan, 1e-6f));
+}
+
+static bool sameBits(const float *a, const float *b, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        if (std::isnan(a[i]) ? !std::isnan(b[i]) : memcmp(&a[i], &b[i], sizeof(float)))
+            return false;
+    }
+    return true;
+}
+
+TEST(simd_mat4_kernels_match_glm)
+{
+    if (!Mat4Simd::available())
+        return;
+    std::mt19937 rng(21);
+    for (int i = 0; i < 1000; ++i) {
+        alignas(16) glm::mat4 a = randomMatrix(rng), b = randomMatrix(rng);
+        if (i % 100 == 0)
+            a[1] = a[0]; // singular
+        alignas(16) glm::vec4 v(a[2]);
+        alignas(16) glm::mat4 m;
+        alignas(16) glm::vec4 r;
+        Mat4Simd::mul(&a[0][0], &b[0][0], &m[0][0]);
+        CHECK(sameBits(&m[0][0], &glm::mat4(a * b)[0][0], 16));
+        if (Mat4Simd::hasAvx()) {
+            Mat4Simd::mulAvx(&a[0][0], &b[0][0], &m[0][0]);
+            CHECK(sameBits(&m[0][0], &glm::mat4(a * b)[0][0], 16));
+        }
+        Mat4Simd::mulVec(&a[0][0], &v[0], &r[0]);
+        CHECK(sameBits(&r[0], &glm::vec4(a * v)[0], 4));
+        Mat4Simd::vecMul(&v[0], &a[0][0], &r[0]);
+        CHECK(sameBits(&r[0], &glm::vec4(v * a)[0], 4));
+        Mat4Simd::inverse(&a[0][0], &m[0][0]);
+        CHECK(sameBits(&m[0][0], &glm::inverse(a)[0][0], 16));
+        const float det = Mat4Simd::determinant(&a[0][0]), expected = glm::determinant(a);
+        CHECK(sameBits(&det, &expected, 1));
+    }
+
+    // and through the kernels of a plan
+    Graph g;
+    const Id a = constant(g, randomMatrix(rng));
+    const Id b = constant(g, randomMatrix(rng));
+    op(g, constructMulNode, a, b);
+    op(g, constructInverseNode, a);
+    op(g, constructDeterminantNode, b);
+    op(g, constructMulNode, b, constant(g, glm::vec4(1.0f, 2.0f, 3.0f, 4.0f)));
+    GraphEval::Plan plan;
+    GraphEval::compile(g, plan);
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Full);
+    CHECK(matchesReference(g, plan, 0.0f));
+}
+
+// element i of an array value as a value of its own, and the element count
+template<typename T>
+static bool arrayElement(const PortData &a, size_t i, PortData *element, size_t *count)
+{
+    using Data = typename ValueTraits<ValueArray<T>>::Data;
+    if (auto *array = std::get_if<Data>(&a.d)) {
+        *count = array->v.count;
+        if (i < array->v.count)
+            element->d = typename ValueTraits<T>::Data { array->v.at(i) };
+        return true;
+    }
+    return false;
+}
+
+static PortData arrayElement(const PortData &a, size_t i, size_t *count)
+{
+    PortData element;
+    element.error = a.error;
+    *count = 0;
+    arrayElement<float>(a, i, &element, count) || arrayElement<glm::vec2>(a, i, &element, count)
+        || arrayElement<glm::vec3>(a, i, &element, count) || arrayElement<glm::vec4>(a, i, &element, count);
+    return element;
+}
+
+// the same operations over a, f and c, whatever their types
+static std::vector<Id> elementWiseOps(Graph &g, Id a, Id f, Id c)
+{
+    std::vector<Id> ops;
+    ops.push_back(op(g, constructPlusNode, a, c));
+    ops.push_back(op(g, constructMulNode, a, f));
+    ops.push_back(op(g, constructMulNode, f, c));
+    ops.push_back(op(g, constructDivNode, ops[0], ops[1]));
+    ops.push_back(op(g, constructLengthNode, a));
+    ops.push_back(op(g, constructDistanceNode, c, ops[2]));
+    ops.push_back(op(g, constructNormalizeNode, ops[3]));
+    ops.push_back(op(g, constructDotNode, a, c));
+    ops.push_back(op(g, constructCrossNode, c, a));
+    ops.push_back(op(g, constructNegateNode, ops[4]));
+    const Id swizzle = op(g, constructSwizzleNode, ops[8]);
+    setValue(g, swizzle, PortDataString { "zxxy" });
+    ops.push_back(swizzle);
+    return ops;
+}
+
+TEST(arrays_evaluated_element_wise)
+{
+    std::mt19937 rng(23);
+    std::uniform_real_distribution<float> d(-4.0f, 4.0f);
+    Vec3Array a;
+    a.resize(300); // more than a tile, not a whole number of runs
+    for (size_t i = 0; i < a.count; ++i)
+        a.set(i, glm::vec3(d(rng), d(rng), d(rng)));
+    FloatArray f;
+    f.resize(290);
+    for (size_t i = 0; i < f.count; ++i)
+        f.set(i, d(rng));
+    const glm::vec3 c(0.5f, -1.0f, 2.0f);
+
+    Graph g;
+    const Id aNode = constructVec3Node(&g);
+    setValue(g, aNode, PortDataVec3Array { a });
+    const Id fNode = constructFloatNode(&g);
+    setValue(g, fNode, PortDataFloatArray { f });
+    const std::vector<Id> ops = elementWiseOps(g, aNode, fNode, constant(g, c));
+    GraphEval::Plan plan;
+    GraphEval::compile(g, plan);
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Full);
+
+    // element i against the same graph over element i of each array
+    for (size_t i = 0; i < a.count; ++i) {
+        Graph scalar;
+        const std::vector<Id> scalarOps = elementWiseOps(scalar, constant(scalar, a.at(i)),
+                                                         constant(scalar, i < f.count ? f.at(i) : 0.0f), constant(scalar, c));
+        for (size_t k = 0; k < ops.size(); ++k) {
+            size_t count;
+            const PortData element = arrayElement(result(g, plan, ops[k]), i, &count);
+            CHECK(element.error == PortDataError::None);
+            // as long as the shortest array operand, upstream included
+            const bool usesF = k == 1 || k == 2 || k == 3 || k == 5 || k == 6;
+            CHECK(count == (usesF ? f.count : a.count));
+            if (i < count)
+                CHECK(same(element, reference(scalar, scalarOps[k]), 0.0f));
+        }
+    }
+}
+
+// the elements of a streamed Vec3Array output, put back together
+struct StreamedArray
+{
+    std::vector<glm::vec3> elements;
+
+    static void receive(void *context, size_t output, const void *chunk, size_t first)
+    {
+        StreamedArray &s(*static_cast<StreamedArray *>(context));
+        const Vec3Array &c(*static_cast<const Vec3Array *>(chunk));
+        CHECK(output == 0 && first == s.elements.size());
+        for (size_t i = 0; i < c.count; ++i)
+            s.elements.push_back(c.at(i));
+    }
+};
+
+TEST(streamed_results_same_as_in_memory)
+{
+    std::mt19937 rng(24);
+    std::uniform_real_distribution<float> d(-4.0f, 4.0f);
+    Vec3Array a;
+    FloatArray f;
+    a.resize(10000);
+    f.resize(10000);
+    for (size_t i = 0; i < a.count; ++i) {
+        a.set(i, glm::vec3(d(rng), d(rng), d(rng)));
+        f.set(i, d(rng));
+    }
+
+    Graph g;
+    const Id aNode = constructVec3Node(&g);
+    setValue(g, aNode, PortDataVec3Array { a });
+    const Id fNode = constructFloatNode(&g);
+    setValue(g, fNode, PortDataFloatArray { f });
+    const Id c = constant(g, glm::vec3(0.5f, -1.0f, 2.0f));
+    const Id normalized = op(g, constructNormalizeNode, op(g, constructMulNode, aNode, fNode));
+    const Id sum = op(g, constructSumNode, normalized);
+    const Id max = op(g, constructMaximumNode, op(g, constructLengthNode, aNode));
+    const Id min = op(g, constructMinimumNode, op(g, constructDotNode, aNode, c));
+    // needs the sum over all chunks first, so takes a second pass
+    const Id spread = op(g, constructSumNode, op(g, constructDistanceNode, normalized, op(g, constructMulNode, sum, constant(g, 1.0f / 10000.0f))));
+    const std::vector<Id> outputs { normalized, sum, max, min, spread };
+
+    GraphEval::Plan plan;
+    GraphEval::compile(g, plan, outputs);
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Full);
+    std::vector<PortData> inMemory;
+    for (Id id : outputs)
+        inMemory.push_back(result(g, plan, id));
+    float longest = 0.0f;
+    for (size_t i = 0; i < a.count; ++i)
+        longest = std::max(longest, glm::length(a.at(i)));
+    CHECK(same(inMemory[2], PortData { PortDataFloat { longest } }));
+
+    for (size_t chunkSize : { 1000, 4096 }) {
+        GraphEval::Stream stream;
+        CHECK(GraphEval::compileStream(plan, outputs, chunkSize, stream));
+        CHECK(stream.passCount == 2);
+        StreamedArray streamed;
+        GraphEval::runStream(plan, stream, StreamedArray::receive, &streamed);
+        for (size_t i = 1; i < outputs.size(); ++i)
+            CHECK(same(result(g, plan, outputs[i]), inMemory[i]));
+        const Vec3Array &expected(std::get<PortDataVec3Array>(inMemory[0].d).v);
+        CHECK(streamed.elements.size() == expected.count);
+        for (size_t i = 0; i < streamed.elements.size(); ++i) {
+            const glm::vec3 e = expected.at(i);
+            CHECK(!memcmp(&streamed.elements[i], &e, sizeof(e)));
+        }
+    }
+}
@@ -0,0 +1,276 @@
+// Graph: storage, adjacency, topological order and edit transactions.
+
+#include "testing.h"
+#include "testgraphs.h"
+#include "graphfile.h"
+#include <random>
+#include <unordered_set>
+
+using namespace TestGraphs;
+using namespace NodeConstructors;
+
+// whether to is downstream of from, from included
+static bool reaches(const Graph &g, Id from, Id to)
+{
+    std::vector<Id> stack { from };
+    std::unordered_set<Id> seen { from };
+    while (!stack.empty()) {
+        const Id n = stack.back();
+        stack.pop_back();
+        if (n == to)
+            return true;
+        for (Id consumer : g.node(n).consumerNodes) {
+            if (seen.insert(consumer).second)
+                stack.push_back(consumer);
+        }
+    }
+    return false;
+}
+
+// topoOrder holds every node once, sources before consumers
+static bool isTopologicallyOrdered(const Graph &g)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < g.topoOrder.size(); ++i) {
+        if (!g.topoOrder[i])
+            continue;
+        ++count;
+        if (g.node(g.topoOrder[i]).topoIndex != i)
+            return false;
+    }
+    if (count != g.nodes.size())
+        return false;
+    for (const Connection &c : g.connections) {
+        if (g.node(g.sourceNodeId(c)).topoIndex >= g.node(g.consumerNodeId(c)).topoIndex)
+            return false;
+    }
+    return true;
+}
+
+TEST(connections_keep_topological_order)
+{
+    Graph g;
+    std::vector<Id> nodes;
+    for (int i = 0; i < 200; ++i)
+        nodes.push_back(constructPlusNode(&g));
+
+    std::mt19937 rng(8);
+    size_t accepted = 0, refused = 0;
+    for (int i = 0; i < 600; ++i) {
+        const Id from = nodes[rng() % nodes.size()];
+        const Id to = nodes[rng() % nodes.size()];
+        const int order = int(rng() % 2);
+        const bool free = g.port(inputPort(g, to, order)).connections.empty();
+        const bool cycle = reaches(g, to, from);
+        const Id c = connect(g, from, to, order);
+        CHECK(bool(c) == (free && !cycle));
+        accepted += c != 0;
+        refused += free && cycle;
+        if (c && rng() % 4 == 0)
+            g.removeConnection(c);
+        if (rng() % 50 == 0) {
+            const Id removed = nodes[rng() % nodes.size()];
+            g.removeNode(removed);
+            nodes.erase(std::find(nodes.begin(), nodes.end(), removed));
+        }
+    }
+    CHECK(accepted > 100 && refused > 10);
+    CHECK(isTopologicallyOrdered(g));
+}
+
+TEST(stale_handles_detected)
+{
+    SlotMap<int> map;
+    const int a = map.insert();
+    map.at(a) = 1;
+    const int b = map.insert();
+    map.at(b) = 2;
+    map.erase(a);
+    const int c = map.insert(); // reuses the slot of a
+    map.at(c) = 3;
+    CHECK(c != a && (c & SlotMap<int>::INDEX_MASK) == (a & SlotMap<int>::INDEX_MASK));
+    CHECK(!map.contains(a) && !map.find(a));
+    bool thrown = false;
+    try {
+        map.at(a);
+    } catch (const std::out_of_range &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(map.at(b) == 2 && map.at(c) == 3 && map.size() == 2);
+
+    // the same for nodes
+    Graph g;
+    const Id n = constant(g, 1.0f);
+    const Id m = constant(g, 2.0f);
+    g.removeNode(n);
+    const Id reused = constant(g, 3.0f);
+    CHECK(!g.nodes.find(n) && g.nodes.find(reused) && g.nodes.find(m));
+    CHECK(std::get<PortDataFloat>(reference(g, m).d).v == 2.0f);
+}
+
+TEST(port_adjacency_matches_connections)
+{
+    Graph g;
+    std::vector<Id> nodes;
+    for (int i = 0; i < 50; ++i)
+        nodes.push_back(i % 5 ? constructPlusNode(&g) : constant(g, glm::vec3(float(i))));
+    std::mt19937 rng(12);
+    std::vector<Id> made;
+    for (int i = 0; i < 300; ++i) {
+        const Id to = nodes[rng() % nodes.size()];
+        if (g.node(to).isConstant())
+            continue;
+        if (const Id c = connect(g, nodes[rng() % nodes.size()], to, int(rng() % 2)))
+            made.push_back(c);
+        if (!made.empty() && rng() % 3 == 0) {
+            const size_t k = rng() % made.size();
+            g.removeConnection(made[k]);
+            made.erase(made.begin() + k);
+        }
+    }
+    g.removeNode(nodes[7]);
+    nodes.erase(nodes.begin() + 7);
+
+    // what scanning all connections would find
+    size_t portEntries = 0;
+    for (const Node &n : g.nodes) {
+        std::vector<Id> sources, consumers;
+        for (const Port &port : n.ports) {
+            CHECK(&g.port(port.id) == &port && g.nodeForPort(port.id).id == n.id);
+            size_t count = 0;
+            for (const Connection &c : g.connections) {
+                if (c.ep[0].portId == port.id || c.ep[1].portId == port.id) {
+                    CHECK(std::count(port.connections.begin(), port.connections.end(), c.id) == 1);
+                    ++count;
+                }
+            }
+            CHECK(count == port.connections.size());
+            portEntries += count;
+        }
+        for (const Connection &c : g.connections) {
+            if (g.consumerNodeId(c) == n.id)
+                sources.push_back(g.sourceNodeId(c));
+            if (g.sourceNodeId(c) == n.id)
+                consumers.push_back(g.consumerNodeId(c));
+        }
+        CHECK(std::is_permutation(sources.begin(), sources.end(), n.sourceNodes.begin(), n.sourceNodes.end()));
+        CHECK(std::is_permutation(consumers.begin(), consumers.end(), n.consumerNodes.begin(), n.consumerNodes.end()));
+    }
+    CHECK(portEntries == 2 * g.connections.size());
+    CHECK(g.connections.size() > 20);
+}
+
+TEST(removed_ids_recycled)
+{
+    Graph g;
+    const Id a = constant(g, glm::vec3(1.0f));
+    const size_t ports = g.portNodeMap.size();
+    const uint32_t mask = SlotMap<Node>::INDEX_MASK;
+    uint32_t largestIndex = 0;
+    for (int i = 0; i < 1000; ++i) {
+        const Id plus = op(g, constructPlusNode, a, a);
+        const Id neg = op(g, constructNegateNode, plus);
+        for (const Port &port : g.node(neg).ports)
+            largestIndex = std::max(largestIndex, uint32_t(port.id) & mask);
+        largestIndex = std::max(largestIndex, uint32_t(neg) & mask);
+        largestIndex = std::max(largestIndex, uint32_t(g.node(neg).ports.front().connections.front()) & mask);
+        g.removeNode(i % 2 ? plus : neg);
+        g.removeNode(i % 2 ? neg : plus);
+    }
+    // nothing left behind, ids stay in the range a few nodes need
+    CHECK(g.nodes.size() == 1 && g.connections.empty() && g.portNodeMap.size() == ports);
+    CHECK(largestIndex <= 8);
+    CHECK(g.node(a).consumerNodes.empty() && g.topoOrder.size() < 4);
+}
+
+TEST(edit_transaction_rejects_at_commit)
+{
+    Graph g;
+    const Id a = constant(g, glm::vec3(1.0f, 2.0f, 3.0f));
+    const Id f = constant(g, 2.0f);
+    g.beginEdit();
+    const Id p1 = constructPlusNode(&g);
+    const Id p2 = constructPlusNode(&g);
+    const Id cross = constructCrossNode(&g);
+    CHECK(connect(g, a, p1, 0));
+    CHECK(connect(g, p1, p2, 0));
+    CHECK(connect(g, a, p2, 1));
+    const Id cycle = connect(g, p2, p1, 1); // only checked at commit
+    CHECK(connect(g, p2, cross, 0));
+    const Id mistyped = connect(g, f, cross, 1);
+    CHECK(cycle && mistyped);
+    const Id neg = op(g, constructNegateNode, a);
+    CHECK(g.port(outputPort(g, neg)).type == PortDataType::Empty); // inference deferred
+    std::vector<Id> rejected = g.commitEdit();
+    CHECK(g.port(outputPort(g, neg)).type == PortDataType::Vec3);
+    std::sort(rejected.begin(), rejected.end());
+    CHECK((rejected == std::vector<Id> { std::min(cycle, mistyped), std::max(cycle, mistyped) }));
+    CHECK(!g.connections.contains(cycle) && !g.connections.contains(mistyped));
+    CHECK(isTopologicallyOrdered(g));
+
+    // the inputs freed by the rejected connections can be used again
+    CHECK(connect(g, a, p1, 1));
+    CHECK(g.port(outputPort(g, p2)).type == PortDataType::Vec3);
+    CHECK(connect(g, a, cross, 1));
+    GraphEval::Plan plan;
+    GraphEval::compile(g, plan);
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Full);
+    CHECK(matchesReference(g, plan, 0.0f));
+    CHECK(result(g, plan, cross).error == PortDataError::None);
+}
+
+TEST(nodes_follow_their_descriptors)
+{
+    Graph g;
+    size_t constructed = 0;
+    for (const NodeConstructorSet *set = nodeConstructorSets; set->category; ++set) {
+        for (const NodeConstructor *c = set->constructors; c->text; ++c) {
+            const Node &n(g.node(c->func(&g)));
+            const NodeTypeDescriptor &d(n.descriptor());
+            CHECK(d.type == n.type && d.name && *d.name);
+            CHECK(n.ports.size() == d.portCount);
+            size_t inputs = 0;
+            for (size_t i = 0; i < n.ports.size(); ++i) {
+                CHECK(n.ports[i].order == int(i) && n.ports[i].dir == d.ports[i].dir);
+                inputs += n.ports[i].dir == PortDirection::Input;
+            }
+            CHECK(inputs == d.inputPortCount);
+            ++constructed;
+        }
+    }
+    CHECK(constructed + 1 == size_t(NodeType::NodeTypeCount)); // all but Invalid
+}
+
+TEST(clear_resets_for_reload)
+{
+    Graph g;
+    RandomGraph(g, 200, 17);
+    const std::string saved = GraphFile::write(g);
+    const size_t nodeCount = g.nodes.size();
+    const size_t connectionCount = g.connections.size();
+    GraphEval::Plan plan;
+    GraphEval::compile(g, plan);
+    const uint64_t version = g.topologyVersion;
+
+    g.clear();
+    CHECK(g.nodes.empty() && g.connections.empty() && g.portNodeMap.empty() && g.topoOrder.empty());
+    CHECK(g.topologyVersion > version);
+    CHECK(!plan.isValidFor(g));
+
+    // reloading, which clears again when the file is bad
+    std::string error;
+    CHECK(GraphFile::read(g, saved, nullptr, &error));
+    CHECK(g.nodes.size() == nodeCount && g.connections.size() == connectionCount);
+    GraphEval::compile(g, plan);
+    GraphEval::run(g, plan, GraphEval::UpdateMode::Full);
+    CHECK(matchesReference(g, plan, 0.0f));
+
+    g.clear();
+    const uint64_t cleared = g.topologyVersion;
+    CHECK(!GraphFile::read(g, saved + "link 1 0 99999 0\n", nullptr, &error) && !error.empty());
+    CHECK(g.nodes.empty() && g.connections.empty() && g.portNodeMap.empty());
+    CHECK(g.topologyVersion > cleared);
+    CHECK(GraphFile::read(g, saved));
+    CHECK(g.nodes.size() == nodeCount && g.connections.size() == connectionCount);
+}
@@ -0,0 +1,104 @@
+// Native mode of GraphEval::update(): a hand written function stands in
+// for a compiled module, and with NODESTUFF_NATIVE_EVAL a real one is
+// built by NativeCompiler.
+
+#include "testing.h"
+#include "testgraphs.h"
+#include "nativecompiler.h"
+#include <chrono>
+#include <thread>
+
+using namespace TestGraphs;
+using namespace NodeConstructors;
+
+static int nativeCalls = 0;
+
+// What a module for { a, b, plus, swizzle } with the swizzle "zyx" computes
+static void handWrittenModule(void *const *v)
+{
+    const glm::vec3 &a(*static_cast<const glm::vec3 *>(v[0]));
+    const glm::vec3 &b(*static_cast<const glm::vec3 *>(v[1]));
+    glm::vec3 &plus(*static_cast<glm::vec3 *>(v[2]));
+    plus = a + b;
+    *static_cast<glm::vec3 *>(v[3]) = glm::vec3(plus.z, plus.y, plus.x);
+    ++nativeCalls;
+}
+
+TEST(native_mode_interprets_the_rest)
+{
+    Graph g;
+    const Id a = constant(g, glm::vec3(1.0f, 2.0f, 3.0f));
+    const Id b = constant(g, glm::vec3(0.5f, -1.0f, 4.0f));
+    const Id plus = op(g, constructPlusNode, a, b);
+    const Id swizzle = op(g, constructSwizzleNode, plus);
+    setValue(g, swizzle, PortDataString { "zyx" });
+    // left out of the module: an array and what reads from it
+    FloatArray elements;
+    elements.resize(100);
+    for (size_t i = 0; i < elements.count; ++i)
+        elements.set(i, float(i));
+    const Id array = constructFloatNode(&g);
+    setValue(g, array, PortDataFloatArray { elements });
+    const Id length = op(g, constructLengthNode, swizzle);
+    const Id sum = op(g, constructSumNode, op(g, constructMulNode, array, length));
+    auto sumOf = [&] { return std::get<PortDataFloat>(result(g, GraphEval::updatePlan(), sum).d).v; };
+    auto expectedSum = [&] { return 4950.0f * std::get<PortDataFloat>(reference(g, length).d).v; };
+
+    GraphEval::update(g, GraphEval::UpdateMode::Full);
+    CHECK(GraphEval::attachNative(g, handWrittenModule, nullptr, { a, b, plus, swizzle }));
+    nativeCalls = 0;
+    setValue(g, a, PortDataVec3 { glm::vec3(-2.0f, 0.0f, 1.0f) });
+    GraphEval::update(g);
+    CHECK(GraphEval::stats().native && nativeCalls == 1);
+    CHECK(matchesReference(g, GraphEval::updatePlan(), { a, b, plus, swizzle, length }, 0.0f));
+    CHECK(std::fabs(sumOf() - expectedSum()) <= 1e-5f * expectedSum());
+
+    // arrays edited under native mode are picked up
+    elements.set(99, 0.0f);
+    setValue(g, array, PortDataFloatArray { elements });
+    GraphEval::update(g);
+    CHECK(GraphEval::stats().native && nativeCalls == 1);
+    CHECK(std::fabs(sumOf() - 4851.0f / 4950.0f * expectedSum()) <= 1e-5f * expectedSum());
+
+    // the module has the swizzle baked in, so editing it goes back to
+    // interpretation even though the type stays the same
+    setValue(g, swizzle, PortDataString { "xzy" });
+    GraphEval::update(g);
+    CHECK(!GraphEval::stats().native && nativeCalls == 1);
+    CHECK(matchesReference(g, GraphEval::updatePlan(), { a, b, plus, swizzle, length }, 0.0f));
+}
+
+#ifdef NODESTUFF_NATIVE_EVAL
+TEST(native_module_matches_interpreter)
+{
+    Graph g;
+    RandomGraph r(g, 300, 20);
+    g.setLive(g.node(r.vec3s[2]), true);
+    GraphEval::update(g, GraphEval::UpdateMode::Full);
+
+    NativeCompiler compiler;
+    compiler.compile(1, CppGen::generateModule(g, NativeCompiler::functionName()));
+    NativeCompiler::Result built;
+    for (int i = 0; i < 6000 && !compiler.take(&built); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    CHECK(built.tag == 1 && built.function);
+    CHECK(built.nodes.size() == g.nodes.size());
+    CHECK(GraphEval::attachNative(g, built.function, built.library, built.nodes));
+
+    for (int i = 0; i < 2; ++i) {
+        setValue(g, r.vec3s[2], PortDataVec3 { glm::vec3(float(i), -1.0f, 0.5f) });
+        setValue(g, r.floats[1], PortDataFloat { 3.0f - float(i) });
+        GraphEval::update(g);
+        CHECK(GraphEval::stats().native);
+        // nodes are shared with the native plan, so compile afresh to
+        // evaluate all of them
+        GraphEval::Plan interpreted;
+        GraphEval::compile(g, interpreted);
+        GraphEval::run(g, interpreted, GraphEval::UpdateMode::Full);
+        for (const Node &n : g.nodes) {
+            const Id port = outputPort(g, n.id);
+            CHECK(same(result(g, GraphEval::updatePlan(), n.id), GraphEval::result(interpreted, port)));
+        }
+    }
+}
+#endif
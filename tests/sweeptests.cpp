@@ -0,0 +1,99 @@
+// Sweep: batched evaluation over many samples, checked sample by sample
+// against plain evaluation.
+
+#include "testing.h"
+#include "testgraphs.h"
+#include "sweep.h"
+#include <sstream>
+
+using namespace TestGraphs;
+using namespace NodeConstructors;
+
+// the rows of the binary output, false when it is malformed
+static bool readBinary(const std::string &s, size_t columnCount, std::vector<std::vector<float>> *rows)
+{
+    size_t pos = 0;
+    auto read = [&](void *p, size_t size) {
+        if (pos + size > s.size())
+            return false;
+        memcpy(p, s.data() + pos, size);
+        pos += size;
+        return true;
+    };
+    char magic[8];
+    uint32_t columns = 0;
+    if (!read(magic, 8) || memcmp(magic, "NSWEEP01", 8) || !read(&columns, 4) || columns != columnCount)
+        return false;
+    for (uint32_t i = 0; i < columns; ++i) {
+        uint32_t length = 0;
+        if (!read(&length, 4) || pos + length > s.size())
+            return false;
+        pos += length;
+    }
+    for (;;) {
+        uint32_t count = 0;
+        if (!read(&count, 4))
+            return false;
+        if (!count)
+            return pos == s.size();
+        const size_t first = rows->size();
+        rows->resize(first + count, std::vector<float>(columns));
+        for (uint32_t c = 0; c < columns; ++c) {
+            for (uint32_t r = 0; r < count; ++r) {
+                if (!read(&(*rows)[first + r][c], 4))
+                    return false;
+            }
+        }
+    }
+}
+
+TEST(sweep_matches_sample_by_sample_evaluation)
+{
+    Graph g;
+    const Id a = constant(g, glm::vec3(1.0f, 2.0f, 3.0f));
+    const Id b = constant(g, glm::vec3(-1.0f, 0.5f, 0.25f));
+    const Id f = constant(g, 0.5f);
+    const Id length = op(g, constructLengthNode, op(g, constructMulNode, a, f));
+    const Id cross = op(g, constructCrossNode, op(g, constructNormalizeNode, a), b);
+    const Id dot = op(g, constructDotNode, b, b); // not varied by a or f
+
+    Sweep::Spec spec;
+    spec.parameters.push_back({ a, 0, Sweep::Parameter::Grid, -1.0f, 1.0f, 7, 0 });
+    spec.parameters.push_back({ f, 0, Sweep::Parameter::Grid, 0.5f, 2.0f, 5, 0 });
+    spec.parameters.push_back({ b, 2, Sweep::Parameter::Random, -3.0f, 3.0f, 0, 0 });
+    spec.samplesPerPoint = 3;
+    spec.seed = 22;
+    spec.outputs = { length, cross, dot };
+    Sweep::Options options;
+    options.format = Sweep::Format::Binary;
+    options.threadCount = 3;
+    options.laneCount = 16; // the last batch of each block only partly used
+    options.blockSize = 40;
+
+    std::ostringstream out;
+    const Sweep::Result sweep = Sweep::run(g, spec, options, out);
+    CHECK(sweep.ok && sweep.sampleCount == 7 * 5 * 3);
+    std::vector<std::vector<float>> rows;
+    CHECK(readBinary(out.str(), 3 + 1 + 3 + 1, &rows));
+    CHECK(rows.size() == sweep.sampleCount);
+
+    const glm::vec3 a0 = std::get<PortDataVec3>(reference(g, a).d).v;
+    const glm::vec3 b0 = std::get<PortDataVec3>(reference(g, b).d).v;
+    CHECK(a0 == glm::vec3(1.0f, 2.0f, 3.0f) && b0 == glm::vec3(-1.0f, 0.5f, 0.25f)); // left alone
+    for (const std::vector<float> &row : rows) {
+        setValue(g, a, PortDataVec3 { glm::vec3(row[0], a0.y, a0.z) });
+        setValue(g, f, PortDataFloat { row[1] });
+        setValue(g, b, PortDataVec3 { glm::vec3(b0.x, b0.y, row[2]) });
+        CHECK(row[2] >= -3.0f && row[2] < 3.0f);
+        GraphEval::Plan plan;
+        GraphEval::compile(g, plan);
+        GraphEval::run(g, plan, GraphEval::UpdateMode::Full);
+        PortData values[3];
+        values[0].d = PortDataFloat { row[3] };
+        values[1].d = PortDataVec3 { glm::vec3(row[4], row[5], row[6]) };
+        values[2].d = PortDataFloat { row[7] };
+        CHECK(same(values[0], result(g, plan, length)));
+        CHECK(same(values[1], result(g, plan, cross)));
+        CHECK(same(values[2], result(g, plan, dot)));
+    }
+}
@@ -0,0 +1,392 @@
+#ifndef TESTGRAPHS_H
+#define TESTGRAPHS_H
+
+#include "graph.h"
+#include "grapheval.h"
+#include "nodeconstructors.h"
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <variant>
+
+// Building graphs in tests, and the reference their evaluation is checked
+// against.
+namespace TestGraphs {
+
+inline Id outputPort(const Graph &g, Id node)
+{
+    for (const Port &port : g.node(node).ports) {
+        if (port.dir == PortDirection::Output)
+            return port.id;
+    }
+    return 0;
+}
+
+inline Id inputPort(const Graph &g, Id node, int order)
+{
+    for (const Port &port : g.node(node).ports) {
+        if (port.dir == PortDirection::Input && port.order == order)
+            return port.id;
+    }
+    return 0;
+}
+
+inline Port &staticPort(Graph &g, Id node, int order = -1)
+{
+    for (Port &port : g.node(node).ports) {
+        if (port.dir == PortDirection::Static && (order < 0 || port.order == order))
+            return port;
+    }
+    return g.node(node).ports.front();
+}
+
+// the output of from into input order of to, 0 when refused
+inline Id connect(Graph &g, Id from, Id to, int order)
+{
+    return g.addConnection(from, outputPort(g, from), to, inputPort(g, to, order));
+}
+
+// a constant node holding v
+inline Id constant(Graph &g, float v)
+{
+    const Id n = NodeConstructors::constructFloatNode(&g);
+    staticPort(g, n).data.d = PortDataFloat { v };
+    g.staticPortChanged(g.node(n));
+    return n;
+}
+
+inline Id constant(Graph &g, const glm::vec3 &v)
+{
+    const Id n = NodeConstructors::constructVec3Node(&g);
+    staticPort(g, n).data.d = PortDataVec3 { v };
+    g.staticPortChanged(g.node(n));
+    return n;
+}
+
+inline Id constant(Graph &g, const glm::vec4 &v)
+{
+    const Id n = NodeConstructors::constructVec4Node(&g);
+    staticPort(g, n).data.d = PortDataVec4 { v };
+    g.staticPortChanged(g.node(n));
+    return n;
+}
+
+inline Id constant(Graph &g, const glm::mat4 &m)
+{
+    const Id n = NodeConstructors::constructMat4Node(&g);
+    staticPort(g, n).data.d = PortDataMat4 { m, false };
+    g.staticPortChanged(g.node(n));
+    return n;
+}
+
+inline void setValue(Graph &g, Id node, const PortDataVar &d)
+{
+    staticPort(g, node).data.d = d;
+    g.staticPortChanged(g.node(node));
+}
+
+// a node of type op with its inputs connected to the given nodes
+inline Id op(Graph &g, Id (*construct)(Graph *), Id a, Id b = 0)
+{
+    const Id n = construct(&g);
+    connect(g, a, n, 0);
+    if (b)
+        connect(g, b, n, 1);
+    return n;
+}
+
+// A random DAG of vec3 and float operations over a few constants, the
+// same for a given seed.
+struct RandomGraph
+{
+    std::vector<Id> vec3s;
+    std::vector<Id> floats;
+
+    RandomGraph(Graph &g, size_t nodeCount, unsigned seed)
+    {
+        std::mt19937 rng(seed);
+        for (int i = 0; i < 4; ++i) {
+            vec3s.push_back(constant(g, glm::vec3(i + 1, 0.5f * i, 1.0f - i)));
+            floats.push_back(constant(g, 0.25f * i + 1.0f));
+        }
+        auto vec3 = [&] { return vec3s[rng() % vec3s.size()]; };
+        auto scalar = [&] { return floats[rng() % floats.size()]; };
+        for (size_t i = 0; i < nodeCount; ++i) {
+            switch (rng() % 6) {
+            case 0:
+                vec3s.push_back(op(g, NodeConstructors::constructPlusNode, vec3(), vec3()));
+                break;
+            case 1:
+                vec3s.push_back(op(g, NodeConstructors::constructMulNode, vec3(), scalar()));
+                break;
+            case 2:
+                vec3s.push_back(op(g, NodeConstructors::constructNormalizeNode, vec3()));
+                break;
+            case 3:
+                floats.push_back(op(g, NodeConstructors::constructDotNode, vec3(), vec3()));
+                break;
+            case 4:
+                vec3s.push_back(op(g, NodeConstructors::constructCrossNode, vec3(), vec3()));
+                break;
+            default:
+                floats.push_back(op(g, NodeConstructors::constructLengthNode, vec3()));
+                break;
+            }
+        }
+    }
+};
+
+// The result of node as computed by the plan's last run.
+inline PortData result(const Graph &g, const GraphEval::Plan &plan, Id node)
+{
+    return GraphEval::result(plan, outputPort(g, node));
+}
+
+// Evaluates node by walking its upstream recursively with glm, the way
+// the original interpreter did, with none of the machinery under test.
+// Covers the constants, Swizzle with xyzw and the arithmetic, geometric
+// and matrix operations.
+namespace Reference {
+
+template<typename T> struct Wrap;
+template<> struct Wrap<float> { using Type = PortDataFloat; };
+template<> struct Wrap<glm::vec2> { using Type = PortDataVec2; };
+template<> struct Wrap<glm::vec3> { using Type = PortDataVec3; };
+template<> struct Wrap<glm::vec4> { using Type = PortDataVec4; };
+template<> struct Wrap<glm::mat3> { using Type = PortDataMat3; };
+template<> struct Wrap<glm::mat4> { using Type = PortDataMat4; };
+
+template<typename T> struct IsValue : std::false_type { };
+template<> struct IsValue<PortDataFloat> : std::true_type { };
+template<> struct IsValue<PortDataVec2> : std::true_type { };
+template<> struct IsValue<PortDataVec3> : std::true_type { };
+template<> struct IsValue<PortDataVec4> : std::true_type { };
+template<> struct IsValue<PortDataMat3> : std::true_type { };
+template<> struct IsValue<PortDataMat4> : std::true_type { };
+
+template<typename F, typename A, typename = void> struct Valid1 : std::false_type { };
+template<typename F, typename A>
+struct Valid1<F, A, std::void_t<typename Wrap<std::decay_t<decltype(std::declval<F>()(std::declval<A>()))>>::Type>> : std::true_type { };
+
+template<typename F, typename A, typename B, typename = void> struct Valid2 : std::false_type { };
+template<typename F, typename A, typename B>
+struct Valid2<F, A, B, std::void_t<typename Wrap<std::decay_t<decltype(std::declval<F>()(std::declval<A>(), std::declval<B>()))>>::Type>> : std::true_type { };
+
+template<typename T>
+inline PortDataVar wrap(const T &v)
+{
+    using D = typename Wrap<T>::Type;
+    if constexpr (std::is_same_v<D, PortDataMat3> || std::is_same_v<D, PortDataMat4>)
+        return D { v, false };
+    else
+        return D { v };
+}
+
+template<typename F>
+inline PortData apply(F f, const PortData &a)
+{
+    PortData r;
+    r.error = PortDataError::InvalidArgs;
+    std::visit([&](const auto &x) {
+        using X = std::decay_t<decltype(x)>;
+        if constexpr (IsValue<X>::value) {
+            if constexpr (Valid1<F, decltype(x.v)>::value) {
+                r.d = wrap(f(x.v));
+                r.error = PortDataError::None;
+            }
+        }
+    }, a.d);
+    return r;
+}
+
+template<typename F>
+inline PortData apply(F f, const PortData &a, const PortData &b)
+{
+    PortData r;
+    r.error = PortDataError::InvalidArgs;
+    std::visit([&](const auto &x, const auto &y) {
+        using X = std::decay_t<decltype(x)>;
+        using Y = std::decay_t<decltype(y)>;
+        if constexpr (IsValue<X>::value && IsValue<Y>::value) {
+            if constexpr (Valid2<F, decltype(x.v), decltype(y.v)>::value) {
+                r.d = wrap(f(x.v, y.v));
+                r.error = PortDataError::None;
+            }
+        }
+    }, a.d, b.d);
+    return r;
+}
+
+// glm's geometric functions take anything and fail to compile on what
+// is not a vector, these only take vectors
+struct Length { template<int N> float operator()(const glm::vec<N, float> &a) const { return glm::length(a); } };
+struct Distance { template<int N> float operator()(const glm::vec<N, float> &a, const glm::vec<N, float> &b) const { return glm::distance(a, b); } };
+struct Dot { template<int N> float operator()(const glm::vec<N, float> &a, const glm::vec<N, float> &b) const { return glm::dot(a, b); } };
+struct Normalize { template<int N> glm::vec<N, float> operator()(const glm::vec<N, float> &a) const { return glm::normalize(a); } };
+
+inline PortData swizzle(const PortData &a, const std::string &s)
+{
+    float src[4] = {};
+    int srcCount = 0;
+    if (auto *v = std::get_if<PortDataVec2>(&a.d)) {
+        memcpy(src, &v->v, sizeof(v->v));
+        srcCount = 2;
+    } else if (auto *v = std::get_if<PortDataVec3>(&a.d)) {
+        memcpy(src, &v->v, sizeof(v->v));
+        srcCount = 3;
+    } else if (auto *v = std::get_if<PortDataVec4>(&a.d)) {
+        memcpy(src, &v->v, sizeof(v->v));
+        srcCount = 4;
+    }
+    PortData r;
+    if (!srcCount || s.empty() || s.size() > 4) {
+        r.error = PortDataError::InvalidArgs;
+        return r;
+    }
+    float c[4] = {};
+    for (size_t i = 0; i < s.size(); ++i) {
+        const int index = s[i] == 'w' ? 3 : s[i] - 'x';
+        c[i] = index >= 0 && index < srcCount ? src[index] : 0.0f;
+    }
+    switch (s.size()) {
+    case 1:
+        r.d = PortDataFloat { c[0] };
+        break;
+    case 2:
+        r.d = PortDataVec2 { glm::vec2(c[0], c[1]) };
+        break;
+    case 3:
+        r.d = PortDataVec3 { glm::vec3(c[0], c[1], c[2]) };
+        break;
+    default:
+        r.d = PortDataVec4 { glm::vec4(c[0], c[1], c[2], c[3]) };
+        break;
+    }
+    return r;
+}
+
+} // namespace
+
+inline PortData reference(const Graph &g, Id id)
+{
+    using namespace Reference;
+    const Node &n(g.node(id));
+    if (n.isConstant()) {
+        for (const Port &port : n.ports) {
+            if (port.dir == PortDirection::Static)
+                return port.data;
+        }
+    }
+
+    const auto sources = g.orderedSourceNodesForNode(id);
+    PortData args[4];
+    if (sources.size() != n.descriptor().inputPortCount) {
+        PortData r;
+        r.error = PortDataError::NotEnoughArgs;
+        return r;
+    }
+    for (size_t i = 0; i < sources.size(); ++i) {
+        args[i] = reference(g, sources[i].first);
+        if (args[i].error != PortDataError::None) {
+            PortData r;
+            r.error = args[i].error;
+            return r;
+        }
+    }
+
+    switch (n.type) {
+    case NodeType::Plus:
+        return apply([](const auto &a, const auto &b) -> decltype(a + b) { return a + b; }, args[0], args[1]);
+    case NodeType::Minus:
+        return apply([](const auto &a, const auto &b) -> decltype(a - b) { return a - b; }, args[0], args[1]);
+    case NodeType::Mul:
+        return apply([](const auto &a, const auto &b) -> decltype(a * b) { return a * b; }, args[0], args[1]);
+    case NodeType::Div:
+        return apply([](const auto &a, const auto &b) -> decltype(a / b) { return a / b; }, args[0], args[1]);
+    case NodeType::Negate:
+        return apply([](const auto &a) -> decltype(-a) { return -a; }, args[0]);
+    case NodeType::Length:
+        return apply(Length(), args[0]);
+    case NodeType::Distance:
+        return apply(Distance(), args[0], args[1]);
+    case NodeType::Dot:
+        return apply(Dot(), args[0], args[1]);
+    case NodeType::Cross:
+        return apply([](const glm::vec3 &a, const glm::vec3 &b) { return glm::cross(a, b); }, args[0], args[1]);
+    case NodeType::Normalize:
+        return apply(Normalize(), args[0]);
+    case NodeType::Transpose:
+        return apply([](const auto &a) -> decltype(glm::transpose(a)) { return glm::transpose(a); }, args[0]);
+    case NodeType::Inverse:
+        return apply([](const auto &a) -> decltype(glm::inverse(a)) { return glm::inverse(a); }, args[0]);
+    case NodeType::Determinant:
+        return apply([](const auto &a) -> decltype(glm::determinant(a)) { return glm::determinant(a); }, args[0]);
+    case NodeType::Swizzle:
+        for (const Port &port : n.ports) {
+            if (port.dir == PortDirection::Static)
+                return swizzle(args[0], std::get<PortDataString>(port.data.d).v);
+        }
+        break;
+    default:
+        break;
+    }
+    PortData r;
+    r.error = PortDataError::InvalidArgs;
+    return r;
+}
+
+// The same type, error and value, each float within tolerance relative to
+// the larger magnitude (or absolute below 1), bit for bit when tolerance is
+// 0. Infinities only match themselves, NaNs only match NaNs.
+inline bool same(const PortData &a, const PortData &b, float tolerance = 0.0f)
+{
+    if (a.error != b.error || a.d.index() != b.d.index())
+        return false;
+    bool equal = true;
+    std::visit([&](const auto &x) {
+        using X = std::decay_t<decltype(x)>;
+        if constexpr (Reference::IsValue<X>::value) {
+            const auto &y = std::get<X>(b.d);
+            const float *p = reinterpret_cast<const float *>(&x.v);
+            const float *q = reinterpret_cast<const float *>(&y.v);
+            for (size_t i = 0; i < sizeof(x.v) / sizeof(float); ++i) {
+                if (std::isnan(p[i]) || std::isnan(q[i]))
+                    equal = equal && std::isnan(p[i]) && std::isnan(q[i]);
+                else if (tolerance == 0.0f)
+                    equal = equal && !memcmp(&p[i], &q[i], sizeof(float));
+                else
+                    equal = equal && (p[i] == q[i] || std::fabs(p[i] - q[i]) <= tolerance * std::max(1.0f, std::max(std::fabs(p[i]), std::fabs(q[i]))));
+            }
+        } else if constexpr (std::is_same_v<X, PortDataString>) {
+            equal = x.v == std::get<X>(b.d).v;
+        }
+    }, a.d);
+    return equal;
+}
+
+// every output of the plan against reference()
+inline bool matchesReference(const Graph &g, const GraphEval::Plan &plan, float tolerance = 1e-5f)
+{
+    for (const Node &n : g.nodes) {
+        const Id port = outputPort(g, n.id);
+        if (port && plan.outputValues.count(port) && !same(GraphEval::result(plan, port), reference(g, n.id), tolerance))
+            return false;
+    }
+    return true;
+}
+
+// the outputs of nodes, which reference() has to cover
+inline bool matchesReference(const Graph &g, const GraphEval::Plan &plan, const std::vector<Id> &nodes, float tolerance = 1e-5f)
+{
+    for (Id id : nodes) {
+        if (!same(GraphEval::result(plan, outputPort(g, id)), reference(g, id), tolerance))
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
+#endif
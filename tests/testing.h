@@ -0,0 +1,50 @@
+#ifndef TESTING_H
+#define TESTING_H
+
+#include <cstdio>
+
+// Just enough of a test framework for nodetests: TEST(name) defines a test
+// case that registers itself, CHECK(condition) reports a failure and lets
+// the test go on.
+namespace Testing {
+
+struct Case
+{
+    const char *name;
+    void (*run)();
+    Case *next;
+};
+
+Case *&cases();
+int &failureCount();
+
+struct Registration
+{
+    Registration(Case *c)
+    {
+        c->next = cases();
+        cases() = c;
+    }
+};
+
+inline void fail(const char *file, int line, const char *condition)
+{
+    ++failureCount();
+    fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, condition);
+}
+
+} // namespace
+
+#define TEST(name) \
+    static void test_##name(); \
+    static Testing::Case testCase_##name = { #name, test_##name, nullptr }; \
+    static Testing::Registration testRegistration_##name(&testCase_##name); \
+    static void test_##name()
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) \
+            Testing::fail(__FILE__, __LINE__, #condition); \
+    } while (false)
+
+#endif
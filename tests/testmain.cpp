@@ -0,0 +1,50 @@
+// nodetests: headless tests of the graph, its evaluation and the code
+// that does not need Qt. Runs all tests, or those whose name contains the
+// first argument.
+
+#include "testing.h"
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+namespace Testing {
+
+Case *&cases()
+{
+    static Case *first = nullptr;
+    return first;
+}
+
+int &failureCount()
+{
+    static int count = 0;
+    return count;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const char *filter = argc > 1 ? argv[1] : nullptr;
+
+    // registration order differs between translation units, run by name
+    std::vector<Testing::Case *> cases;
+    for (Testing::Case *c = Testing::cases(); c; c = c->next) {
+        if (!filter || strstr(c->name, filter))
+            cases.push_back(c);
+    }
+    std::sort(cases.begin(), cases.end(), [](const Testing::Case *a, const Testing::Case *b) {
+        return strcmp(a->name, b->name) < 0;
+    });
+
+    int failedCases = 0;
+    for (Testing::Case *c : cases) {
+        const int failuresBefore = Testing::failureCount();
+        c->run();
+        const bool ok = Testing::failureCount() == failuresBefore;
+        failedCases += !ok;
+        printf("%s %s\n", ok ? "ok  " : "FAIL", c->name);
+    }
+    printf("%zu tests, %d failed\n", cases.size(), failedCases);
+    return failedCases ? 1 : 0;
+}
@@ -0,0 +1,83 @@
+// EvalWorker: results computed on the worker thread, checked against the
+// reference interpreter in testgraphs.h.
+
+#include "testing.h"
+#include "testgraphs.h"
+#include "evalworker.h"
+#include <chrono>
+
+using namespace TestGraphs;
+using namespace NodeConstructors;
+
+// the results of the last submit(), or whatever came back within a few seconds
+static const EvalResults &latestResults(EvalWorker &worker)
+{
+    for (int i = 0; i < 5000 && worker.lag(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        worker.results();
+    }
+    return worker.results();
+}
+
+// nodes, which reference() has to cover, have results matching it
+static bool matchesReference(const Graph &g, const EvalResults &r, const std::vector<Id> &nodes)
+{
+    for (Id id : nodes) {
+        auto it = r.outputs.find(outputPort(g, id));
+        if (it == r.outputs.end() || !same(it->second, reference(g, id), 1e-5f))
+            return false;
+    }
+    return true;
+}
+
+// sum is the Sum of 0, 1, ... 999 times length
+static bool sumMatches(const Graph &g, const EvalResults &r, Id sum, Id length)
+{
+    auto it = r.outputs.find(outputPort(g, sum));
+    if (it == r.outputs.end() || it->second.error != PortDataError::None)
+        return false;
+    const float expected = 499500.0f * std::get<PortDataFloat>(reference(g, length).d).v;
+    return std::fabs(std::get<PortDataFloat>(it->second.d).v - expected) <= 1e-5f * expected;
+}
+
+TEST(worker_results_match_reference)
+{
+    Graph g;
+    const Id a = constant(g, glm::vec3(1.0f, 2.0f, 3.0f));
+    const Id b = constant(g, glm::vec3(-1.0f, 0.5f, 2.0f));
+    const Id cross = op(g, constructCrossNode, a, b);
+    const Id plus = op(g, constructPlusNode, cross, a);
+    const Id length = op(g, constructLengthNode, plus);
+    const std::vector<Id> vectorNodes { a, b, cross, plus, length };
+
+    FloatArray elements;
+    elements.resize(1000);
+    for (size_t i = 0; i < elements.count; ++i)
+        elements.set(i, float(i));
+    const Id array = constructFloatNode(&g);
+    setValue(g, array, PortDataFloatArray { elements });
+    const Id sum = op(g, constructSumNode, op(g, constructMulNode, array, length));
+
+    EvalWorker worker;
+    worker.submit(g);
+    const EvalResults &r(latestResults(worker));
+    CHECK(!worker.lag());
+    CHECK(r.topologyVersion == g.topologyVersion);
+    CHECK(matchesReference(g, r, vectorNodes));
+
+    // arrays come by size only
+    auto it = r.arrays.find(outputPort(g, array));
+    CHECK(it != r.arrays.end() && it->second.type == PortDataType::FloatArray && it->second.count == 1000);
+    CHECK(!r.outputs.count(outputPort(g, array)));
+    CHECK(sumMatches(g, r, sum, length));
+
+    // edits go over as values, without a new snapshot
+    setValue(g, b, PortDataVec3 { glm::vec3(4.0f, -2.0f, 0.0f) });
+    const uint64_t topologyVersion = g.topologyVersion;
+    worker.submit(g);
+    const EvalResults &edited(latestResults(worker));
+    CHECK(!worker.lag());
+    CHECK(edited.topologyVersion == topologyVersion);
+    CHECK(matchesReference(g, edited, vectorNodes));
+    CHECK(sumMatches(g, edited, sum, length));
+}
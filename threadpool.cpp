@@ -0,0 +1,136 @@
+#include "threadpool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(int workerCount)
+{
+    if (workerCount < 0)
+        workerCount = std::max(1, int(std::thread::hardware_concurrency())) - 1;
+
+    queues.reset(new Queue[size_t(workerCount) + 1]);
+    workers.reserve(size_t(workerCount));
+    for (int i = 0; i < workerCount; ++i)
+        workers.emplace_back(&ThreadPool::workerMain, this, size_t(i) + 1);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(jobLock);
+        quit = true;
+    }
+    jobStarted.notify_all();
+    for (std::thread &t : workers)
+        t.join();
+}
+
+ThreadPool &ThreadPool::instance()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::parallelFor(size_t count, size_t grainSize, RangeFunc f, void *context)
+{
+    grainSize = std::max<size_t>(1, grainSize);
+    if (workers.empty() || count <= grainSize) {
+        if (count)
+            f(context, 0, count);
+        return;
+    }
+
+    // initial even split, stealing evens out the rest
+    const size_t n = threadCount();
+    const size_t share = (count + n - 1) / n;
+    for (size_t i = 0; i < n; ++i) {
+        std::lock_guard<std::mutex> guard(queues[i].lock);
+        queues[i].begin = std::min(count, i * share);
+        queues[i].end = std::min(count, (i + 1) * share);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(jobLock);
+        jobFunc = f;
+        jobContext = context;
+        jobGrainSize = grainSize;
+        busyWorkers = workers.size();
+        ++jobSerial;
+    }
+    jobStarted.notify_all();
+
+    work(0);
+
+    std::unique_lock<std::mutex> guard(jobLock);
+    jobFinished.wait(guard, [this] { return busyWorkers == 0; });
+}
+
+bool ThreadPool::take(size_t q, size_t *begin, size_t *end)
+{
+    Queue &queue(queues[q]);
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.begin == queue.end)
+        return false;
+    *begin = queue.begin;
+    *end = std::min(queue.end, queue.begin + jobGrainSize);
+    queue.begin = *end;
+    return true;
+}
+
+bool ThreadPool::steal(size_t q)
+{
+    const size_t n = threadCount();
+    for (size_t i = 1; i < n; ++i) {
+        Queue &victim(queues[(q + i) % n]);
+        size_t begin, end;
+        {
+            std::lock_guard<std::mutex> guard(victim.lock);
+            const size_t remaining = victim.end - victim.begin;
+            if (remaining == 0)
+                continue;
+            const size_t half = std::max<size_t>(1, remaining / 2);
+            begin = victim.end - half;
+            end = victim.end;
+            victim.end = begin;
+        }
+        Queue &queue(queues[q]);
+        std::lock_guard<std::mutex> guard(queue.lock);
+        queue.begin = begin;
+        queue.end = end;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::work(size_t q)
+{
+    size_t begin, end;
+    for (;;) {
+        if (take(q, &begin, &end))
+            jobFunc(jobContext, begin, end);
+        else if (!steal(q))
+            break;
+    }
+}
+
+void ThreadPool::workerMain(size_t q)
+{
+    uint64_t seenJobSerial = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard(jobLock);
+            jobStarted.wait(guard, [this, seenJobSerial] { return quit || jobSerial != seenJobSerial; });
+            if (quit)
+                return;
+            seenJobSerial = jobSerial;
+        }
+
+        work(q);
+
+        bool last;
+        {
+            std::lock_guard<std::mutex> guard(jobLock);
+            last = --busyWorkers == 0;
+        }
+        if (last)
+            jobFinished.notify_one();
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <cstdint>
+
+// Fixed set of worker threads executing parallelFor() jobs. Every thread
+// (including the caller, which always takes part) owns a queue holding a
+// contiguous index range, takes grain sized chunks from its front, and
+// steals half of the remaining range of another queue when it runs dry.
+// Not reentrant: the range function must not call parallelFor() itself.
+struct ThreadPool
+{
+    // -1 = one less than the number of hardware threads
+    explicit ThreadPool(int workerCount = -1);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    using RangeFunc = void (*)(void *context, size_t begin, size_t end);
+
+    // number of threads taking part in a job, including the caller
+    size_t threadCount() const { return workers.size() + 1; }
+
+    // calls f for disjoint chunks covering [0, count) and returns when all are done
+    void parallelFor(size_t count, size_t grainSize, RangeFunc f, void *context);
+
+    static ThreadPool &instance();
+
+private:
+    struct Queue
+    {
+        std::mutex lock;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    bool take(size_t q, size_t *begin, size_t *end);
+    bool steal(size_t q);
+    void work(size_t q);
+    void workerMain(size_t q);
+
+    std::vector<std::thread> workers;
+    std::unique_ptr<Queue[]> queues;
+
+    std::mutex jobLock;
+    std::condition_variable jobStarted;
+    std::condition_variable jobFinished;
+    uint64_t jobSerial = 0;
+    size_t busyWorkers = 0;
+    bool quit = false;
+
+    RangeFunc jobFunc = nullptr;
+    void *jobContext = nullptr;
+    size_t jobGrainSize = 1;
+};
+
+#endif
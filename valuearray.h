@@ -0,0 +1,125 @@
+#ifndef VALUEARRAY_H
+#define VALUEARRAY_H
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <new>
+#include <cstddef>
+#include "glm/gtc/type_ptr.hpp"
+
+// cache line aligned storage for std::vector
+template<typename T, size_t ALIGNMENT = 64>
+struct AlignedAllocator
+{
+    using value_type = T;
+    template<typename U> struct rebind { using other = AlignedAllocator<U, ALIGNMENT>; };
+
+    AlignedAllocator() = default;
+    template<typename U> AlignedAllocator(const AlignedAllocator<U, ALIGNMENT> &) { }
+
+    T *allocate(size_t n)
+    {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(ALIGNMENT)));
+    }
+
+    void deallocate(T *p, size_t)
+    {
+        ::operator delete(p, std::align_val_t(ALIGNMENT));
+    }
+
+    template<typename U> bool operator==(const AlignedAllocator<U, ALIGNMENT> &) const { return true; }
+    template<typename U> bool operator!=(const AlignedAllocator<U, ALIGNMENT> &) const { return false; }
+};
+
+// An array of float, vec2, vec3, vec4 or mat4 elements stored as a
+// structure of arrays: one run of floats per component (column-major for
+// matrices), each starting on a cache line, stride floats apart. Loops
+// over the elements read and write whole SIMD registers of a component at
+// a time, which the compiler vectorizes. The runs are padded to a
+// multiple of 16 floats.
+//
+// A view has its components in memory owned by someone else, like a
+// slice of a larger array or a mapped file, which owner keeps alive if
+// set. The padding after its last element must be readable.
+template<typename T>
+struct ValueArray
+{
+    static constexpr int COMPONENTS = int(sizeof(T) / sizeof(float));
+    static constexpr size_t PADDING = 16;
+
+    size_t count = 0;
+    size_t stride = 0;
+    float *external = nullptr; // the first component of a view
+    std::shared_ptr<const void> owner;
+    std::vector<float, AlignedAllocator<float>> data;
+
+    static ValueArray view(float *first, size_t stride, size_t count, std::shared_ptr<const void> owner = nullptr)
+    {
+        ValueArray a;
+        a.count = count;
+        a.stride = stride;
+        a.external = first;
+        a.owner = std::move(owner);
+        return a;
+    }
+
+    // Makes room for n elements. The contents are kept unless the stride
+    // has to grow, so a kernel writing every element never allocates in
+    // steady state. A view becomes an array of its own.
+    void resize(size_t n)
+    {
+        count = n;
+        const size_t padded = (n + PADDING - 1) / PADDING * PADDING;
+        if (external || padded > stride) {
+            external = nullptr;
+            owner.reset();
+            stride = padded;
+            data.assign(COMPONENTS * stride, 0.0f);
+        }
+    }
+
+    // an array of its own with the same elements, views included
+    ValueArray copy() const
+    {
+        ValueArray a;
+        a.resize(count);
+        for (int c = 0; c < COMPONENTS; ++c)
+            std::copy_n(component(c), count, a.component(c));
+        return a;
+    }
+
+    // the same elements without depending on memory owned by someone
+    // else: views are copied, unless their owner is known
+    ValueArray detached() const
+    {
+        return external && !owner ? copy() : *this;
+    }
+
+    float *component(int c) { return (external ? external : data.data()) + c * stride; }
+    const float *component(int c) const { return (external ? external : data.data()) + c * stride; }
+
+    T at(size_t i) const
+    {
+        T v;
+        float *f = reinterpret_cast<float *>(&v);
+        for (int c = 0; c < COMPONENTS; ++c)
+            f[c] = component(c)[i];
+        return v;
+    }
+
+    void set(size_t i, const T &v)
+    {
+        const float *f = reinterpret_cast<const float *>(&v);
+        for (int c = 0; c < COMPONENTS; ++c)
+            component(c)[i] = f[c];
+    }
+};
+
+using FloatArray = ValueArray<float>;
+using Vec2Array = ValueArray<glm::vec2>;
+using Vec3Array = ValueArray<glm::vec3>;
+using Vec4Array = ValueArray<glm::vec4>;
+using Mat4Array = ValueArray<glm::mat4>;
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef VALUESTORE_H
+#define VALUESTORE_H
+
+#include "portdata.h"
+#include <vector>
+
+template<typename T> struct ValueTraits;
+template<> struct ValueTraits<float> { using Data = PortDataFloat; static constexpr PortDataType type = PortDataType::Float; };
+template<> struct ValueTraits<glm::vec2> { using Data = PortDataVec2; static constexpr PortDataType type = PortDataType::Vec2; };
+template<> struct ValueTraits<glm::vec3> { using Data = PortDataVec3; static constexpr PortDataType type = PortDataType::Vec3; };
+template<> struct ValueTraits<glm::vec4> { using Data = PortDataVec4; static constexpr PortDataType type = PortDataType::Vec4; };
+template<> struct ValueTraits<glm::mat3> { using Data = PortDataMat3; static constexpr PortDataType type = PortDataType::Mat3; };
+template<> struct ValueTraits<glm::mat4> { using Data = PortDataMat4; static constexpr PortDataType type = PortDataType::Mat4; };
+template<> struct ValueTraits<FloatArray> { using Data = PortDataFloatArray; static constexpr PortDataType type = PortDataType::FloatArray; };
+template<> struct ValueTraits<Vec2Array> { using Data = PortDataVec2Array; static constexpr PortDataType type = PortDataType::Vec2Array; };
+template<> struct ValueTraits<Vec3Array> { using Data = PortDataVec3Array; static constexpr PortDataType type = PortDataType::Vec3Array; };
+template<> struct ValueTraits<Vec4Array> { using Data = PortDataVec4Array; static constexpr PortDataType type = PortDataType::Vec4Array; };
+template<> struct ValueTraits<Mat4Array> { using Data = PortDataMat4Array; static constexpr PortDataType type = PortDataType::Mat4Array; };
+
+// Evaluation results in one densely packed array per value type. A value
+// is a slot in the array of its type plus an error code. Pointers to
+// values are invalidated by add() and clear(), so all values are added up
+// front. PortData, with its runtime type tests, is only produced for
+// display by portData(). Array values are a ValueArray each, with their
+// elements in storage of their own that stays put when values are added.
+struct ValueStore
+{
+    template<typename T>
+    using Array = std::vector<T, AlignedAllocator<T>>;
+
+    struct Value
+    {
+        PortDataType type;
+        uint32_t slot; // in the array of type, unused for Empty
+    };
+
+    std::vector<Value> values;
+    std::vector<PortDataError> errors; // parallel to values
+    Array<float> floats;
+    Array<glm::vec2> vec2s;
+    Array<glm::vec3> vec3s;
+    Array<glm::vec4> vec4s;
+    Array<glm::mat3> mat3s;
+    Array<glm::mat4> mat4s;
+    std::vector<FloatArray> floatArrays;
+    std::vector<Vec2Array> vec2Arrays;
+    std::vector<Vec3Array> vec3Arrays;
+    std::vector<Vec4Array> vec4Arrays;
+    std::vector<Mat4Array> mat4Arrays;
+
+    void clear()
+    {
+        values.clear();
+        errors.clear();
+        floats.clear();
+        vec2s.clear();
+        vec3s.clear();
+        vec4s.clear();
+        mat3s.clear();
+        mat4s.clear();
+        floatArrays.clear();
+        vec2Arrays.clear();
+        vec3Arrays.clear();
+        vec4Arrays.clear();
+        mat4Arrays.clear();
+    }
+
+    // Returns the index of the new value. Empty and String values get no
+    // storage, they can only carry an error.
+    uint32_t add(PortDataType type)
+    {
+        uint32_t slot = 0;
+        switch (type) {
+        case PortDataType::Float:
+            slot = append(floats);
+            break;
+        case PortDataType::Vec2:
+            slot = append(vec2s);
+            break;
+        case PortDataType::Vec3:
+            slot = append(vec3s);
+            break;
+        case PortDataType::Vec4:
+            slot = append(vec4s);
+            break;
+        case PortDataType::Mat3:
+            slot = append(mat3s);
+            break;
+        case PortDataType::Mat4:
+            slot = append(mat4s);
+            break;
+        case PortDataType::FloatArray:
+            slot = append(floatArrays);
+            break;
+        case PortDataType::Vec2Array:
+            slot = append(vec2Arrays);
+            break;
+        case PortDataType::Vec3Array:
+            slot = append(vec3Arrays);
+            break;
+        case PortDataType::Vec4Array:
+            slot = append(vec4Arrays);
+            break;
+        case PortDataType::Mat4Array:
+            slot = append(mat4Arrays);
+            break;
+        default:
+            type = PortDataType::Empty;
+            break;
+        }
+        values.push_back({ type, slot });
+        errors.push_back(PortDataError::None);
+        return uint32_t(values.size() - 1);
+    }
+
+    // null for values without storage
+    void *pointer(uint32_t index)
+    {
+        const Value &v(values[index]);
+        switch (v.type) {
+        case PortDataType::Float:
+            return &floats[v.slot];
+        case PortDataType::Vec2:
+            return &vec2s[v.slot];
+        case PortDataType::Vec3:
+            return &vec3s[v.slot];
+        case PortDataType::Vec4:
+            return &vec4s[v.slot];
+        case PortDataType::Mat3:
+            return &mat3s[v.slot];
+        case PortDataType::Mat4:
+            return &mat4s[v.slot];
+        case PortDataType::FloatArray:
+            return &floatArrays[v.slot];
+        case PortDataType::Vec2Array:
+            return &vec2Arrays[v.slot];
+        case PortDataType::Vec3Array:
+            return &vec3Arrays[v.slot];
+        case PortDataType::Vec4Array:
+            return &vec4Arrays[v.slot];
+        case PortDataType::Mat4Array:
+            return &mat4Arrays[v.slot];
+        default:
+            return nullptr;
+        }
+    }
+
+    // elements of an array value, without copying them like portData()
+    size_t arraySize(uint32_t index) const
+    {
+        const Value &v(values[index]);
+        switch (v.type) {
+        case PortDataType::FloatArray:
+            return floatArrays[v.slot].count;
+        case PortDataType::Vec2Array:
+            return vec2Arrays[v.slot].count;
+        case PortDataType::Vec3Array:
+            return vec3Arrays[v.slot].count;
+        case PortDataType::Vec4Array:
+            return vec4Arrays[v.slot].count;
+        case PortDataType::Mat4Array:
+            return mat4Arrays[v.slot].count;
+        default:
+            return 0;
+        }
+    }
+
+    PortData portData(uint32_t index) const
+    {
+        const Value &v(values[index]);
+        PortData d;
+        d.error = errors[index];
+        if (d.error != PortDataError::None)
+            return d;
+        switch (v.type) {
+        case PortDataType::Float:
+            d.d = PortDataFloat { floats[v.slot] };
+            break;
+        case PortDataType::Vec2:
+            d.d = PortDataVec2 { vec2s[v.slot] };
+            break;
+        case PortDataType::Vec3:
+            d.d = PortDataVec3 { vec3s[v.slot] };
+            break;
+        case PortDataType::Vec4:
+            d.d = PortDataVec4 { vec4s[v.slot] };
+            break;
+        case PortDataType::Mat3:
+            d.d = PortDataMat3 { mat3s[v.slot], false };
+            break;
+        case PortDataType::Mat4:
+            d.d = PortDataMat4 { mat4s[v.slot], false };
+            break;
+        case PortDataType::FloatArray:
+            d.d = PortDataFloatArray { floatArrays[v.slot].detached() };
+            break;
+        case PortDataType::Vec2Array:
+            d.d = PortDataVec2Array { vec2Arrays[v.slot].detached() };
+            break;
+        case PortDataType::Vec3Array:
+            d.d = PortDataVec3Array { vec3Arrays[v.slot].detached() };
+            break;
+        case PortDataType::Vec4Array:
+            d.d = PortDataVec4Array { vec4Arrays[v.slot].detached() };
+            break;
+        case PortDataType::Mat4Array:
+            d.d = PortDataMat4Array { mat4Arrays[v.slot].detached() };
+            break;
+        default:
+            break;
+        }
+        return d;
+    }
+
+private:
+    template<typename A>
+    static uint32_t append(A &a)
+    {
+        a.emplace_back();
+        return uint32_t(a.size() - 1);
+    }
+};
+
+#endif